@@ -0,0 +1,189 @@
+#include "arena.h"
+#include <string.h>
+
+#define SLAB_SIZE (256 * 1024)
+
+// Roughly 1.5x apart so a line never wastes more than a third of its block.
+static const size_t classSizes[ARENA_CLASSES] = {32, 48, 64, 96, 128, 192, 256, 384, 512, 768, 1024, 1536, ARENA_MAX_CLASS};
+
+struct ArenaSlab {
+    ArenaSlab* next;
+    size_t size;
+};
+
+// Header in front of every large block so the arena can find them again when it is freed.
+struct ArenaLarge {
+    ArenaLarge* prev;
+    ArenaLarge* next;
+};
+
+static int classIndex(size_t size)
+{
+    for (int i = 0; i < ARENA_CLASSES; i++) {
+        if (size <= classSizes[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+Arena* createArena(void)
+{
+    Arena* arena = (Arena*)calloc(1, sizeof(Arena));
+    return arena;
+}
+
+void freeArena(Arena* arena)
+{
+    if (arena == NULL) {
+        return;
+    }
+    ArenaSlab* slab = arena->slabs;
+    while (slab != NULL) {
+        ArenaSlab* next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    ArenaLarge* large = arena->large;
+    while (large != NULL) {
+        ArenaLarge* next = large->next;
+        free(large);
+        large = next;
+    }
+    free(arena);
+}
+
+// Capacity actually handed out for a request of size bytes.
+size_t arenaBlockSize(size_t size)
+{
+    int index = classIndex(size);
+    return index < 0 ? size : classSizes[index];
+}
+
+// Capacity to grow a block of size bytes into: the next size class, or double once past the classes.
+size_t arenaNextSize(size_t size)
+{
+    int index = classIndex(size + 1);
+    return index < 0 ? size * 2 : classSizes[index];
+}
+
+static void* allocLarge(Arena* arena, size_t size)
+{
+    ArenaLarge* large = (ArenaLarge*)malloc(sizeof(ArenaLarge) + size);
+    if (large == NULL) {
+        return NULL;
+    }
+    large->prev = NULL;
+    large->next = arena->large;
+    if (arena->large != NULL) {
+        arena->large->prev = large;
+    }
+    arena->large = large;
+    return large + 1;
+}
+
+static void linkLarge(Arena* arena, ArenaLarge* large)
+{
+    if (large->prev != NULL) {
+        large->prev->next = large;
+    }
+    else {
+        arena->large = large;
+    }
+    if (large->next != NULL) {
+        large->next->prev = large;
+    }
+}
+
+static void freeLarge(Arena* arena, void* ptr)
+{
+    ArenaLarge* large = (ArenaLarge*)ptr - 1;
+    if (large->prev != NULL) {
+        large->prev->next = large->next;
+    }
+    else {
+        arena->large = large->next;
+    }
+    if (large->next != NULL) {
+        large->next->prev = large->prev;
+    }
+    free(large);
+}
+
+void* arenaAlloc(Arena* arena, size_t size)
+{
+    if (arena == NULL) {
+        return malloc(size);
+    }
+    int index = classIndex(size);
+    if (index < 0) {
+        return allocLarge(arena, size);
+    }
+    void* block = arena->freeLists[index];
+    if (block != NULL) {
+        arena->freeLists[index] = *(void**)block;
+        return block;
+    }
+    size_t blockSize = classSizes[index];
+    if (arena->remaining < blockSize) {
+        ArenaSlab* slab = (ArenaSlab*)malloc(SLAB_SIZE);
+        if (slab == NULL) {
+            return NULL;
+        }
+        slab->next = arena->slabs;
+        slab->size = SLAB_SIZE;
+        arena->slabs = slab;
+        arena->next = (char*)(slab + 1);
+        arena->remaining = SLAB_SIZE - sizeof(ArenaSlab);
+    }
+    block = arena->next;
+    arena->next += blockSize;
+    arena->remaining -= blockSize;
+    return block;
+}
+
+// Moves a block to a new size, keeping the first min(oldSize, newSize) bytes.
+void* arenaRealloc(Arena* arena, void* ptr, size_t oldSize, size_t newSize)
+{
+    if (arena == NULL) {
+        return realloc(ptr, newSize);
+    }
+    if (ptr != NULL && classIndex(oldSize) < 0 && classIndex(newSize) < 0) {
+        ArenaLarge* large = (ArenaLarge*)realloc((ArenaLarge*)ptr - 1, sizeof(ArenaLarge) + newSize);
+        if (large == NULL) {
+            return NULL;
+        }
+        linkLarge(arena, large);
+        return large + 1;
+    }
+    if (ptr != NULL && arenaBlockSize(oldSize) == arenaBlockSize(newSize)) {
+        return ptr;
+    }
+    void* block = arenaAlloc(arena, newSize);
+    if (block == NULL) {
+        return NULL;
+    }
+    if (ptr != NULL) {
+        memcpy(block, ptr, oldSize < newSize ? oldSize : newSize);
+        arenaFree(arena, ptr, oldSize);
+    }
+    return block;
+}
+
+void arenaFree(Arena* arena, void* ptr, size_t size)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    if (arena == NULL) {
+        free(ptr);
+        return;
+    }
+    int index = classIndex(size);
+    if (index < 0) {
+        freeLarge(arena, ptr);
+        return;
+    }
+    *(void**)ptr = arena->freeLists[index];
+    arena->freeLists[index] = ptr;
+}
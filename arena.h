@@ -0,0 +1,32 @@
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stdlib.h>
+
+// Document scoped allocator. Small blocks are carved out of large slabs and recycled through a free
+// list per size class. Blocks above the largest class go to malloc but are still tracked by the
+// arena, so freeArena releases everything at once.
+
+#define ARENA_CLASSES 13
+#define ARENA_MAX_CLASS 2048
+
+typedef struct ArenaSlab ArenaSlab;
+typedef struct ArenaLarge ArenaLarge;
+
+typedef struct {
+    ArenaSlab* slabs;
+    char* next;
+    size_t remaining;
+    void* freeLists[ARENA_CLASSES];
+    ArenaLarge* large;
+} Arena;
+
+Arena* createArena(void);
+void freeArena(Arena* arena);
+size_t arenaBlockSize(size_t size);
+size_t arenaNextSize(size_t size);
+void* arenaAlloc(Arena* arena, size_t size);
+void* arenaRealloc(Arena* arena, void* ptr, size_t oldSize, size_t newSize);
+void arenaFree(Arena* arena, void* ptr, size_t size);
+
+#endif
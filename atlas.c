@@ -0,0 +1,388 @@
+#define _POSIX_C_SOURCE 200809L
+#include "atlas.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define ATLAS_MAGIC "TXTATLS1"
+#define READY_SIZES 4
+#define QUEUED_SIZES 4
+#define FNV_OFFSET 14695981039346656037ull
+#define FNV_PRIME 1099511628211ull
+
+// Start of an atlas file, followed by width * height ARGB8888 pixels.
+typedef struct {
+    char magic[8];
+    uint64_t fontHash;
+    int32_t size;
+    int32_t glyphHeight;
+    int32_t width;
+    int32_t height;
+    Glyph_Rect solid;
+    Glyph_Rect rects[GLYPH_ASCII];
+} AtlasHeader;
+
+// A font opened at some size with its baked ASCII, waiting to be picked up.
+typedef struct {
+    int size;
+    TTF_Font* font;
+    Glyph_Image* image;
+} ReadyAtlas;
+
+struct AtlasCache {
+    char* fontFile;
+    // NULL when there is nowhere to keep the files, atlases are then baked every time.
+    char* directory;
+    uint64_t fontHash;
+    SDL_Thread* baker;
+    // Shared with the baker thread, guarded by lock.
+    SDL_mutex* lock;
+    SDL_cond* wake;
+    SDL_cond* baked;
+    int queue[QUEUED_SIZES];
+    int queueLength;
+    int baking;
+    ReadyAtlas ready[READY_SIZES];
+    int readyCount;
+    int quit;
+};
+
+static uint64_t hashBytes(uint64_t hash, const void* data, size_t length)
+{
+    const unsigned char* bytes = (const unsigned char*)data;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+// Hash of the font file and of the SDL_ttf it is rasterized with. 0 if the font cannot be read.
+static uint64_t hashFont(const char* fontFile)
+{
+    int fd = open(fontFile, O_RDONLY);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+    void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return 0;
+    }
+    int version[3] = {SDL_TTF_MAJOR_VERSION, SDL_TTF_MINOR_VERSION, SDL_TTF_PATCHLEVEL};
+    uint64_t hash = hashBytes(FNV_OFFSET, version, sizeof(version));
+    hash = hashBytes(hash, data, (size_t)info.st_size);
+    munmap(data, (size_t)info.st_size);
+    return hash;
+}
+
+// $TEXT_CACHE_DIR, otherwise text-editor in $XDG_CACHE_HOME or ~/.cache. Created if it is missing.
+static char* cacheDirectory(void)
+{
+    const char* base = getenv("TEXT_CACHE_DIR");
+    const char* suffix = "";
+    if (base == NULL || base[0] == '\0') {
+        base = getenv("XDG_CACHE_HOME");
+        suffix = "/text-editor";
+    }
+    if (base == NULL || base[0] == '\0') {
+        base = getenv("HOME");
+        suffix = "/.cache/text-editor";
+    }
+    if (base == NULL || base[0] == '\0') {
+        return NULL;
+    }
+    size_t length = strlen(base) + strlen(suffix);
+    char* path = (char*)malloc(length + 1);
+    snprintf(path, length + 1, "%s%s", base, suffix);
+    for (char* p = path + 1; *p != '\0'; p++) {
+        if (*p == '/') {
+            *p = '\0';
+            mkdir(path, 0755);
+            *p = '/';
+        }
+    }
+    if (mkdir(path, 0755) != 0 && errno != EEXIST) {
+        free(path);
+        return NULL;
+    }
+    return path;
+}
+
+static char* atlasPath(AtlasCache* cache, int size)
+{
+    size_t length = strlen(cache->directory) + 48;
+    char* path = (char*)malloc(length);
+    snprintf(path, length, "%s/%016llx-%d.atlas", cache->directory, (unsigned long long)cache->fontHash, size);
+    return path;
+}
+
+static int validRect(const Glyph_Rect* rect, int width, int height)
+{
+    return rect->x >= 0 && rect->y >= 0 && rect->w >= 0 && rect->h >= 0 && rect->x + rect->w <= width
+        && rect->y + rect->h <= height;
+}
+
+// Maps the atlas file of size and copies it out. NULL if there is none or it does not belong to
+// this font.
+static Glyph_Image* readAtlas(AtlasCache* cache, int size)
+{
+    char* path = atlasPath(cache, size);
+    int fd = open(path, O_RDONLY);
+    free(path);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0 || (size_t)info.st_size < sizeof(AtlasHeader)) {
+        close(fd);
+        return NULL;
+    }
+    void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    const AtlasHeader* header = (const AtlasHeader*)data;
+    int valid = memcmp(header->magic, ATLAS_MAGIC, sizeof(header->magic)) == 0 && header->fontHash == cache->fontHash
+        && header->size == size && header->width > 0 && header->width <= GLYPH_PAGE_SIZE && header->height > 0
+        && header->height <= GLYPH_PAGE_SIZE
+        && (size_t)info.st_size == sizeof(AtlasHeader) + sizeof(Uint32) * header->width * header->height
+        && validRect(&header->solid, header->width, header->height);
+    for (int c = 0; valid && c < GLYPH_ASCII; c++) {
+        valid = validRect(&header->rects[c], header->width, header->height);
+    }
+    Glyph_Image* image = NULL;
+    if (valid) {
+        image = createGlyphImage(header->width, header->height);
+        image->glyphHeight = header->glyphHeight;
+        image->solid = header->solid;
+        memcpy(image->rects, header->rects, sizeof(image->rects));
+        memcpy(image->pixels, header + 1, sizeof(Uint32) * image->width * image->height);
+    }
+    munmap(data, (size_t)info.st_size);
+    return image;
+}
+
+static int writeAll(int fd, const char* data, size_t length)
+{
+    while (length > 0) {
+        ssize_t count = write(fd, data, length);
+        if (count < 0) {
+            return -1;
+        }
+        data += count;
+        length -= (size_t)count;
+    }
+    return 0;
+}
+
+// Writes a temporary file and renames it over the atlas, so a reader never sees half of one. Not
+// synced, a lost atlas is just baked again.
+static void writeAtlas(AtlasCache* cache, int size, const Glyph_Image* image)
+{
+    AtlasHeader header = {0};
+    memcpy(header.magic, ATLAS_MAGIC, sizeof(header.magic));
+    header.fontHash = cache->fontHash;
+    header.size = size;
+    header.glyphHeight = image->glyphHeight;
+    header.width = image->width;
+    header.height = image->height;
+    header.solid = image->solid;
+    memcpy(header.rects, image->rects, sizeof(header.rects));
+
+    char* path = atlasPath(cache, size);
+    size_t pathLength = strlen(path);
+    char* tempName = (char*)malloc(pathLength + 8);
+    memcpy(tempName, path, pathLength);
+    memcpy(tempName + pathLength, ".XXXXXX", 8);
+    int fd = mkstemp(tempName);
+    if (fd >= 0) {
+        int result = writeAll(fd, (const char*)&header, sizeof(header));
+        if (result == 0) {
+            result = writeAll(fd, (const char*)image->pixels, sizeof(Uint32) * image->width * image->height);
+        }
+        close(fd);
+        if (result != 0 || rename(tempName, path) != 0) {
+            unlink(tempName);
+        }
+    }
+    free(tempName);
+    free(path);
+}
+
+// Opens the font at size and gets its atlas from the disk, baking and storing it if it is not
+// there. Returns NULL if the font cannot be opened.
+static TTF_Font* prepareAtlas(AtlasCache* cache, int size, Glyph_Image** image)
+{
+    lockFonts();
+    TTF_Font* font = TTF_OpenFont(cache->fontFile, size);
+    unlockFonts();
+    if (font == NULL) {
+        return NULL;
+    }
+    *image = cache->directory != NULL ? readAtlas(cache, size) : NULL;
+    if (*image == NULL) {
+        *image = bakeGlyphImage(font);
+        if (cache->directory != NULL) {
+            writeAtlas(cache, size, *image);
+        }
+    }
+    return font;
+}
+
+static int findReady(AtlasCache* cache, int size)
+{
+    for (int i = 0; i < cache->readyCount; i++) {
+        if (cache->ready[i].size == size) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Removes a ready atlas, keeping the rest in the order they were baked. Expects the lock held.
+static void removeReady(AtlasCache* cache, int index)
+{
+    memmove(cache->ready + index, cache->ready + index + 1, sizeof(ReadyAtlas) * (cache->readyCount - index - 1));
+    cache->readyCount--;
+}
+
+static void removeQueued(AtlasCache* cache, int size)
+{
+    for (int i = 0; i < cache->queueLength; i++) {
+        if (cache->queue[i] == size) {
+            memmove(cache->queue + i, cache->queue + i + 1, sizeof(int) * (cache->queueLength - i - 1));
+            cache->queueLength--;
+            return;
+        }
+    }
+}
+
+// Baker thread. Prepares the queued sizes and keeps the last few of them ready.
+static int bakeAtlases(void* data)
+{
+    AtlasCache* cache = (AtlasCache*)data;
+    SDL_LockMutex(cache->lock);
+    while (!cache->quit) {
+        if (cache->queueLength == 0) {
+            SDL_CondWait(cache->wake, cache->lock);
+            continue;
+        }
+        int size = cache->queue[0];
+        removeQueued(cache, size);
+        if (findReady(cache, size) >= 0) {
+            continue;
+        }
+        cache->baking = size;
+        SDL_UnlockMutex(cache->lock);
+
+        Glyph_Image* image = NULL;
+        TTF_Font* font = prepareAtlas(cache, size, &image);
+
+        SDL_LockMutex(cache->lock);
+        cache->baking = 0;
+        if (font != NULL) {
+            if (cache->readyCount == READY_SIZES) {
+                closeGlyphFont(cache->ready[0].font);
+                freeGlyphImage(cache->ready[0].image);
+                removeReady(cache, 0);
+            }
+            cache->ready[cache->readyCount++] = (ReadyAtlas){.size = size, .font = font, .image = image};
+        }
+        SDL_CondBroadcast(cache->baked);
+    }
+    SDL_UnlockMutex(cache->lock);
+    return 0;
+}
+
+AtlasCache* openAtlasCache(const char* fontFile)
+{
+    AtlasCache* cache = (AtlasCache*)calloc(1, sizeof(AtlasCache));
+    size_t length = strlen(fontFile);
+    cache->fontFile = (char*)malloc(length + 1);
+    memcpy(cache->fontFile, fontFile, length + 1);
+    cache->fontHash = hashFont(fontFile);
+    if (cache->fontHash != 0) {
+        cache->directory = cacheDirectory();
+    }
+    cache->lock = SDL_CreateMutex();
+    cache->wake = SDL_CreateCond();
+    cache->baked = SDL_CreateCond();
+    cache->baker = SDL_CreateThread(bakeAtlases, "atlas", cache);
+    return cache;
+}
+
+void closeAtlasCache(AtlasCache* cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    SDL_LockMutex(cache->lock);
+    cache->quit = 1;
+    SDL_CondSignal(cache->wake);
+    SDL_UnlockMutex(cache->lock);
+    if (cache->baker != NULL) {
+        SDL_WaitThread(cache->baker, NULL);
+    }
+    for (int i = 0; i < cache->readyCount; i++) {
+        closeGlyphFont(cache->ready[i].font);
+        freeGlyphImage(cache->ready[i].image);
+    }
+    SDL_DestroyCond(cache->baked);
+    SDL_DestroyCond(cache->wake);
+    SDL_DestroyMutex(cache->lock);
+    free(cache->directory);
+    free(cache->fontFile);
+    free(cache);
+}
+
+// Font at size and its baked ASCII, which the caller frees. Takes it from the baker if it has it
+// ready or is working on it, otherwise prepares it right away. NULL if the font cannot be opened.
+TTF_Font* loadAtlas(AtlasCache* cache, int size, Glyph_Image** image)
+{
+    SDL_LockMutex(cache->lock);
+    removeQueued(cache, size);
+    while (cache->baking == size) {
+        SDL_CondWait(cache->baked, cache->lock);
+    }
+    int index = findReady(cache, size);
+    if (index >= 0) {
+        TTF_Font* font = cache->ready[index].font;
+        *image = cache->ready[index].image;
+        removeReady(cache, index);
+        SDL_UnlockMutex(cache->lock);
+        return font;
+    }
+    SDL_UnlockMutex(cache->lock);
+    return prepareAtlas(cache, size, image);
+}
+
+// Has the baker prepare size in the background. Only the latest few requests are kept.
+void prebakeAtlas(AtlasCache* cache, int size)
+{
+    SDL_LockMutex(cache->lock);
+    int queued = cache->baking == size || findReady(cache, size) >= 0;
+    for (int i = 0; !queued && i < cache->queueLength; i++) {
+        queued = cache->queue[i] == size;
+    }
+    if (!queued) {
+        if (cache->queueLength == QUEUED_SIZES) {
+            removeQueued(cache, cache->queue[0]);
+        }
+        cache->queue[cache->queueLength++] = size;
+        SDL_CondSignal(cache->wake);
+    }
+    SDL_UnlockMutex(cache->lock);
+}
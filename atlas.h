@@ -0,0 +1,18 @@
+#ifndef ATLAS_H_
+#define ATLAS_H_
+
+#include "glyph.h"
+
+// Baked ASCII atlases kept between runs, one file per font and size in the cache directory, so a
+// font size that was used before opens without rasterizing anything. Files are keyed by a hash of
+// the font file. A worker thread opens and bakes the sizes a zoom step away ahead of time, zooming to
+// them only has to upload the image.
+
+typedef struct AtlasCache AtlasCache;
+
+AtlasCache* openAtlasCache(const char* fontFile);
+void closeAtlasCache(AtlasCache* cache);
+TTF_Font* loadAtlas(AtlasCache* cache, int size, Glyph_Image** image);
+void prebakeAtlas(AtlasCache* cache, int size);
+
+#endif
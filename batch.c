@@ -0,0 +1,144 @@
+#include "batch.h"
+#include <stdlib.h>
+
+#define MIN_QUADS 1024
+
+static void reserveQuads(QuadList* quads, int count)
+{
+    if (count <= quads->capacity) {
+        return;
+    }
+    int capacity = quads->capacity == 0 ? MIN_QUADS : quads->capacity;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    quads->vertices = (SDL_Vertex*)realloc(quads->vertices, sizeof(SDL_Vertex) * 4 * capacity);
+    quads->pages = (unsigned char*)realloc(quads->pages, capacity);
+    quads->capacity = capacity;
+}
+
+static void addQuad(QuadList* quads, int page, float x, float y, float w, float h,
+                    float u0, float v0, float u1, float v1, SDL_Color color)
+{
+    reserveQuads(quads, quads->count + 1);
+    SDL_Vertex* vertex = quads->vertices + quads->count * 4;
+    vertex[0] = (SDL_Vertex){{x, y}, color, {u0, v0}};
+    vertex[1] = (SDL_Vertex){{x + w, y}, color, {u1, v0}};
+    vertex[2] = (SDL_Vertex){{x + w, y + h}, color, {u1, v1}};
+    vertex[3] = (SDL_Vertex){{x, y + h}, color, {u0, v1}};
+    quads->pages[quads->count] = (unsigned char)page;
+    quads->count++;
+}
+
+// Adds a glyph drawn at its own size with its top left corner at x, y.
+void addGlyphQuad(QuadList* quads, float x, float y, Glyph_Entry* glyph, SDL_Color color)
+{
+    float scale = 1.0f / GLYPH_PAGE_SIZE;
+    Glyph_Rect* rect = &glyph->rect;
+    addQuad(quads, glyph->page, x, y, (float)rect->w, (float)rect->h, rect->x * scale, rect->y * scale,
+            (rect->x + rect->w) * scale, (rect->y + rect->h) * scale, color);
+}
+
+void clearQuads(QuadList* quads)
+{
+    quads->count = 0;
+}
+
+void freeQuads(QuadList* quads)
+{
+    free(quads->vertices);
+    free(quads->pages);
+    *quads = (QuadList){0};
+}
+
+GlyphBatch* createBatch(void)
+{
+    GlyphBatch* batch = (GlyphBatch*)calloc(1, sizeof(GlyphBatch));
+    return batch;
+}
+
+void freeBatch(GlyphBatch* batch)
+{
+    if (batch == NULL) {
+        return;
+    }
+    for (int i = 0; i < MAX_GLYPH_PAGES; i++) {
+        freeQuads(&batch->queues[i]);
+    }
+    freeQuads(&batch->scratch);
+    free(batch->indices);
+    free(batch);
+}
+
+// Starts a new frame drawing from the pages of glyphMap.
+void beginBatch(GlyphBatch* batch, Glyph_Map* glyphMap)
+{
+    batch->textures = glyphMap->textures;
+    batch->pageCount = glyphMap->pageCount;
+    for (int i = 0; i < MAX_GLYPH_PAGES; i++) {
+        clearQuads(&batch->queues[i]);
+    }
+}
+
+// Queues quads that were laid out relative to 0, 0 and moves them to x, y.
+void batchQuads(GlyphBatch* batch, const QuadList* quads, float x, float y)
+{
+    for (int i = 0; i < quads->count; i++) {
+        QuadList* queue = &batch->queues[quads->pages[i]];
+        reserveQuads(queue, queue->count + 1);
+        SDL_Vertex* vertex = queue->vertices + queue->count * 4;
+        for (int j = 0; j < 4; j++) {
+            vertex[j] = quads->vertices[i * 4 + j];
+            vertex[j].position.x += x;
+            vertex[j].position.y += y;
+        }
+        queue->pages[queue->count] = quads->pages[i];
+        queue->count++;
+    }
+}
+
+// Queues a filled rectangle. All corners sample the middle of the white patch solid, so filtering
+// never picks up a neighbouring glyph.
+void batchRect(GlyphBatch* batch, SDL_Rect* rect, Glyph_Rect* solid, SDL_Color color)
+{
+    float u = (solid->x + solid->w * 0.5f) / GLYPH_PAGE_SIZE;
+    float v = (solid->y + solid->h * 0.5f) / GLYPH_PAGE_SIZE;
+    addQuad(&batch->queues[0], 0, (float)rect->x, (float)rect->y, (float)rect->w, (float)rect->h, u, v, u, v, color);
+}
+
+// Every quad uses the same two triangles, so the index array is filled in once when it grows.
+static void reserveIndices(GlyphBatch* batch, int quadCount)
+{
+    if (quadCount <= batch->indexCapacity) {
+        return;
+    }
+    int capacity = batch->indexCapacity == 0 ? MIN_QUADS : batch->indexCapacity;
+    while (capacity < quadCount) {
+        capacity *= 2;
+    }
+    batch->indices = (int*)realloc(batch->indices, sizeof(int) * 6 * capacity);
+    for (int i = batch->indexCapacity; i < capacity; i++) {
+        int* index = batch->indices + i * 6;
+        index[0] = i * 4;
+        index[1] = i * 4 + 1;
+        index[2] = i * 4 + 2;
+        index[3] = i * 4 + 2;
+        index[4] = i * 4 + 3;
+        index[5] = i * 4;
+    }
+    batch->indexCapacity = capacity;
+}
+
+void flushBatch(GlyphBatch* batch, SDL_Renderer* renderer)
+{
+    for (int page = batch->pageCount - 1; page >= 0; page--) {
+        QuadList* queue = &batch->queues[page];
+        if (queue->count == 0) {
+            continue;
+        }
+        reserveIndices(batch, queue->count);
+        SDL_RenderGeometry(renderer, batch->textures[page], queue->vertices, queue->count * 4,
+                           batch->indices, queue->count * 6);
+        clearQuads(queue);
+    }
+}
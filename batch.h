@@ -0,0 +1,39 @@
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include <SDL.h>
+#include "glyph.h"
+
+// Collects textured quads from the glyph atlas and draws them with one SDL_RenderGeometry call per
+// atlas page. Solid rectangles sample the white patch on the first page so they go into the same
+// batch. The first page is drawn last, so rectangles stay on top of text from any page.
+
+// Quads in the order they were added, each with the atlas page it is drawn from.
+typedef struct {
+    SDL_Vertex* vertices;
+    unsigned char* pages;
+    int count;
+    int capacity;
+} QuadList;
+
+typedef struct {
+    SDL_Texture** textures;
+    int pageCount;
+    QuadList queues[MAX_GLYPH_PAGES];
+    int* indices;
+    int indexCapacity;
+    // Scratch list for laying out text before it is queued.
+    QuadList scratch;
+} GlyphBatch;
+
+void addGlyphQuad(QuadList* quads, float x, float y, Glyph_Entry* glyph, SDL_Color color);
+void clearQuads(QuadList* quads);
+void freeQuads(QuadList* quads);
+GlyphBatch* createBatch(void);
+void freeBatch(GlyphBatch* batch);
+void beginBatch(GlyphBatch* batch, Glyph_Map* glyphMap);
+void batchQuads(GlyphBatch* batch, const QuadList* quads, float x, float y);
+void batchRect(GlyphBatch* batch, SDL_Rect* rect, Glyph_Rect* solid, SDL_Color color);
+void flushBatch(GlyphBatch* batch, SDL_Renderer* renderer);
+
+#endif
@@ -0,0 +1,221 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "utf8.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define WRITE_BLOCK (4 * 1024 * 1024)
+
+double benchSeconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double)now.tv_sec + (double)now.tv_nsec * 1e-9;
+}
+
+// Memory the process has in RAM right now, 0 where /proc is not there.
+size_t benchResidentBytes(void)
+{
+    FILE* statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) {
+        return 0;
+    }
+    unsigned long size = 0, resident = 0;
+    if (fscanf(statm, "%lu %lu", &size, &resident) != 2) {
+        resident = 0;
+    }
+    fclose(statm);
+    return (size_t)resident * (size_t)sysconf(_SC_PAGESIZE);
+}
+
+// The argument at index as a number of megabytes, in bytes.
+size_t benchArgument(int argc, char** argv, int index, size_t fallback)
+{
+    if (index >= argc) {
+        return fallback;
+    }
+    return (size_t)(strtod(argv[index], NULL) * 1024 * 1024);
+}
+
+// Scratch file in $TMPDIR, or /tmp. The caller frees the path.
+char* benchPath(const char* name)
+{
+    const char* directory = getenv("TMPDIR");
+    if (directory == NULL || directory[0] == '\0') {
+        directory = "/tmp";
+    }
+    size_t length = strlen(directory) + strlen(name) + 2;
+    char* path = (char*)malloc(length);
+    snprintf(path, length, "%s/%s", directory, name);
+    return path;
+}
+
+// xorshift, fast enough that making the input does not dwarf what is measured.
+unsigned int benchRandom(unsigned int* state)
+{
+    unsigned int x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+// Fills text with words and lines whose lengths average lineLength.
+static void fillBenchText(char* text, size_t size, size_t lineLength, unsigned int* state, size_t* untilNewLine)
+{
+    for (size_t i = 0; i < size; i++) {
+        if (*untilNewLine == 0) {
+            text[i] = '\n';
+            *untilNewLine = 1 + benchRandom(state) % (2 * lineLength - 1);
+            continue;
+        }
+        unsigned int r = benchRandom(state) % 32;
+        text[i] = r < 26 ? (char)('a' + r) : ' ';
+        (*untilNewLine)--;
+    }
+}
+
+// size bytes of text in memory. The caller frees it.
+char* makeBenchText(size_t size, size_t lineLength, unsigned int seed)
+{
+    char* text = (char*)malloc(size);
+    size_t untilNewLine = lineLength;
+    fillBenchText(text, size, lineLength, &seed, &untilNewLine);
+    return text;
+}
+
+// Writes size bytes of text to path a block at a time, so files larger than memory can be made.
+int writeBenchFile(const char* path, size_t size, size_t lineLength)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        perror(path);
+        return 0;
+    }
+    char* block = (char*)malloc(WRITE_BLOCK);
+    unsigned int state = 2463534242u;
+    size_t untilNewLine = lineLength;
+    int written = 1;
+    for (size_t done = 0; done < size && written;) {
+        size_t length = size - done < WRITE_BLOCK ? size - done : WRITE_BLOCK;
+        fillBenchText(block, length, lineLength, &state, &untilNewLine);
+        written = fwrite(block, 1, length, file) == length;
+        done += length;
+    }
+    free(block);
+    if (fclose(file) != 0 || !written) {
+        perror(path);
+        return 0;
+    }
+    return 1;
+}
+
+void printRate(const char* label, size_t bytes, double seconds)
+{
+    printf("%-32s %10.2f ms %8.2f GB/s\n", label, seconds * 1000.0,
+           seconds > 0.0 ? (double)bytes / seconds / 1e9 : 0.0);
+}
+
+// lines lines of exactly lineLength characters each.
+int writeLinesFile(const char* path, size_t lines, size_t lineLength)
+{
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        perror(path);
+        return 0;
+    }
+    char* line = makeBenchText(lineLength + 1, lineLength + 2, 99);
+    line[lineLength] = '\n';
+    int written = 1;
+    for (size_t i = 0; i < lines && written; i++) {
+        written = fwrite(line, 1, lineLength + 1, file) == lineLength + 1;
+    }
+    free(line);
+    if (fclose(file) != 0 || !written) {
+        perror(path);
+        return 0;
+    }
+    return 1;
+}
+
+int openBenchScreen(BenchScreen* screen, const char* fontFile, int fontSize, int columns, int rows)
+{
+    if (SDL_Init(0) != 0 || TTF_Init() != 0) {
+        fprintf(stderr, "SDL ERROR: %s\n", SDL_GetError());
+        return 0;
+    }
+    initGlyphs();
+    screen->font = TTF_OpenFont(fontFile, fontSize);
+    if (screen->font == NULL) {
+        fprintf(stderr, "SDL ERROR: %s\n", SDL_GetError());
+        return 0;
+    }
+    Glyph_Image* image = bakeGlyphImage(screen->font);
+    screen->surface = SDL_CreateRGBSurfaceWithFormat(0, columns * image->rects['m'].w, rows * image->glyphHeight, 32,
+                                                     SDL_PIXELFORMAT_ARGB8888);
+    screen->renderer = screen->surface != NULL ? SDL_CreateSoftwareRenderer(screen->surface) : NULL;
+    if (screen->renderer == NULL) {
+        fprintf(stderr, "SDL ERROR: %s\n", SDL_GetError());
+        freeGlyphImage(image);
+        return 0;
+    }
+    screen->glyphMap = createGlyphMap(screen->renderer, screen->font, image);
+    freeGlyphImage(image);
+    return 1;
+}
+
+void closeBenchScreen(BenchScreen* screen)
+{
+    freeGlyphMap(screen->glyphMap);
+    SDL_DestroyRenderer(screen->renderer);
+    SDL_FreeSurface(screen->surface);
+    closeGlyphFont(screen->font);
+    TTF_Quit();
+    SDL_Quit();
+}
+
+static int oldCharWidth(Glyph_Map* glyphMap, const char* string, const char* end, size_t* length)
+{
+    Uint32 codepoint = decodeUtf8(string, end, length);
+    return codepoint < 32 ? 0 : glyphWidth(glyphMap, codepoint);
+}
+
+int oldCursorX(Glyph_Map* glyphMap, const LineSpan* line, size_t index)
+{
+    int x = 0;
+    size_t length;
+    for (size_t i = 0; i < index && i < line->beforeLength; i += length) {
+        x += oldCharWidth(glyphMap, line->before + i, line->before + line->beforeLength, &length);
+    }
+    for (size_t i = 0; i < line->afterLength && line->beforeLength + i < index; i += length) {
+        x += oldCharWidth(glyphMap, line->after + i, line->after + line->afterLength, &length);
+    }
+    return x;
+}
+
+size_t oldCursorPosition(Glyph_Map* glyphMap, const LineSpan* line, int target)
+{
+    int x = 0;
+    size_t position = 0;
+    size_t length;
+    for (size_t i = 0; i < line->beforeLength; i += length) {
+        int width = oldCharWidth(glyphMap, line->before + i, line->before + line->beforeLength, &length);
+        if (x + width / 2 > target) {
+            return position;
+        }
+        x += width;
+        position += length;
+    }
+    for (size_t i = 0; i < line->afterLength; i += length) {
+        int width = oldCharWidth(glyphMap, line->after + i, line->after + line->afterLength, &length);
+        if (x + width / 2 > target) {
+            return position;
+        }
+        x += width;
+        position += length;
+    }
+    return position;
+}
@@ -0,0 +1,41 @@
+#ifndef BENCH_H_
+#define BENCH_H_
+
+#include <stdlib.h>
+#include <SDL.h>
+#include <SDL_ttf.h>
+#include "glyph.h"
+#include "line.h"
+
+// Helpers shared by the benchmarks. Each *_bench.c is its own program, "make bench" builds them with
+// optimizations and runs them one after the other. Sizes can be given in megabytes on the command
+// line, without them the benchmarks run on the sizes they were written for.
+
+double benchSeconds(void);
+size_t benchResidentBytes(void);
+size_t benchArgument(int argc, char** argv, int index, size_t fallback);
+char* benchPath(const char* name);
+char* makeBenchText(size_t size, size_t lineLength, unsigned int seed);
+int writeBenchFile(const char* path, size_t size, size_t lineLength);
+unsigned int benchRandom(unsigned int* state);
+void printRate(const char* label, size_t bytes, double seconds);
+int writeLinesFile(const char* path, size_t lines, size_t lineLength);
+
+// A surface of columns by rows characters drawn by SDL's software renderer, so the benchmarks that
+// draw run the same with or without a display.
+typedef struct {
+    SDL_Surface* surface;
+    SDL_Renderer* renderer;
+    TTF_Font* font;
+    Glyph_Map* glyphMap;
+} BenchScreen;
+
+int openBenchScreen(BenchScreen* screen, const char* fontFile, int fontSize, int columns, int rows);
+void closeBenchScreen(BenchScreen* screen);
+
+// Cursor x and the index at an x as main.c found them before the flat width table, decoding every
+// code point and looking up its glyph from the start of the line.
+int oldCursorX(Glyph_Map* glyphMap, const LineSpan* line, size_t index);
+size_t oldCursorPosition(Glyph_Map* glyphMap, const LineSpan* line, int target);
+
+#endif
@@ -0,0 +1,124 @@
+#include "bench.h"
+#include "scan.h"
+#include "search.h"
+#include <stdio.h>
+#include <string.h>
+
+// findLiteral over a 1 GB buffer with the plain, SSE2 and AVX2 versions, for a needle that is never
+// found, so the whole buffer is scanned, and for one that is found every few kilobytes. Levels the
+// CPU does not support are skipped. findInLine is checked across the gap first.
+//
+//   find_bench [megabytes]
+
+#define PASSES 3
+
+static const char* levelNames[] = {"plain", "SSE2", "AVX2"};
+
+// findInLine against a byte by byte search of the same line, for needles taken from around the gap
+// and from the end of a line whose gap is near its end. Needles longer than the bytes after the gap
+// are the ones checked one position at a time. The line is longer than the largest arena class, so
+// its buffer is a block of its own and reading past it shows up in a sanitizer build. Returns 0 if
+// they disagree anywhere.
+static int checkAcrossGap(void)
+{
+    static const size_t lengths[] = {1, 2, 7, 64, 255, 256, 257, 300, 600};
+    static const size_t afterLengths[] = {1, 10, 300};
+    char* bytes = makeBenchText(3400, 4000, 7);
+    for (size_t a = 0; a < sizeof(afterLengths) / sizeof(afterLengths[0]); a++) {
+        // The after part goes in first, the before part in front of it leaves the gap between them.
+        size_t before = 3000;
+        size_t total = before + afterLengths[a];
+        Text* text = createText();
+        insertOnLine(text, 0, 0, bytes + before, afterLengths[a]);
+        insertOnLine(text, 0, 0, bytes, before);
+        for (size_t l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++) {
+            size_t length = lengths[l];
+            if (length > total) {
+                continue;
+            }
+            char needle[600];
+            for (size_t start = total - length; start + 40 + length > before && start > 0; start--) {
+                // The needle is the bytes at start, and with its last byte changed it only matches
+                // as far as the end of the line.
+                for (int changed = 0; changed < 2; changed++) {
+                    memcpy(needle, bytes + start, length);
+                    if (changed) {
+                        memmove(needle, needle + 1, length - 1);
+                        needle[length - 1] = '\x01';
+                    }
+                    size_t expected = total;
+                    for (size_t i = 0; i + length <= total; i++) {
+                        if (memcmp(bytes + i, needle, length) == 0) {
+                            expected = i;
+                            break;
+                        }
+                    }
+                    size_t index = total;
+                    if (!findInLine(text, 0, 0, needle, length, &index)) {
+                        index = total;
+                    }
+                    if (index != expected) {
+                        printf("  findInLine: %zu byte needle found at %zu instead of %zu, %zu bytes after the gap\n",
+                               length, index, expected, afterLengths[a]);
+                        freeText(text);
+                        free(bytes);
+                        return 0;
+                    }
+                }
+            }
+        }
+        freeText(text);
+    }
+    free(bytes);
+    return 1;
+}
+
+// Seconds for one pass over text, the best of PASSES. count is set to the matches found.
+static double timeFind(const char* text, size_t size, const char* needle, size_t* count)
+{
+    size_t length = strlen(needle);
+    double best = 0.0;
+    for (int pass = 0; pass < PASSES; pass++) {
+        double start = benchSeconds();
+        *count = 0;
+        for (const char* p = text; (p = findLiteral(p, text + size, needle, length)) != NULL; p += length) {
+            (*count)++;
+        }
+        double seconds = benchSeconds() - start;
+        if (pass == 0 || seconds < best) {
+            best = seconds;
+        }
+    }
+    return best;
+}
+
+int main(int argc, char** argv)
+{
+    if (!checkAcrossGap()) {
+        return 1;
+    }
+    size_t size = benchArgument(argc, argv, 1, (size_t)1024 * 1024 * 1024);
+    char* text = makeBenchText(size, 60, 3);
+    // Planted every 4 KB, the random text is not likely to have it anywhere else.
+    const char* planted = "xyzzyplugh";
+    for (size_t at = 4096; at + strlen(planted) < size; at += 4096) {
+        memcpy(text + at, planted, strlen(planted));
+    }
+    printf("%.0f MB buffer\n", (double)size / (1024 * 1024));
+    for (ScanLevel level = SCAN_PLAIN; level <= SCAN_AVX2; level++) {
+        if (!useScanLevel(level)) {
+            printf("  %s is not supported here\n", levelNames[level]);
+            continue;
+        }
+        char label[64];
+        size_t count = 0;
+        double seconds = timeFind(text, size, "zqxjkvwpfb", &count);
+        snprintf(label, sizeof(label), "  %s, not found", levelNames[level]);
+        printRate(label, size, seconds);
+        seconds = timeFind(text, size, planted, &count);
+        snprintf(label, sizeof(label), "  %s, %zu found", levelNames[level], count);
+        printRate(label, size, seconds);
+    }
+    free(text);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "bench.h"
+#include "gap.h"
+#include <stdio.h>
+
+// Inserts at random positions of one line held in a single gap buffer of 1 KB, 1 MB and 64 MB, with
+// the gap relocated by one memmove and, for comparison, a byte at a time as moveCursor used to. Each
+// insert is taken back right away, so the line keeps its size however many inserts are made.
+//
+//   gap_bench [megabytes...]
+
+// Fewer inserts on large buffers, so the byte at a time runs finish in a few seconds.
+static int insertCount(size_t size)
+{
+    size_t count = ((size_t)2 << 30) / size;
+    return count > 100000 ? 100000 : count < 50 ? 50 : (int)count;
+}
+
+static void moveCursorByBytes(GapBuffer* buffer, size_t position)
+{
+    while (buffer->cursor < position) {
+        cursorRight(buffer);
+    }
+    while (buffer->cursor > position) {
+        cursorLeft(buffer);
+    }
+}
+
+static double runInserts(Arena* arena, const char* text, size_t size, int count, int byBytes)
+{
+    GapBuffer* buffer = createBuffer(arena, size + 1);
+    insertBuffer(buffer, text, size);
+    unsigned int state = 88172645u;
+    double start = benchSeconds();
+    for (int i = 0; i < count; i++) {
+        size_t position = benchRandom(&state) % (gapUsed(buffer) + 1);
+        if (byBytes) {
+            moveCursorByBytes(buffer, position);
+        }
+        else {
+            moveCursor(buffer, position);
+        }
+        insertBuffer(buffer, "x", 1);
+        deleteFromBuffer(buffer);
+    }
+    double seconds = benchSeconds() - start;
+    freeBuffer(buffer);
+    return seconds;
+}
+
+static void runSize(size_t size)
+{
+    Arena* arena = createArena();
+    char* text = makeBenchText(size, size + 1, 7);
+    int count = insertCount(size);
+    double moved = runInserts(arena, text, size, count, 0);
+    double stepped = runInserts(arena, text, size, count, 1);
+    printf("%8zu KB line, %6d inserts: memmove %10.0f ns, byte at a time %12.0f ns per insert (%.0fx)\n",
+           size / 1024, count, moved * 1e9 / count, stepped * 1e9 / count, moved > 0.0 ? stepped / moved : 0.0);
+    free(text);
+    freeArena(arena);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            runSize(benchArgument(argc, argv, i, 0));
+        }
+        return 0;
+    }
+    runSize(1024);
+    runSize((size_t)1024 * 1024);
+    runSize((size_t)64 * 1024 * 1024);
+    return 0;
+}
@@ -0,0 +1,89 @@
+#include "bench.h"
+
+// The editor itself, for calculateCursorX and findCursorPosition.
+#define main editorMain
+#include "../main.c"
+#undef main
+
+// Cursor placement and mouse hit-testing at random places of 100 KB lines, against decoding and
+// looking up every code point from the start of the line as before the flat width table. The font is
+// fixed pitch, so the runs are measured again with its advance cleared to time the width table the
+// way it is used for proportional fonts.
+//
+//   glyph_bench [line kilobytes]
+
+#define LOOKUPS 2000
+
+typedef struct {
+    double cursorX;
+    double position;
+} LookupTimes;
+
+static LookupTimes runLookups(Text* text, Glyph_Map* glyphMap, CheckpointCache* checkpoints, int old)
+{
+    LineSpan line = getLineSpan(text, 0);
+    size_t length = line.beforeLength + line.afterLength;
+    int width = lineRangeWidth(glyphMap, &line, 0, length, 0);
+    unsigned int state = 1234567;
+    size_t sum = 0;
+    LookupTimes times;
+
+    double start = benchSeconds();
+    for (int i = 0; i < LOOKUPS; i++) {
+        size_t index = benchRandom(&state) % (length + 1);
+        sum += old ? oldCursorX(glyphMap, &line, index) : calculateCursorX(text, 0, glyphMap, checkpoints, index);
+    }
+    times.cursorX = (benchSeconds() - start) / LOOKUPS;
+
+    start = benchSeconds();
+    for (int i = 0; i < LOOKUPS; i++) {
+        int x = (int)(benchRandom(&state) % (unsigned int)(width + 1));
+        sum += old ? oldCursorPosition(glyphMap, &line, x) : findCursorPosition(text, 0, glyphMap, checkpoints, x);
+    }
+    times.position = (benchSeconds() - start) / LOOKUPS;
+    if (sum == 0) {
+        printf("  nothing measured\n");
+    }
+    return times;
+}
+
+static void printLookups(const char* label, LookupTimes times)
+{
+    printf("  %-28s cursor x %10.0f ns, hit-test %10.0f ns\n", label, times.cursorX * 1e9, times.position * 1e9);
+}
+
+int main(int argc, char** argv)
+{
+    size_t size = argc > 1 ? (size_t)(strtod(argv[1], NULL) * 1024) : 100 * 1024;
+    initScanner();
+    BenchScreen screen;
+    if (!openBenchScreen(&screen, FONT_FILE, FONT_SIZE, 80, 25)) {
+        return 1;
+    }
+    char* path = benchPath("glyph_bench.txt");
+    if (!writeLinesFile(path, 1, size)) {
+        return 1;
+    }
+    Text* text = createText();
+    FileSource* file = openFile(path, 0);
+    finishLoading(file, text);
+    CheckpointCache* checkpoints = createCheckpointCache();
+    printf("%zu KB line, %d lookups\n", size / 1024, LOOKUPS);
+
+    Glyph_Map* glyphMap = screen.glyphMap;
+    printLookups("every code point", runLookups(text, glyphMap, checkpoints, 1));
+    printLookups("fixed pitch", runLookups(text, glyphMap, checkpoints, 0));
+    int advance = glyphMap->advance;
+    glyphMap->advance = 0;
+    clearCheckpoints(checkpoints);
+    printLookups("width table", runLookups(text, glyphMap, checkpoints, 0));
+    glyphMap->advance = advance;
+
+    freeCheckpointCache(checkpoints);
+    freeText(text);
+    closeFile(file);
+    closeBenchScreen(&screen);
+    remove(path);
+    free(path);
+    return 0;
+}
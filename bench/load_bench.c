@@ -0,0 +1,68 @@
+#include "bench.h"
+#include "file.h"
+#include <stdio.h>
+#include <string.h>
+
+// Load throughput of openFile, which maps the file and indexes its newlines with SIMD on a worker
+// pool, against the fgets loader it replaced, on files with short and with long lines. Both read a
+// file that is already in the page cache.
+//
+//   load_bench [megabytes]
+
+#define OLD_CHUNK 256
+
+// The loader as it was before: fgets into a 256 byte buffer, then strcspn and strlen over each piece.
+static Text* loadWithFgets(const char* path)
+{
+    Text* text = createText();
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return text;
+    }
+    size_t line = 0;
+    char buffer[OLD_CHUNK] = "";
+    while (fgets(buffer, OLD_CHUNK, file)) {
+        size_t newLine = strcspn(buffer, "\n");
+        buffer[newLine] = 0;
+        insertOnLine(text, (int)line, lineLength(text, line), buffer, strlen(buffer));
+        if (newLine < OLD_CHUNK - 1) {
+            line++;
+            createNewLine(text, line, lineLength(text, line - 1));
+        }
+    }
+    fclose(file);
+    return text;
+}
+
+static void runLines(size_t size, size_t lineLength)
+{
+    char* path = benchPath("load_bench.txt");
+    if (!writeBenchFile(path, size, lineLength)) {
+        exit(1);
+    }
+    printf("%.0f MB, lines of %zu bytes on average\n", (double)size / (1024 * 1024), lineLength);
+
+    double start = benchSeconds();
+    Text* text = createText();
+    FileSource* file = openFile(path, 0);
+    finishLoading(file, text);
+    printRate("  openFile", size, benchSeconds() - start);
+    freeText(text);
+    closeFile(file);
+
+    start = benchSeconds();
+    text = loadWithFgets(path);
+    printRate("  fgets loader", size, benchSeconds() - start);
+    freeText(text);
+    remove(path);
+    free(path);
+}
+
+int main(int argc, char** argv)
+{
+    initScanner();
+    size_t size = benchArgument(argc, argv, 1, (size_t)256 * 1024 * 1024);
+    runLines(size, 40);
+    runLines(size, 4096);
+    return 0;
+}
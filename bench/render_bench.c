@@ -0,0 +1,94 @@
+#include "bench.h"
+
+// The editor itself, for renderText and the state it draws from.
+#define main editorMain
+#include "../main.c"
+#undef main
+
+// Frame time for a 200 by 60 screen full of text on the software renderer, scrolling one line a
+// frame. Each glyph used to be its own SDL_RenderCopy from the atlas, renderText lays lines out once
+// into the line cache and draws the screen with one SDL_RenderGeometry call per atlas page.
+//
+//   render_bench [frames]
+
+#define COLUMNS 200
+#define ROWS 60
+#define LINES 10000
+
+// One SDL_RenderCopy per character, as renderChar did.
+static void renderCopies(SDL_Renderer* renderer, Text* text, Glyph_Map* glyphMap, size_t first)
+{
+    for (size_t i = first; i < text->lineCount && i < first + ROWS; i++) {
+        LineSpan line = getLineSpan(text, i);
+        SDL_Rect dest = {0, (int)(i - first) * glyphMap->glyphHeight, 0, 0};
+        for (size_t c = 0; c < line.beforeLength + line.afterLength; c++) {
+            char ch = c < line.beforeLength ? line.before[c] : line.after[c - line.beforeLength];
+            Glyph_Entry* glyph = findGlyph(glyphMap, (unsigned char)ch);
+            SDL_Rect source = {glyph->rect.x, glyph->rect.y, glyph->rect.w, glyph->rect.h};
+            dest.w = source.w;
+            dest.h = source.h;
+            SDL_RenderCopy(renderer, glyphMap->textures[glyph->page], &source, &dest);
+            dest.x += source.w;
+        }
+    }
+}
+
+int main(int argc, char** argv)
+{
+    int frames = argc > 1 ? atoi(argv[1]) : 300;
+    initScanner();
+    BenchScreen screen;
+    if (!openBenchScreen(&screen, FONT_FILE, FONT_SIZE, COLUMNS, ROWS)) {
+        return 1;
+    }
+    char* path = benchPath("render_bench.txt");
+    if (!writeLinesFile(path, LINES, COLUMNS)) {
+        return 1;
+    }
+    Text* text = createText();
+    FileSource* file = openFile(path, 0);
+    finishLoading(file, text);
+
+    GlyphBatch* batch = createBatch();
+    LineCache* lineCache = createLineCache(LINE_CACHE_KB * 1024);
+    CheckpointCache* checkpoints = createCheckpointCache();
+    Cursor cursor = {0};
+    Selection selection = {0};
+    FindState find = {0};
+    ScrollState scroll = {0};
+    scroll.win_w = screen.surface->w;
+    scroll.win_h = screen.surface->h;
+    SDL_Color color = {255, 255, 255, 255};
+    printf("%d by %d characters, %d by %d pixels\n", COLUMNS, ROWS, scroll.win_w, scroll.win_h);
+
+    double start = benchSeconds();
+    for (int frame = 0; frame < frames; frame++) {
+        SDL_RenderClear(screen.renderer);
+        renderCopies(screen.renderer, text, screen.glyphMap, (size_t)frame % (LINES - ROWS));
+        SDL_RenderPresent(screen.renderer);
+    }
+    double copies = (benchSeconds() - start) / frames;
+
+    start = benchSeconds();
+    for (int frame = 0; frame < frames; frame++) {
+        scroll.y = frame % (LINES - ROWS);
+        SDL_RenderClear(screen.renderer);
+        renderText(screen.renderer, batch, lineCache, checkpoints, NULL, text, &cursor, true, &selection, &find, color,
+                   screen.glyphMap, &scroll);
+        SDL_RenderPresent(screen.renderer);
+    }
+    double batched = (benchSeconds() - start) / frames;
+    printf("  SDL_RenderCopy per glyph   %8.3f ms per frame\n", copies * 1000.0);
+    printf("  renderText, batched        %8.3f ms per frame (%.1fx)\n", batched * 1000.0,
+           batched > 0.0 ? copies / batched : 0.0);
+
+    freeCheckpointCache(checkpoints);
+    freeLineCache(lineCache);
+    freeBatch(batch);
+    freeText(text);
+    closeFile(file);
+    closeBenchScreen(&screen);
+    remove(path);
+    free(path);
+    return 0;
+}
@@ -0,0 +1,79 @@
+#include "bench.h"
+#include "file.h"
+#include <stdio.h>
+
+// Saving a file of a million lines with some of them edited. The old save wrote every line from the
+// UI thread with fwrite and fputs, the UI waits for all of it. startSave only snapshots the text on
+// the UI thread and writes it on a thread of its own, the UI is held up for the snapshot alone.
+//
+//   save_bench [lines in millions]
+
+#define AVERAGE_LINE 60
+// Every EDIT_EVERY'th line is edited, so it is a gap buffer and not a run of the file.
+#define EDIT_EVERY 16
+
+// The save as it was before, on lines that are still in the file as well.
+static void saveLineByLine(const char* path, Text* text)
+{
+    FILE* txtFile = fopen(path, "w");
+    if (txtFile == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < text->lineCount; i++) {
+        Line* line = &text->lines[i];
+        if (line->buffer != NULL) {
+            moveCursorToEnd(line->buffer);
+            fwrite(line->buffer->string, sizeof(char), line->buffer->cursor, txtFile);
+        }
+        else {
+            fwrite(text->source + line->offset, sizeof(char), line->length, txtFile);
+        }
+        fputs("\n", txtFile);
+    }
+    fclose(txtFile);
+}
+
+int main(int argc, char** argv)
+{
+    initScanner();
+    size_t lines = argc > 1 ? (size_t)(strtod(argv[1], NULL) * 1000000) : 1000000;
+    size_t size = lines * (AVERAGE_LINE + 1);
+    char* path = benchPath("save_bench.txt");
+    char* savePath = benchPath("save_bench.saved");
+    if (!writeBenchFile(path, size, AVERAGE_LINE)) {
+        return 1;
+    }
+    Text* text = createText();
+    FileSource* file = openFile(path, 0);
+    finishLoading(file, text);
+    unsigned int state = 4242;
+    for (size_t line = 0; line < text->lineCount; line += EDIT_EVERY) {
+        insertOnLine(text, (int)line, benchRandom(&state) % (lineLength(text, line) + 1), "x", 1);
+    }
+    printf("%zu lines, %.0f MB, every %d. line edited\n", text->lineCount, (double)size / (1024 * 1024),
+           EDIT_EVERY);
+
+    double start = benchSeconds();
+    saveLineByLine(savePath, text);
+    printRate("  fwrite per line, UI waits", size, benchSeconds() - start);
+
+    start = benchSeconds();
+    saveFile(savePath, text, SYNC_NONE);
+    printRate("  saveFile", size, benchSeconds() - start);
+
+    start = benchSeconds();
+    SaveJob* job = startSave(savePath, text, SYNC_NONE, 0);
+    double started = benchSeconds();
+    finishSave(job);
+    double finished = benchSeconds();
+    printRate("  startSave, UI waits", size, started - start);
+    printRate("  startSave, written", size, finished - start);
+
+    freeText(text);
+    closeFile(file);
+    remove(path);
+    remove(savePath);
+    free(path);
+    free(savePath);
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include "bench.h"
+
+// The editor itself, for renderText and selectAll.
+#define main editorMain
+#include "../main.c"
+#undef main
+
+// Frame time with everything selected in a file of 10 million lines. The selection used to be drawn
+// by walking every selected line and finding the x of both ends of each, on or off screen.
+// renderSelection now only looks at the ranges that reach the visible lines.
+//
+//   selection_bench [lines in millions]
+
+#define COLUMNS 120
+#define ROWS 40
+#define LINE_LENGTH 20
+#define OLD_FRAMES 3
+#define FRAMES 300
+
+// renderSelection as it was, for one range from the start of the first line to the end of the last.
+static void renderOldSelection(GlyphBatch* batch, Text* text, Glyph_Map* glyphMap, ScrollState* scroll)
+{
+    SDL_Color selectionColor = {100, 150, 255, 100};
+    for (size_t line = 0; line < text->lineCount; line++) {
+        LineSpan span = getLineSpan(text, line);
+        int startX = oldCursorX(glyphMap, &span, 0) - scroll->x;
+        int endX = oldCursorX(glyphMap, &span, span.beforeLength + span.afterLength) - scroll->x;
+        SDL_Rect rect = {.x = startX,
+                         .y = (int)(line - scroll->y) * glyphMap->glyphHeight,
+                         .w = endX - startX,
+                         .h = glyphMap->glyphHeight};
+        batchRect(batch, &rect, &glyphMap->solid, selectionColor);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    size_t lines = argc > 1 ? (size_t)(strtod(argv[1], NULL) * 1000000) : 10000000;
+    initScanner();
+    BenchScreen screen;
+    if (!openBenchScreen(&screen, FONT_FILE, FONT_SIZE, COLUMNS, ROWS)) {
+        return 1;
+    }
+    char* path = benchPath("selection_bench.txt");
+    if (!writeLinesFile(path, lines, LINE_LENGTH)) {
+        return 1;
+    }
+    Text* text = createText();
+    FileSource* file = openFile(path, 0);
+    finishLoading(file, text);
+
+    GlyphBatch* batch = createBatch();
+    LineCache* lineCache = createLineCache(LINE_CACHE_KB * 1024);
+    CheckpointCache* checkpoints = createCheckpointCache();
+    Cursor cursor = {0};
+    Selection selection = {0};
+    Selection none = {0};
+    FindState find = {0};
+    ScrollState scroll = {0};
+    scroll.win_w = screen.surface->w;
+    scroll.win_h = screen.surface->h;
+    SDL_Color color = {255, 255, 255, 255};
+    selectAll(text, &selection);
+    printf("%zu lines selected\n", text->lineCount);
+
+    // The old frames draw the text without a selection, then the selection the old way on top.
+    double start = benchSeconds();
+    for (int frame = 0; frame < OLD_FRAMES; frame++) {
+        scroll.y = frame;
+        SDL_RenderClear(screen.renderer);
+        renderText(screen.renderer, batch, lineCache, checkpoints, NULL, text, &cursor, false, &none, &find, color,
+                   screen.glyphMap, &scroll);
+        beginBatch(batch, screen.glyphMap);
+        renderOldSelection(batch, text, screen.glyphMap, &scroll);
+        flushBatch(batch, screen.renderer);
+        SDL_RenderPresent(screen.renderer);
+    }
+    double old = (benchSeconds() - start) / OLD_FRAMES;
+
+    start = benchSeconds();
+    for (int frame = 0; frame < FRAMES; frame++) {
+        scroll.y = frame;
+        SDL_RenderClear(screen.renderer);
+        renderText(screen.renderer, batch, lineCache, checkpoints, NULL, text, &cursor, false, &selection, &find,
+                   color, screen.glyphMap, &scroll);
+        SDL_RenderPresent(screen.renderer);
+    }
+    double clipped = (benchSeconds() - start) / FRAMES;
+    printf("  every selected line        %10.3f ms per frame\n", old * 1000.0);
+    printf("  visible lines only         %10.3f ms per frame (%.0fx)\n", clipped * 1000.0,
+           clipped > 0.0 ? old / clipped : 0.0);
+
+    freeSelection(&selection);
+    freeCheckpointCache(checkpoints);
+    freeLineCache(lineCache);
+    freeBatch(batch);
+    freeText(text);
+    closeFile(file);
+    closeBenchScreen(&screen);
+    remove(path);
+    free(path);
+    return 0;
+}
@@ -0,0 +1,347 @@
+#define _POSIX_C_SOURCE 200809L
+#include "bench.h"
+#include "file.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Open, edit and save time of a Text and the memory it takes, against the per-line Text, an array of
+// one malloc'd gap buffer per line, on files of 10 MB, 100 MB and 1 GB by default. Memory should
+// grow with the file and the edits, not with the number of lines. The per-line Text is skipped on
+// files it would not fit in memory for.
+//
+//   text_bench [megabytes...]
+
+#define AVERAGE_LINE 60
+// Typing and deleting touch one line, a new line moves the line array after it.
+#define EDITS 10000
+#define NEW_LINES 1000
+
+typedef enum {
+    EDIT_INSERT,
+    EDIT_DELETE,
+    EDIT_NEW_LINE
+} EditKind;
+
+typedef struct {
+    size_t lines;
+    size_t resident;
+    double open;
+    double insert;
+    double erase;
+    double newLine;
+    double save;
+} TextTimes;
+
+// The per-line Text, kept as the baseline: every line a gap buffer of at least OLD_MIN_BUFFER bytes
+// of its own, loaded with fgets and edited where the gap is, which is moved there a byte at a time.
+
+#define OLD_MIN_BUFFER 1024
+#define OLD_MIN_LINES 100
+#define OLD_CHUNK 256
+
+typedef struct {
+    size_t cursor;
+    size_t gapEnd;
+    size_t length;
+    char* string;
+} OldBuffer;
+
+typedef struct {
+    size_t lineCount;
+    OldBuffer** lines;
+    size_t maxSize;
+} OldText;
+
+static OldBuffer* oldCreateBuffer(void)
+{
+    OldBuffer* buffer = (OldBuffer*)malloc(sizeof(OldBuffer));
+    buffer->cursor = 0;
+    buffer->gapEnd = OLD_MIN_BUFFER;
+    buffer->length = OLD_MIN_BUFFER;
+    buffer->string = (char*)malloc(OLD_MIN_BUFFER);
+    return buffer;
+}
+
+static void oldInsert(OldBuffer* buffer, const char* text, size_t size)
+{
+    for (size_t i = 0; i < size; i++) {
+        if (buffer->cursor == buffer->gapEnd) {
+            size_t after = buffer->length - buffer->gapEnd;
+            size_t length = buffer->length * 2;
+            buffer->string = (char*)realloc(buffer->string, length);
+            memmove(buffer->string + length - after, buffer->string + buffer->gapEnd, after);
+            buffer->gapEnd = length - after;
+            buffer->length = length;
+        }
+        buffer->string[buffer->cursor++] = text[i];
+    }
+}
+
+static size_t oldUsed(const OldBuffer* buffer)
+{
+    return buffer->cursor + buffer->length - buffer->gapEnd;
+}
+
+static void oldMoveCursor(OldBuffer* buffer, size_t position)
+{
+    while (buffer->cursor < position) {
+        buffer->string[buffer->cursor++] = buffer->string[buffer->gapEnd++];
+    }
+    while (buffer->cursor > position) {
+        buffer->string[--buffer->gapEnd] = buffer->string[--buffer->cursor];
+    }
+}
+
+static void oldNewLine(OldText* text, size_t index, size_t linePos)
+{
+    text->lineCount++;
+    if (text->lineCount >= text->maxSize) {
+        text->maxSize *= 2;
+        text->lines = (OldBuffer**)realloc(text->lines, sizeof(OldBuffer*) * text->maxSize);
+    }
+    memmove(text->lines + index + 1, text->lines + index, sizeof(OldBuffer*) * (text->lineCount - 1 - index));
+    text->lines[index] = oldCreateBuffer();
+    OldBuffer* previous = text->lines[index - 1];
+    oldMoveCursor(previous, linePos);
+    oldInsert(text->lines[index], previous->string + previous->gapEnd, previous->length - previous->gapEnd);
+    previous->gapEnd = previous->length;
+}
+
+static OldText* oldLoad(const char* path)
+{
+    OldText* text = (OldText*)malloc(sizeof(OldText));
+    text->maxSize = OLD_MIN_LINES;
+    text->lines = (OldBuffer**)calloc(text->maxSize, sizeof(OldBuffer*));
+    text->lineCount = 1;
+    text->lines[0] = oldCreateBuffer();
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        return text;
+    }
+    size_t line = 0;
+    char buffer[OLD_CHUNK] = "";
+    while (fgets(buffer, OLD_CHUNK, file)) {
+        size_t newLine = strcspn(buffer, "\n");
+        buffer[newLine] = 0;
+        oldInsert(text->lines[line], buffer, strlen(buffer));
+        if (newLine < OLD_CHUNK - 1) {
+            line++;
+            oldNewLine(text, line, oldUsed(text->lines[line - 1]));
+        }
+    }
+    fclose(file);
+    return text;
+}
+
+static void oldSave(const char* path, OldText* text)
+{
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < text->lineCount; i++) {
+        oldMoveCursor(text->lines[i], oldUsed(text->lines[i]));
+        fwrite(text->lines[i]->string, 1, text->lines[i]->cursor, file);
+        fputs("\n", file);
+    }
+    fclose(file);
+}
+
+static void oldFree(OldText* text)
+{
+    for (size_t i = 0; i < text->lineCount; i++) {
+        free(text->lines[i]->string);
+        free(text->lines[i]);
+    }
+    free(text->lines);
+    free(text);
+}
+
+// count edits of one kind at random places. Returns the seconds they took.
+static double runEdits(Text* text, EditKind kind, int count, unsigned int* state)
+{
+    double start = benchSeconds();
+    for (int i = 0; i < count; i++) {
+        size_t line = benchRandom(state) % text->lineCount;
+        size_t linePos = benchRandom(state) % (lineLength(text, line) + 1);
+        if (kind == EDIT_INSERT) {
+            insertOnLine(text, (int)line, linePos, "x", 1);
+        }
+        else if (kind == EDIT_DELETE && linePos > 0) {
+            deleteFromLine(text, (int)line, linePos);
+        }
+        else if (kind == EDIT_NEW_LINE) {
+            createNewLine(text, line + 1, linePos);
+        }
+    }
+    return benchSeconds() - start;
+}
+
+static double runOldEdits(OldText* text, EditKind kind, int count, unsigned int* state)
+{
+    double start = benchSeconds();
+    for (int i = 0; i < count; i++) {
+        size_t line = benchRandom(state) % text->lineCount;
+        OldBuffer* buffer = text->lines[line];
+        size_t linePos = benchRandom(state) % (oldUsed(buffer) + 1);
+        if (kind == EDIT_INSERT) {
+            oldMoveCursor(buffer, linePos);
+            oldInsert(buffer, "x", 1);
+        }
+        else if (kind == EDIT_DELETE && linePos > 0) {
+            oldMoveCursor(buffer, linePos);
+            buffer->cursor--;
+        }
+        else if (kind == EDIT_NEW_LINE) {
+            oldNewLine(text, line + 1, linePos);
+        }
+    }
+    return benchSeconds() - start;
+}
+
+static TextTimes runText(const char* path, const char* savePath)
+{
+    TextTimes times;
+    size_t before = benchResidentBytes();
+    double start = benchSeconds();
+    Text* text = createText();
+    FileSource* file = openFile(path, 0);
+    finishLoading(file, text);
+    times.open = benchSeconds() - start;
+    times.resident = benchResidentBytes() - before;
+    times.lines = text->lineCount;
+
+    unsigned int state = 12345;
+    times.insert = runEdits(text, EDIT_INSERT, EDITS, &state) / EDITS;
+    times.erase = runEdits(text, EDIT_DELETE, EDITS, &state) / EDITS;
+    times.newLine = runEdits(text, EDIT_NEW_LINE, NEW_LINES, &state) / NEW_LINES;
+
+    start = benchSeconds();
+    saveFile(savePath, text, SYNC_NONE);
+    times.save = benchSeconds() - start;
+    freeText(text);
+    closeFile(file);
+    return times;
+}
+
+static TextTimes runOldText(const char* path, const char* savePath)
+{
+    TextTimes times;
+    size_t before = benchResidentBytes();
+    double start = benchSeconds();
+    OldText* text = oldLoad(path);
+    times.open = benchSeconds() - start;
+    times.resident = benchResidentBytes() - before;
+    times.lines = text->lineCount;
+
+    unsigned int state = 12345;
+    times.insert = runOldEdits(text, EDIT_INSERT, EDITS, &state) / EDITS;
+    times.erase = runOldEdits(text, EDIT_DELETE, EDITS, &state) / EDITS;
+    times.newLine = runOldEdits(text, EDIT_NEW_LINE, NEW_LINES, &state) / NEW_LINES;
+
+    start = benchSeconds();
+    oldSave(savePath, text);
+    times.save = benchSeconds() - start;
+    oldFree(text);
+    return times;
+}
+
+typedef TextTimes (*TextRun)(const char* path, const char* savePath);
+
+// Runs run in a child process, so the memory one Text leaves to the allocator when it is freed does
+// not hide the memory the next one takes.
+static TextTimes runApart(TextRun run, const char* path, const char* savePath)
+{
+    TextTimes times = {0};
+    int pipeEnds[2];
+    if (pipe(pipeEnds) != 0) {
+        return run(path, savePath);
+    }
+    fflush(stdout);
+    pid_t child = fork();
+    if (child == 0) {
+        close(pipeEnds[0]);
+        times = run(path, savePath);
+        _exit(write(pipeEnds[1], &times, sizeof(times)) == (ssize_t)sizeof(times) ? 0 : 1);
+    }
+    close(pipeEnds[1]);
+    if (child < 0) {
+        close(pipeEnds[0]);
+        return run(path, savePath);
+    }
+    if (read(pipeEnds[0], &times, sizeof(times)) != (ssize_t)sizeof(times)) {
+        fprintf(stderr, "text_bench: run failed\n");
+    }
+    close(pipeEnds[0]);
+    waitpid(child, NULL, 0);
+    return times;
+}
+
+// Whether the old Text fits in half the memory there is, with a buffer of its own for every line.
+static int oldTextFits(size_t size)
+{
+    size_t lines = size / AVERAGE_LINE;
+    size_t needed = lines * (OLD_MIN_BUFFER + sizeof(OldBuffer) + sizeof(OldBuffer*) + 32);
+    long pages = sysconf(_SC_PHYS_PAGES);
+    return pages <= 0 || needed < (size_t)pages * (size_t)sysconf(_SC_PAGESIZE) / 2;
+}
+
+static void printRow(const char* label, double now, double old, int hasOld, double scale, const char* unit)
+{
+    printf("  %-12s %12.2f %-3s", label, now * scale, unit);
+    if (hasOld) {
+        printf(" %12.2f %-3s %8.1fx", old * scale, unit, now > 0.0 ? old / now : 0.0);
+    }
+    printf("\n");
+}
+
+static void runSize(size_t size)
+{
+    char* path = benchPath("text_bench.txt");
+    char* savePath = benchPath("text_bench.saved");
+    if (!writeBenchFile(path, size, AVERAGE_LINE)) {
+        exit(1);
+    }
+    printf("%.0f MB, lines of %d bytes on average\n", (double)size / (1024 * 1024), AVERAGE_LINE);
+
+    TextTimes now = runApart(runText, path, savePath);
+    int hasOld = oldTextFits(size);
+    TextTimes old = {0};
+    if (hasOld) {
+        old = runApart(runOldText, path, savePath);
+    }
+    printf("  %-12s %16s", "", "Text");
+    printf(hasOld ? " %16s %9s\n" : "\n", "line buffers", "old/new");
+    printRow("open", now.open, old.open, hasOld, 1000.0, "ms");
+    printRow("insert", now.insert, old.insert, hasOld, 1e9, "ns");
+    printRow("delete", now.erase, old.erase, hasOld, 1e9, "ns");
+    printRow("new line", now.newLine, old.newLine, hasOld, 1e6, "us");
+    printRow("save", now.save, old.save, hasOld, 1000.0, "ms");
+    printRow("resident", (double)now.resident, (double)old.resident, hasOld, 1.0 / (1024 * 1024), "MB");
+    printf("  %zu lines, %.1f bytes per line besides the file\n", now.lines,
+           now.resident > size ? (double)(now.resident - size) / (double)now.lines : 0.0);
+    if (!hasOld) {
+        printf("  line buffers skipped, they would not fit in memory\n");
+    }
+
+    remove(path);
+    remove(savePath);
+    free(path);
+    free(savePath);
+}
+
+int main(int argc, char** argv)
+{
+    if (argc > 1) {
+        for (int i = 1; i < argc; i++) {
+            runSize(benchArgument(argc, argv, i, 0));
+        }
+        return 0;
+    }
+    runSize((size_t)10 * 1024 * 1024);
+    runSize((size_t)100 * 1024 * 1024);
+    runSize((size_t)1024 * 1024 * 1024);
+    return 0;
+}
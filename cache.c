@@ -0,0 +1,163 @@
+#include "cache.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_BUCKETS 256
+
+LineCache* createLineCache(size_t budget)
+{
+    LineCache* cache = (LineCache*)calloc(1, sizeof(LineCache));
+    cache->bucketCount = MIN_BUCKETS;
+    cache->buckets = (LineRun**)calloc(cache->bucketCount, sizeof(LineRun*));
+    cache->budget = budget;
+    return cache;
+}
+
+static size_t runBytes(LineRun* run)
+{
+    return sizeof(LineRun) + (sizeof(SDL_Vertex) * 4 + 1) * run->quads.count;
+}
+
+static size_t hashKey(const void* identity, size_t version)
+{
+    uint64_t hash = ((uint64_t)(uintptr_t)identity ^ ((uint64_t)version * 0x9E3779B97F4A7C15ull)) * 0xFF51AFD7ED558CCDull;
+    return (size_t)(hash ^ (hash >> 32));
+}
+
+static void unlinkRun(LineCache* cache, LineRun* run)
+{
+    if (run->newer != NULL) {
+        run->newer->older = run->older;
+    }
+    else {
+        cache->newest = run->older;
+    }
+    if (run->older != NULL) {
+        run->older->newer = run->newer;
+    }
+    else {
+        cache->oldest = run->newer;
+    }
+}
+
+static void pushNewest(LineCache* cache, LineRun* run)
+{
+    run->newer = NULL;
+    run->older = cache->newest;
+    if (cache->newest != NULL) {
+        cache->newest->newer = run;
+    }
+    else {
+        cache->oldest = run;
+    }
+    cache->newest = run;
+}
+
+static void removeRun(LineCache* cache, LineRun* run)
+{
+    LineRun** link = &cache->buckets[hashKey(run->identity, run->version) & (cache->bucketCount - 1)];
+    while (*link != run) {
+        link = &(*link)->hashNext;
+    }
+    *link = run->hashNext;
+    unlinkRun(cache, run);
+    cache->bytes -= runBytes(run);
+    cache->runCount--;
+    free(run->quads.vertices);
+    free(run->quads.pages);
+    free(run);
+}
+
+static void growBuckets(LineCache* cache)
+{
+    size_t bucketCount = cache->bucketCount * 2;
+    LineRun** buckets = (LineRun**)calloc(bucketCount, sizeof(LineRun*));
+    for (size_t i = 0; i < cache->bucketCount; i++) {
+        LineRun* run = cache->buckets[i];
+        while (run != NULL) {
+            LineRun* next = run->hashNext;
+            size_t index = hashKey(run->identity, run->version) & (bucketCount - 1);
+            run->hashNext = buckets[index];
+            buckets[index] = run;
+            run = next;
+        }
+    }
+    free(cache->buckets);
+    cache->buckets = buckets;
+    cache->bucketCount = bucketCount;
+}
+
+// Drops every run, e.g. when the atlas they point into was rebuilt.
+void clearLineCache(LineCache* cache)
+{
+    while (cache->oldest != NULL) {
+        removeRun(cache, cache->oldest);
+    }
+}
+
+void freeLineCache(LineCache* cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    clearLineCache(cache);
+    free(cache->buckets);
+    free(cache);
+}
+
+// Returns the run stored for this version of a line and marks it as most recently used.
+LineRun* findLineRun(LineCache* cache, const void* identity, size_t version)
+{
+    LineRun* run = cache->buckets[hashKey(identity, version) & (cache->bucketCount - 1)];
+    while (run != NULL && (run->identity != identity || run->version != version)) {
+        run = run->hashNext;
+    }
+    if (run == NULL) {
+        cache->misses++;
+        return NULL;
+    }
+    cache->hits++;
+    if (run != cache->newest) {
+        unlinkRun(cache, run);
+        pushNewest(cache, run);
+    }
+    return run;
+}
+
+// Stores a copy of the quads of a line laid out from 0, 0, so the run can be drawn at any scroll
+// position.
+LineRun* storeLineRun(LineCache* cache, const void* identity, size_t version, const QuadList* quads, int width,
+                      int rows, int state)
+{
+    LineRun* run = (LineRun*)malloc(sizeof(LineRun));
+    run->identity = identity;
+    run->version = version;
+    run->width = width;
+    run->rows = rows;
+    run->state = state;
+    run->quads.count = quads->count;
+    run->quads.capacity = quads->count;
+    run->quads.vertices = (SDL_Vertex*)malloc(sizeof(SDL_Vertex) * 4 * (quads->count + 1));
+    run->quads.pages = (unsigned char*)malloc(quads->count + 1);
+    if (quads->count > 0) {
+        memcpy(run->quads.vertices, quads->vertices, sizeof(SDL_Vertex) * 4 * quads->count);
+        memcpy(run->quads.pages, quads->pages, quads->count);
+    }
+
+    if (cache->runCount >= cache->bucketCount) {
+        growBuckets(cache);
+    }
+    size_t index = hashKey(identity, version) & (cache->bucketCount - 1);
+    run->hashNext = cache->buckets[index];
+    cache->buckets[index] = run;
+    pushNewest(cache, run);
+    cache->runCount++;
+    cache->bytes += runBytes(run);
+
+    // The new run itself is never evicted, it is about to be drawn.
+    while (cache->bytes > cache->budget && cache->oldest != run) {
+        removeRun(cache, cache->oldest);
+    }
+    return run;
+}
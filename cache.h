@@ -0,0 +1,49 @@
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <SDL.h>
+#include "batch.h"
+
+// Vertices of rendered lines, kept so unchanged lines are not laid out again every frame. A line is
+// identified by its gap buffer or its place in the source plus the version stamped on it by the last
+// edit, so an edited line simply misses. The least recently used runs are dropped once the cache
+// holds more than its budget.
+
+typedef struct LineRun LineRun;
+
+struct LineRun {
+    const void* identity;
+    size_t version;
+    QuadList quads;
+    int width;
+    // Screen rows the quads take, more than 1 if the line was wrapped.
+    int rows;
+    // Highlighting state the line started in, its colors depend on it.
+    int state;
+    LineRun* hashNext;
+    LineRun* newer;
+    LineRun* older;
+};
+
+typedef struct {
+    LineRun** buckets;
+    size_t bucketCount;
+    size_t runCount;
+    LineRun* newest;
+    LineRun* oldest;
+    size_t bytes;
+    size_t budget;
+    size_t hits;
+    size_t misses;
+    // Whatever the runs depend on besides the line, e.g. the layout of the glyph atlas.
+    Uint32 generation;
+} LineCache;
+
+LineCache* createLineCache(size_t budget);
+void freeLineCache(LineCache* cache);
+void clearLineCache(LineCache* cache);
+LineRun* findLineRun(LineCache* cache, const void* identity, size_t version);
+LineRun* storeLineRun(LineCache* cache, const void* identity, size_t version, const QuadList* quads, int width,
+                      int rows, int state);
+
+#endif
@@ -0,0 +1,278 @@
+#include "checkpoint.h"
+#include "utf8.h"
+#include <string.h>
+
+#define MIN_CHECKPOINTS 64
+
+// Byte at offset in the text of a line, counting the part before the gap first.
+static char lineByte(const LineSpan* line, size_t offset)
+{
+    return offset < line->beforeLength ? line->before[offset] : line->after[offset - line->beforeLength];
+}
+
+// Where the pen ends up after laying out the bytes from..to of a line with the pen starting at x.
+int lineRangeWidth(Glyph_Map* glyphMap, const LineSpan* line, size_t from, size_t to, int x)
+{
+    if (from < line->beforeLength) {
+        size_t end = to < line->beforeLength ? to : line->beforeLength;
+        x = spanWidth(glyphMap, line->before + from, line->before + end, x);
+        from = end;
+    }
+    if (to > from) {
+        x = spanWidth(glyphMap, line->after + (from - line->beforeLength), line->after + (to - line->beforeLength), x);
+    }
+    return x;
+}
+
+// Lays out a line from the byte at from with the pen at *x and returns the offset of the first
+// character whose middle is past target, or the length of the line. *x is left at that character.
+size_t lineRangePosition(Glyph_Map* glyphMap, const LineSpan* line, size_t from, int* x, int target)
+{
+    if (from < line->beforeLength) {
+        const char* end = line->before + line->beforeLength;
+        const char* found = spanPosition(glyphMap, line->before + from, end, x, target);
+        if (found < end) {
+            return found - line->before;
+        }
+        from = line->beforeLength;
+    }
+    const char* start = line->after + (from - line->beforeLength);
+    const char* found = spanPosition(glyphMap, start, line->after + line->afterLength, x, target);
+    return line->beforeLength + (found - line->after);
+}
+
+static void addCheckpoint(LineCheckpoints* checkpoints, size_t offset, int x)
+{
+    if (checkpoints->count == checkpoints->capacity) {
+        checkpoints->capacity = checkpoints->capacity == 0 ? MIN_CHECKPOINTS : checkpoints->capacity * 2;
+        checkpoints->points = (Checkpoint*)realloc(checkpoints->points, sizeof(Checkpoint) * checkpoints->capacity);
+    }
+    checkpoints->points[checkpoints->count++] = (Checkpoint){.offset = offset, .x = x};
+}
+
+// Measures the line from offset, with the pen at x, up to stop. A checkpoint is added every
+// CHECKPOINT_BYTES at the next character boundary before stop. Returns the x at stop.
+static int measureCheckpoints(LineCheckpoints* checkpoints, const LineSpan* line, Glyph_Map* glyphMap, size_t offset,
+                              int x, size_t stop)
+{
+    while (offset < stop) {
+        size_t next = offset + CHECKPOINT_BYTES;
+        if (next >= stop) {
+            next = stop;
+        }
+        while (next < stop && isContinuationByte(lineByte(line, next))) {
+            next++;
+        }
+        x = lineRangeWidth(glyphMap, line, offset, next, x);
+        offset = next;
+        if (offset < stop) {
+            addCheckpoint(checkpoints, offset, x);
+        }
+    }
+    return x;
+}
+
+// Measures the whole line once.
+static void buildCheckpoints(LineCheckpoints* checkpoints, const LineSpan* line, Glyph_Map* glyphMap)
+{
+    checkpoints->count = 0;
+    addCheckpoint(checkpoints, 0, 0);
+    checkpoints->width = measureCheckpoints(checkpoints, line, glyphMap, 0, 0, line->beforeLength + line->afterLength);
+}
+
+// Whether there is a tab in a line from offset on.
+static int hasTab(const LineSpan* line, size_t offset)
+{
+    if (offset < line->beforeLength && memchr(line->before + offset, '\t', line->beforeLength - offset) != NULL) {
+        return 1;
+    }
+    size_t after = offset > line->beforeLength ? offset - line->beforeLength : 0;
+    return after < line->afterLength && memchr(line->after + after, '\t', line->afterLength - after) != NULL;
+}
+
+// Brings checkpoints made before a change of the line up to date. The ones before the change stay,
+// the line is measured again from the last of those to the first checkpoint after the change, and
+// the ones from there on are moved by the bytes and pixels the change added. Tabs only keep their
+// width when the pen moved by whole tab stops, so after other moves a line with tabs is measured
+// again up to its end.
+static void updateCheckpoints(LineCheckpoints* checkpoints, const LineSpan* line, const LineChange* change,
+                              Glyph_Map* glyphMap)
+{
+    size_t kept = 1;
+    while (kept < checkpoints->count && checkpoints->points[kept].offset <= change->start) {
+        kept++;
+    }
+    size_t moved = kept;
+    while (moved < checkpoints->count && checkpoints->points[moved].offset < change->oldEnd) {
+        moved++;
+    }
+    size_t movedCount = checkpoints->count - moved;
+    Checkpoint* tail = (Checkpoint*)malloc(sizeof(Checkpoint) * (movedCount > 0 ? movedCount : 1));
+    memcpy(tail, checkpoints->points + moved, sizeof(Checkpoint) * movedCount);
+    int oldWidth = checkpoints->width;
+
+    Checkpoint from = checkpoints->points[kept - 1];
+    checkpoints->count = kept;
+    size_t length = line->beforeLength + line->afterLength;
+    if (movedCount == 0) {
+        checkpoints->width = measureCheckpoints(checkpoints, line, glyphMap, from.offset, from.x, length);
+        free(tail);
+        return;
+    }
+    size_t stop = tail[0].offset - change->oldEnd + change->newEnd;
+    int x = measureCheckpoints(checkpoints, line, glyphMap, from.offset, from.x, stop);
+    int shift = x - tail[0].x;
+    if (stop > from.offset) {
+        addCheckpoint(checkpoints, stop, x);
+    }
+    if (shift % glyphMap->tabWidth != 0 && hasTab(line, stop)) {
+        checkpoints->width = measureCheckpoints(checkpoints, line, glyphMap, stop, x, length);
+        free(tail);
+        return;
+    }
+    for (size_t i = 1; i < movedCount; i++) {
+        addCheckpoint(checkpoints, tail[i].offset - change->oldEnd + change->newEnd, tail[i].x + shift);
+    }
+    checkpoints->width = oldWidth + shift;
+    free(tail);
+}
+
+CheckpointCache* createCheckpointCache(void)
+{
+    return (CheckpointCache*)calloc(1, sizeof(CheckpointCache));
+}
+
+void freeCheckpointCache(CheckpointCache* cache)
+{
+    if (cache == NULL) {
+        return;
+    }
+    for (int i = 0; i < CHECKPOINT_LINES; i++) {
+        free(cache->lines[i].points);
+        freeRowStarts(&cache->lines[i].rows);
+    }
+    free(cache);
+}
+
+// Forgets every line, e.g. because the font changed.
+void clearCheckpoints(CheckpointCache* cache)
+{
+    for (int i = 0; i < CHECKPOINT_LINES; i++) {
+        cache->lines[i].identity = NULL;
+        cache->lines[i].count = 0;
+        cache->lines[i].rows.count = 0;
+    }
+}
+
+void setWrapWidth(CheckpointCache* cache, int width)
+{
+    if (width != cache->wrapWidth) {
+        cache->wrapWidth = width;
+        for (int i = 0; i < CHECKPOINT_LINES; i++) {
+            cache->lines[i].rows.count = 0;
+        }
+    }
+}
+
+// Entry of a line. If the line was edited since it was filled, its checkpoints are brought up to
+// date when the edits were recorded and emptied otherwise. The least recently used line makes room
+// when the cache is full.
+static LineCheckpoints* findLine(CheckpointCache* cache, Text* text, size_t line, Glyph_Map* glyphMap)
+{
+    const void* identity = lineIdentity(text, line);
+    size_t version = text->lines[line].version;
+    LineChange change;
+    LineCheckpoints* slot = NULL;
+    LineCheckpoints* oldest = &cache->lines[0];
+    for (int i = 0; i < CHECKPOINT_LINES; i++) {
+        LineCheckpoints* checkpoints = &cache->lines[i];
+        if (checkpoints->identity == identity) {
+            slot = checkpoints;
+            break;
+        }
+        if (checkpoints->used < oldest->used) {
+            oldest = checkpoints;
+        }
+    }
+    // The first edit of a line moves it out of the source, its entry is under the identity it had.
+    for (int i = 0; i < CHECKPOINT_LINES && slot == NULL; i++) {
+        LineCheckpoints* checkpoints = &cache->lines[i];
+        if (checkpoints->count > 0 &&
+            lineChangeSince(text, line, checkpoints->identity, checkpoints->version, &change)) {
+            slot = checkpoints;
+        }
+    }
+    if (slot == NULL) {
+        slot = oldest;
+    }
+    slot->used = ++cache->clock;
+    if (slot->identity != identity || slot->version != version) {
+        if (slot->count > 0 && lineChangeSince(text, line, slot->identity, slot->version, &change)) {
+            LineSpan span = getLineSpan(text, line);
+            updateCheckpoints(slot, &span, &change, glyphMap);
+        }
+        else {
+            slot->count = 0;
+        }
+        slot->identity = identity;
+        slot->version = version;
+        slot->rows.count = 0;
+    }
+    return slot;
+}
+
+// Checkpoints of a line, measured again where it changed since they were made.
+LineCheckpoints* findCheckpoints(CheckpointCache* cache, Text* text, size_t line, Glyph_Map* glyphMap)
+{
+    LineCheckpoints* slot = findLine(cache, text, line, glyphMap);
+    if (slot->count == 0) {
+        LineSpan span = getLineSpan(text, line);
+        buildCheckpoints(slot, &span, glyphMap);
+    }
+    return slot;
+}
+
+// Where the rows of a line start at the wrap width, wrapped again if it changed since.
+const RowStarts* findRowStarts(CheckpointCache* cache, Text* text, size_t line, Glyph_Map* glyphMap)
+{
+    LineCheckpoints* slot = findLine(cache, text, line, glyphMap);
+    if (slot->rows.count == 0) {
+        LineSpan span = getLineSpan(text, line);
+        wrapLine(&slot->rows, glyphMap, &span, cache->wrapWidth);
+    }
+    return &slot->rows;
+}
+
+// Last checkpoint at or before offset.
+Checkpoint checkpointAt(const LineCheckpoints* checkpoints, size_t offset)
+{
+    size_t low = 0;
+    size_t high = checkpoints->count;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (checkpoints->points[middle].offset <= offset) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return checkpoints->points[low];
+}
+
+// Last checkpoint at or left of x.
+Checkpoint checkpointBefore(const LineCheckpoints* checkpoints, int x)
+{
+    size_t low = 0;
+    size_t high = checkpoints->count;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (checkpoints->points[middle].x <= x) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return checkpoints->points[low];
+}
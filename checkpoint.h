@@ -0,0 +1,53 @@
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+#include "glyph.h"
+#include "line.h"
+#include "wrap.h"
+
+// Pen positions along very long lines, one about every CHECKPOINT_BYTES bytes, so the x of an index
+// or the index at an x is found by laying out the text from the nearest checkpoint instead of from
+// the start of the line. Kept for the few long lines used last, keyed by identity and version like
+// the line cache. When lines are wrapped the same entries hold where each row of a line starts, for
+// short lines as well since the rows of the line with the cursor are looked up after every key.
+
+#define CHECKPOINT_BYTES 1024
+#define LONG_LINE_BYTES (16 * CHECKPOINT_BYTES)
+#define CHECKPOINT_LINES 8
+
+typedef struct {
+    size_t offset;
+    int x;
+} Checkpoint;
+
+typedef struct {
+    const void* identity;
+    size_t version;
+    Checkpoint* points;
+    size_t count;
+    size_t capacity;
+    int width;
+    // Rows at the cache's wrap width, count is 0 until they are needed.
+    RowStarts rows;
+    size_t used;
+} LineCheckpoints;
+
+typedef struct {
+    LineCheckpoints lines[CHECKPOINT_LINES];
+    size_t clock;
+    // Width lines are wrapped at, 0 when they are not wrapped.
+    int wrapWidth;
+} CheckpointCache;
+
+CheckpointCache* createCheckpointCache(void);
+void freeCheckpointCache(CheckpointCache* cache);
+void clearCheckpoints(CheckpointCache* cache);
+void setWrapWidth(CheckpointCache* cache, int width);
+LineCheckpoints* findCheckpoints(CheckpointCache* cache, Text* text, size_t line, Glyph_Map* glyphMap);
+const RowStarts* findRowStarts(CheckpointCache* cache, Text* text, size_t line, Glyph_Map* glyphMap);
+Checkpoint checkpointAt(const LineCheckpoints* checkpoints, size_t offset);
+Checkpoint checkpointBefore(const LineCheckpoints* checkpoints, int x);
+int lineRangeWidth(Glyph_Map* glyphMap, const LineSpan* line, size_t from, size_t to, int x);
+size_t lineRangePosition(Glyph_Map* glyphMap, const LineSpan* line, size_t from, int* x, int target);
+
+#endif
@@ -1,46 +1,529 @@
+#define _POSIX_C_SOURCE 200809L
 #include "file.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include "gap.h"
 
-#define MAX_BUFFER 256
+#define READ_BLOCK (1 << 20)
+#define FIRST_WINDOW (256 * 1024)
+#define LOAD_WINDOW (64 * 1024 * 1024)
+#define SCAN_CHUNK (1 << 20)
 
-void openFile(char const* fileName, Text* text)
+// Newline offsets found by the loader that the main thread has not appended to the text yet.
+struct LoadBatch {
+    LoadBatch* next;
+    size_t count;
+    size_t offsets[];
+};
+
+// Reads the whole stream into memory for files that cannot be mapped, e.g. pipes.
+static char* readAll(int fd, size_t* size)
+{
+    size_t capacity = READ_BLOCK;
+    size_t length = 0;
+    char* data = (char*)malloc(capacity);
+    ssize_t count;
+    while ((count = read(fd, data + length, capacity - length)) > 0) {
+        length += (size_t)count;
+        if (length == capacity) {
+            capacity *= 2;
+            data = (char*)realloc(data, capacity);
+        }
+    }
+    *size = length;
+    return data;
+}
+
+static void scanChunk(void* job)
+{
+    ScanJob* scan = (ScanJob*)job;
+    scan->index.count = 0;
+    collectNewLines(scan->data, scan->from, scan->to, &scan->index);
+}
+
+static void notifyLoad(FileSource* file)
+{
+    if(file->loadEvent != 0) {
+        SDL_Event event = {0};
+        event.type = file->loadEvent;
+        SDL_PushEvent(&event);
+    }
+}
+
+// Loader thread. Scans the file a window at a time, each window split into chunks that the worker
+// pool scans in parallel, and queues the newline offsets for the main thread. The first window is
+// small so the first screen shows up right away.
+static int loadFile(void* data)
+{
+    FileSource* file = (FileSource*)data;
+    if(!file->mapped) {
+        size_t size;
+        char* contents = readAll(file->fd, &size);
+        close(file->fd);
+        SDL_LockMutex(file->lock);
+        file->data = contents;
+        file->size = size;
+        SDL_UnlockMutex(file->lock);
+    }
+
+    size_t from = 0;
+    size_t window = FIRST_WINDOW;
+    while(from < file->size) {
+        SDL_LockMutex(file->lock);
+        int cancel = file->cancel;
+        SDL_UnlockMutex(file->lock);
+        if(cancel) {
+            break;
+        }
+
+        size_t to = file->size - from > window ? from + window : file->size;
+        int jobCount = (int)((to - from) / SCAN_CHUNK);
+        if(jobCount > poolWorkers(file->pool)) {
+            jobCount = poolWorkers(file->pool);
+        }
+        if(jobCount < 1) {
+            jobCount = 1;
+        }
+        size_t chunk = (to - from) / jobCount;
+        for(int i = 0; i < jobCount; i++) {
+            file->jobs[i].data = file->data;
+            file->jobs[i].from = from + i * chunk;
+            file->jobs[i].to = i == jobCount - 1 ? to : from + (i + 1) * chunk;
+        }
+        runPool(file->pool, scanChunk, file->jobs, sizeof(ScanJob), jobCount);
+
+        // Stitch the per-chunk tables into one batch.
+        size_t count = 0;
+        for(int i = 0; i < jobCount; i++) {
+            count += file->jobs[i].index.count;
+        }
+        LoadBatch* batch = (LoadBatch*)malloc(sizeof(LoadBatch) + sizeof(size_t) * count);
+        batch->next = NULL;
+        batch->count = 0;
+        for(int i = 0; i < jobCount; i++) {
+            memcpy(batch->offsets + batch->count, file->jobs[i].index.offsets, sizeof(size_t) * file->jobs[i].index.count);
+            batch->count += file->jobs[i].index.count;
+        }
+
+        SDL_LockMutex(file->lock);
+        if(file->lastBatch != NULL) {
+            file->lastBatch->next = batch;
+        }
+        else {
+            file->batches = batch;
+        }
+        file->lastBatch = batch;
+        file->scanned = to;
+        SDL_CondBroadcast(file->progress);
+        SDL_UnlockMutex(file->lock);
+        notifyLoad(file);
+
+        from = to;
+        window = LOAD_WINDOW;
+    }
+
+    SDL_LockMutex(file->lock);
+    file->finished = 1;
+    SDL_CondBroadcast(file->progress);
+    SDL_UnlockMutex(file->lock);
+    notifyLoad(file);
+    return 0;
+}
+
+// Maps the file and starts the loader thread. Returns right away, lines show up in the text as
+// publishLines picks them up. loadEvent is pushed whenever there is something new to publish.
+FileSource* openFile(char const* fileName, Uint32 loadEvent)
 {
     printf("%s\n", fileName);
-    FILE* txtFile = fopen(fileName, "r");
-    if(txtFile == NULL) {
-        return;
+    int fd = open(fileName, O_RDONLY);
+    if(fd < 0) {
+        return NULL;
     }
-    printf("File loaded\n");
-    size_t line = 0;
-    char buffer[MAX_BUFFER] = "";
-    while (fgets(buffer, MAX_BUFFER, txtFile)) {
-        int newLine = strcspn(buffer, "\n");
-        buffer[newLine] = 0;
-        insertBuffer(text->lines[line], buffer, strlen(buffer));
-        if(newLine < MAX_BUFFER-1) {
-            line++;
-            createNewLine(text, line, 0);
+    FileSource* file = (FileSource*)calloc(1, sizeof(FileSource));
+    file->fd = fd;
+    file->loadEvent = loadEvent;
+    struct stat info;
+    if(fstat(fd, &info) == 0 && S_ISREG(info.st_mode) && info.st_size > 0) {
+        void* data = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(data != MAP_FAILED) {
+            file->data = (char*)data;
+            file->size = (size_t)info.st_size;
+            file->mapped = 1;
+            close(fd);
         }
     }
-    fclose(txtFile);
-    return;
+
+    file->lock = SDL_CreateMutex();
+    file->progress = SDL_CreateCond();
+    file->pool = createPool(SDL_GetCPUCount() - 1);
+    file->jobs = (ScanJob*)calloc(poolWorkers(file->pool), sizeof(ScanJob));
+    file->loader = SDL_CreateThread(loadFile, "loader", file);
+    if(file->loader == NULL) {
+        loadFile(file);
+    }
+    return file;
+}
+
+// Appends the lines the loader has found since the last call. Must be called from the thread that
+// owns the text. Returns the number of lines added.
+size_t publishLines(FileSource* file, Text* text)
+{
+    if(file == NULL || file->published) {
+        return 0;
+    }
+    SDL_LockMutex(file->lock);
+    LoadBatch* batch = file->batches;
+    file->batches = NULL;
+    file->lastBatch = NULL;
+    int finished = file->finished;
+    SDL_UnlockMutex(file->lock);
+    if(batch == NULL && !finished) {
+        return 0;
+    }
+
+    size_t before = text->lineCount;
+    if(text->source == NULL) {
+        // The first lines replace the empty line the text starts with, unless it was typed in.
+        text->source = file->data;
+        if(text->lineCount == 1 && lineLength(text, 0) == 0) {
+            freeBuffer(text->lines[0].buffer);
+            text->lineCount = 0;
+            markLinesChanged(text, 0, 1, 0);
+            resetLineWidths(text);
+            before = 0;
+        }
+    }
+    while(batch != NULL) {
+        LoadBatch* next = batch->next;
+        file->lineStart = appendSourceLines(text, file->lineStart, batch->offsets, batch->count);
+        free(batch);
+        batch = next;
+    }
+    if(finished) {
+        // Whatever follows the last newline is the final line.
+        appendSourceLine(text, file->lineStart, file->size - file->lineStart);
+        file->published = 1;
+    }
+    return text->lineCount - before;
+}
+
+// Blocks until the loader is done and publishes everything.
+void finishLoading(FileSource* file, Text* text)
+{
+    if(file == NULL) {
+        return;
+    }
+    SDL_LockMutex(file->lock);
+    while(!file->finished) {
+        SDL_CondWait(file->progress, file->lock);
+    }
+    SDL_UnlockMutex(file->lock);
+    publishLines(file, text);
 }
 
-void saveFile(char const* fileName, Text* text)
+// Blocks until the loader has found the first lines, or is done, and publishes them. Edits made
+// after this apply to lines of the file.
+void waitForLines(FileSource* file, Text* text)
 {
-    FILE* txtFile = fopen(fileName, "w");
-    if(txtFile == NULL) {
+    if(file == NULL) {
         return;
     }
+    SDL_LockMutex(file->lock);
+    while(file->batches == NULL && !file->finished) {
+        SDL_CondWait(file->progress, file->lock);
+    }
+    SDL_UnlockMutex(file->lock);
+    publishLines(file, text);
+}
+
+// Fraction of the file the loader has scanned so far.
+float loadProgress(FileSource* file)
+{
+    if(file == NULL || file->published) {
+        return 1.0f;
+    }
+    SDL_LockMutex(file->lock);
+    float progress = file->size > 0 ? (float)file->scanned / (float)file->size : 0.0f;
+    SDL_UnlockMutex(file->lock);
+    return progress;
+}
+
+void closeFile(FileSource* file)
+{
+    if(file == NULL) {
+        return;
+    }
+    SDL_LockMutex(file->lock);
+    file->cancel = 1;
+    SDL_UnlockMutex(file->lock);
+    SDL_WaitThread(file->loader, NULL);
+    while(file->batches != NULL) {
+        LoadBatch* next = file->batches->next;
+        free(file->batches);
+        file->batches = next;
+    }
+    for(int i = 0; i < poolWorkers(file->pool); i++) {
+        freeNewLineIndex(&file->jobs[i].index);
+    }
+    free(file->jobs);
+    freePool(file->pool);
+    SDL_DestroyCond(file->progress);
+    SDL_DestroyMutex(file->lock);
+    if(file->mapped) {
+        munmap(file->data, file->size);
+    }
+    else {
+        free(file->data);
+    }
+    free(file);
+}
+
+#define SNAPSHOT_BLOCK (1 << 20)
+#define IOV_BATCH 1024
+
+typedef struct {
+    const char* data;
+    size_t length;
+} SaveSpan;
+
+typedef struct SnapshotBlock SnapshotBlock;
+
+struct SnapshotBlock {
+    SnapshotBlock* next;
+    size_t used;
+    size_t capacity;
+    char data[];
+};
+
+struct SaveJob {
+    char* fileName;
+    SyncPolicy policy;
+    SaveSpan* spans;
+    size_t spanCount;
+    SnapshotBlock* blocks;
+    Uint32 doneEvent;
+    SDL_Thread* thread;
+    int result;
+};
+
+static const char newLine[] = "\n";
+
+// Copies length bytes into the snapshot storage. Blocks are never reallocated so earlier spans stay
+// valid.
+static const char* snapshotCopy(SaveJob* job, const char* data, size_t length)
+{
+    SnapshotBlock* block = job->blocks;
+    if(block == NULL || block->capacity - block->used < length) {
+        size_t capacity = length > SNAPSHOT_BLOCK ? length : SNAPSHOT_BLOCK;
+        block = (SnapshotBlock*)malloc(sizeof(SnapshotBlock) + capacity);
+        block->next = job->blocks;
+        block->used = 0;
+        block->capacity = capacity;
+        job->blocks = block;
+    }
+    char* copy = block->data + block->used;
+    memcpy(copy, data, length);
+    block->used += length;
+    return copy;
+}
+
+static void addSpan(SaveJob* job, const char* data, size_t length)
+{
+    if(length > 0) {
+        job->spans[job->spanCount++] = (SaveSpan){.data = data, .length = length};
+    }
+}
+
+// Captures the text as a list of spans without touching any gap. Unedited lines point straight into
+// the read-only source, only edited lines are copied since the editor keeps changing them.
+static SaveJob* snapshotText(char const* fileName, Text* text, SyncPolicy policy)
+{
+    SaveJob* job = (SaveJob*)calloc(1, sizeof(SaveJob));
+    job->fileName = (char*)malloc(strlen(fileName) + 1);
+    strcpy(job->fileName, fileName);
+    job->policy = policy;
+    job->spans = (SaveSpan*)malloc(sizeof(SaveSpan) * (text->lineCount * 3 + 1));
     for(size_t i = 0; i < text->lineCount; i++) {
-        moveCursorToEnd(text->lines[i]);
-        fwrite(text->lines[i]->string, sizeof(char), text->lines[i]->cursor, txtFile);
-        //fputs(text->lines[i]->string, txtFile);
-        fputs("\n", txtFile);
+        LineSpan line = getLineSpan(text, i);
+        if(text->lines[i].buffer == NULL) {
+            addSpan(job, line.after, line.afterLength);
+        }
+        else {
+            addSpan(job, snapshotCopy(job, line.before, line.beforeLength), line.beforeLength);
+            addSpan(job, snapshotCopy(job, line.after, line.afterLength), line.afterLength);
+        }
+        if(i + 1 < text->lineCount) {
+            addSpan(job, newLine, 1);
+        }
+    }
+    return job;
+}
+
+static void freeSaveJob(SaveJob* job)
+{
+    while(job->blocks != NULL) {
+        SnapshotBlock* next = job->blocks->next;
+        free(job->blocks);
+        job->blocks = next;
+    }
+    free(job->spans);
+    free(job->fileName);
+    free(job);
+}
+
+static int writeSpans(int fd, SaveSpan* spans, size_t spanCount)
+{
+    struct iovec vectors[IOV_BATCH];
+    size_t next = 0;
+    size_t skip = 0;
+    while(next < spanCount) {
+        int count = 0;
+        for(size_t i = next; i < spanCount && count < IOV_BATCH; i++, count++) {
+            size_t offset = i == next ? skip : 0;
+            vectors[count].iov_base = (void*)(spans[i].data + offset);
+            vectors[count].iov_len = spans[i].length - offset;
+        }
+        ssize_t written = writev(fd, vectors, count);
+        if(written < 0) {
+            return -1;
+        }
+        // Skip past whatever was written, a partial write can end in the middle of a span.
+        size_t remaining = (size_t)written;
+        while(next < spanCount && remaining >= spans[next].length - skip) {
+            remaining -= spans[next].length - skip;
+            skip = 0;
+            next++;
+        }
+        skip += remaining;
+    }
+    return 0;
+}
+
+static void syncDirectory(char const* fileName)
+{
+    const char* slash = strrchr(fileName, '/');
+    int dir;
+    if(slash == NULL) {
+        dir = open(".", O_RDONLY);
+    }
+    else {
+        size_t length = slash == fileName ? 1 : (size_t)(slash - fileName);
+        char* dirName = (char*)malloc(length + 1);
+        memcpy(dirName, fileName, length);
+        dirName[length] = 0;
+        dir = open(dirName, O_RDONLY);
+        free(dirName);
+    }
+    if(dir >= 0) {
+        fsync(dir);
+        close(dir);
+    }
+}
+
+// Writes the snapshot to a temporary file next to the original and renames it over the original, so
+// the file is either the old or the new version even if we crash halfway. The mapping of the old
+// file stays valid for lines that were never edited.
+static int writeSnapshot(SaveJob* job)
+{
+    size_t nameLength = strlen(job->fileName);
+    char* tempName = (char*)malloc(nameLength + 8);
+    memcpy(tempName, job->fileName, nameLength);
+    memcpy(tempName + nameLength, ".XXXXXX", 8);
+    int fd = mkstemp(tempName);
+    if(fd < 0) {
+        free(tempName);
+        return -1;
+    }
+    struct stat info;
+    if(stat(job->fileName, &info) == 0) {
+        fchmod(fd, info.st_mode & 07777);
+    }
+    int result = writeSpans(fd, job->spans, job->spanCount);
+    if(result == 0 && job->policy != SYNC_NONE) {
+        result = fsync(fd);
+    }
+    if(close(fd) != 0) {
+        result = -1;
+    }
+    if(result == 0) {
+        result = rename(tempName, job->fileName);
+    }
+    if(result != 0) {
+        unlink(tempName);
+    }
+    else if(job->policy == SYNC_FULL) {
+        syncDirectory(job->fileName);
+    }
+    free(tempName);
+    return result;
+}
+
+static int saveThread(void* data)
+{
+    SaveJob* job = (SaveJob*)data;
+    job->result = writeSnapshot(job);
+    if(job->doneEvent != 0) {
+        SDL_Event event = {0};
+        event.type = job->doneEvent;
+        event.user.data1 = job;
+        SDL_PushEvent(&event);
+    }
+    return 0;
+}
+
+// Snapshots the text and writes it on a background thread. doneEvent is pushed with the job in
+// user.data1 when the write is finished, finishSave collects the result.
+SaveJob* startSave(char const* fileName, Text* text, SyncPolicy policy, Uint32 doneEvent)
+{
+    SaveJob* job = snapshotText(fileName, text, policy);
+    job->doneEvent = doneEvent;
+    job->thread = SDL_CreateThread(saveThread, "save", job);
+    if(job->thread == NULL) {
+        saveThread(job);
+    }
+    return job;
+}
+
+// Waits for a save started with startSave. Returns 0 if the file was written.
+int finishSave(SaveJob* job)
+{
+    if(job == NULL) {
+        return 0;
+    }
+    SDL_WaitThread(job->thread, NULL);
+    int result = job->result;
+    freeSaveJob(job);
+    return result;
+}
+
+// Saves on the calling thread. Returns 0 if the file was written.
+int saveFile(char const* fileName, Text* text, SyncPolicy policy)
+{
+    SaveJob* job = snapshotText(fileName, text, policy);
+    int result = writeSnapshot(job);
+    freeSaveJob(job);
+    return result;
+}
+
+// Reads the fsync policy from TEXT_FSYNC: none, file (the default) or full, which also syncs the
+// directory so the rename itself is durable.
+SyncPolicy syncPolicyFromEnv(void)
+{
+    const char* value = getenv("TEXT_FSYNC");
+    if(value == NULL) {
+        return SYNC_FILE;
+    }
+    if(strcmp(value, "none") == 0) {
+        return SYNC_NONE;
+    }
+    if(strcmp(value, "full") == 0) {
+        return SYNC_FULL;
     }
-    fclose(txtFile);
-    return;
+    return SYNC_FILE;
 }
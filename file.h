@@ -3,8 +3,61 @@
 
 
 #include "line.h"
+#include "pool.h"
+#include "scan.h"
 
-void openFile(char const* fileName, Text* text);
-void saveFile(char const* fileName, Text* text);
+// Part of the file scanned for newlines by one worker.
+typedef struct {
+    const char* data;
+    size_t from;
+    size_t to;
+    NewLineIndex index;
+} ScanJob;
+
+typedef struct LoadBatch LoadBatch;
+
+// The file a Text was opened from. The contents are mapped read-only and a loader thread finds the
+// line boundaries in the background, unedited lines keep pointing into data.
+typedef struct {
+    char* data;
+    size_t size;
+    int mapped;
+    int fd;
+    Uint32 loadEvent;
+    WorkerPool* pool;
+    ScanJob* jobs;
+    SDL_Thread* loader;
+    // Shared with the loader thread, guarded by lock.
+    SDL_mutex* lock;
+    SDL_cond* progress;
+    LoadBatch* batches;
+    LoadBatch* lastBatch;
+    size_t scanned;
+    int finished;
+    int cancel;
+    // Only touched by the thread that owns the text.
+    size_t lineStart;
+    int published;
+} FileSource;
+
+// How hard a save tries to make sure the data reached the disk.
+typedef enum {
+    SYNC_NONE,
+    SYNC_FILE,
+    SYNC_FULL
+} SyncPolicy;
+
+typedef struct SaveJob SaveJob;
+
+FileSource* openFile(char const* fileName, Uint32 loadEvent);
+size_t publishLines(FileSource* file, Text* text);
+void finishLoading(FileSource* file, Text* text);
+void waitForLines(FileSource* file, Text* text);
+float loadProgress(FileSource* file);
+void closeFile(FileSource* file);
+SaveJob* startSave(char const* fileName, Text* text, SyncPolicy policy, Uint32 doneEvent);
+int finishSave(SaveJob* job);
+int saveFile(char const* fileName, Text* text, SyncPolicy policy);
+SyncPolicy syncPolicyFromEnv(void);
 
 #endif
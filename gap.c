@@ -3,19 +3,23 @@
 #include <stdlib.h>
 #include <string.h>
 
-#define MIN_BUFFER 1024
+#define MIN_BUFFER 32
 
-GapBuffer *createBuffer(void)
+// Creates a buffer with room for at least capacity bytes. The header and the string come from the
+// arena when one is given, otherwise from malloc.
+GapBuffer *createBuffer(Arena *arena, size_t capacity)
 {
-    GapBuffer *newBuffer = (GapBuffer *)malloc(sizeof(GapBuffer));
+    GapBuffer *newBuffer = (GapBuffer *)arenaAlloc(arena, sizeof(GapBuffer));
     if (newBuffer == NULL)
     {
         return newBuffer;
     }
+    size_t length = arenaBlockSize(capacity < MIN_BUFFER ? MIN_BUFFER : capacity);
     newBuffer->cursor = 0;
-    newBuffer->gapEnd = MIN_BUFFER;
-    newBuffer->length = MIN_BUFFER;
-    newBuffer->string = (char *)malloc(sizeof(char) * MIN_BUFFER);
+    newBuffer->gapEnd = length;
+    newBuffer->length = length;
+    newBuffer->arena = arena;
+    newBuffer->string = (char *)arenaAlloc(arena, sizeof(char) * length);
     return newBuffer;
 }
 
@@ -25,44 +29,62 @@ void freeBuffer(GapBuffer *gapBuffer)
     {
         return;
     }
-    free(gapBuffer->string);
-    free(gapBuffer);
+    Arena *arena = gapBuffer->arena;
+    arenaFree(arena, gapBuffer->string, gapBuffer->length);
+    arenaFree(arena, gapBuffer, sizeof(GapBuffer));
 }
 
-void expandBuffer(GapBuffer *gapBuffer)
+static void resizeBuffer(GapBuffer *gapBuffer, size_t newLength)
 {
-    if (gapBuffer == NULL)
-    {
-        return;
-    }
-    // Get new length for buffer and allocate memory. For now we just double the length.
     size_t oldLength = gapBuffer->length;
-    size_t newLength = oldLength * 2; // Add size check so it does not overflow
-    char *newString = (char *)realloc(gapBuffer->string, sizeof(char) * newLength);
+    char *newString = (char *)arenaRealloc(gapBuffer->arena, gapBuffer->string, oldLength, sizeof(char) * newLength);
     // Need to copy everything after the gap till the end.
     size_t afterGapText = gapBuffer->length - gapBuffer->gapEnd;
-    memmove(newString + newLength - afterGapText, gapBuffer->string + gapBuffer->gapEnd, afterGapText);
+    memmove(newString + newLength - afterGapText, newString + gapBuffer->gapEnd, afterGapText);
     gapBuffer->string = newString;
     gapBuffer->gapEnd = newLength - afterGapText;
     gapBuffer->length = newLength;
-    return;
 }
 
-void insertBuffer(GapBuffer *gapBuffer, char *text, size_t textSize)
+void expandBuffer(GapBuffer *gapBuffer)
 {
     if (gapBuffer == NULL)
     {
         return;
     }
-    // Check if gap is used and if there is space, insert into gap
-    for (size_t i = 0; i < textSize; i++)
+    // Grow into the next size class of the arena, past the largest class this doubles the length.
+    resizeBuffer(gapBuffer, arenaNextSize(gapBuffer->length)); // Add size check so it does not overflow
+    return;
+}
+
+// Makes sure the gap can take extra bytes. Grows geometrically, or straight to the required size
+// when that is larger, so a big insert costs a single reallocation.
+void reserveBuffer(GapBuffer *gapBuffer, size_t extra)
+{
+    size_t gapSize = gapBuffer->gapEnd - gapBuffer->cursor;
+    if (gapSize >= extra)
+    {
+        return;
+    }
+    size_t required = gapBuffer->length - gapSize + extra;
+    size_t newLength = arenaNextSize(gapBuffer->length);
+    if (newLength < required)
     {
-        if (gapBuffer->cursor == gapBuffer->gapEnd)
-        {
-            expandBuffer(gapBuffer);
-        }
-        gapBuffer->string[gapBuffer->cursor++] = text[i];
+        newLength = arenaBlockSize(required);
+    }
+    resizeBuffer(gapBuffer, newLength);
+    return;
+}
+
+void insertBuffer(GapBuffer *gapBuffer, const char *text, size_t textSize)
+{
+    if (gapBuffer == NULL)
+    {
+        return;
     }
+    reserveBuffer(gapBuffer, textSize);
+    memcpy(gapBuffer->string + gapBuffer->cursor, text, textSize);
+    gapBuffer->cursor += textSize;
     return;
 }
 
@@ -98,6 +120,7 @@ size_t gapUsed(GapBuffer *gapBuffer)
     return (gapBuffer->cursor + gapBuffer->length) - gapBuffer->gapEnd;
 }
 
+// Relocates the gap to position with a single memmove of the text between the old and new gap.
 void moveCursor(GapBuffer *gapBuffer, size_t position)
 {
     // Check that the position is not invalid
@@ -105,22 +128,19 @@ void moveCursor(GapBuffer *gapBuffer, size_t position)
     {
         return;
     }
-    // Move cursor right or left to get to correct position
     if (position > gapBuffer->cursor)
     {
         size_t positionsToMove = (position - gapBuffer->cursor);
-        for (size_t i = 0; i < positionsToMove; i++)
-        {
-            cursorRight(gapBuffer);
-        }
+        memmove(gapBuffer->string + gapBuffer->cursor, gapBuffer->string + gapBuffer->gapEnd, positionsToMove);
+        gapBuffer->cursor += positionsToMove;
+        gapBuffer->gapEnd += positionsToMove;
     }
     else
     {
         size_t positionsToMove = (gapBuffer->cursor - position);
-        for (size_t i = 0; i < positionsToMove; i++)
-        {
-            cursorLeft(gapBuffer);
-        }
+        memmove(gapBuffer->string + gapBuffer->gapEnd - positionsToMove, gapBuffer->string + position, positionsToMove);
+        gapBuffer->cursor -= positionsToMove;
+        gapBuffer->gapEnd -= positionsToMove;
     }
     return;
 }
@@ -141,3 +161,51 @@ void copyBuffer(GapBuffer *dest, GapBuffer *src)
     insertBuffer(dest, copy, copySize);
     return;
 }
+
+// Deletes the text between start and end. The gap moves to end once and then takes in the range.
+void deleteBufferRange(GapBuffer *gapBuffer, size_t start, size_t end)
+{
+    if (start >= end || end > gapUsed(gapBuffer))
+    {
+        return;
+    }
+    moveCursor(gapBuffer, end);
+    gapBuffer->cursor = start;
+    return;
+}
+
+// Drops everything after the cursor.
+void truncateBuffer(GapBuffer *gapBuffer)
+{
+    gapBuffer->gapEnd = gapBuffer->length;
+    return;
+}
+
+// Copies the text between start and end into dest without moving the gap. Returns bytes copied.
+size_t copyFromBuffer(GapBuffer *gapBuffer, size_t start, size_t end, char *dest)
+{
+    size_t used = gapUsed(gapBuffer);
+    if (end > used)
+    {
+        end = used;
+    }
+    if (start >= end)
+    {
+        return 0;
+    }
+    size_t copied = 0;
+    if (start < gapBuffer->cursor)
+    {
+        size_t beforeGap = (end < gapBuffer->cursor ? end : gapBuffer->cursor) - start;
+        memcpy(dest, gapBuffer->string + start, beforeGap);
+        copied += beforeGap;
+    }
+    if (end > gapBuffer->cursor)
+    {
+        size_t from = start > gapBuffer->cursor ? start - gapBuffer->cursor : 0;
+        size_t afterGap = end - gapBuffer->cursor - from;
+        memcpy(dest + copied, gapBuffer->string + gapBuffer->gapEnd + from, afterGap);
+        copied += afterGap;
+    }
+    return copied;
+}
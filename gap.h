@@ -2,24 +2,30 @@
 #define GAP_H_
 
 #include <stdlib.h>
+#include "arena.h"
 
 typedef struct {
     size_t cursor;
     size_t gapEnd;
     size_t length;
     char* string;
+    Arena* arena;
 } GapBuffer;
 
-GapBuffer* createBuffer(void);
+GapBuffer* createBuffer(Arena* arena, size_t capacity);
 void freeBuffer(GapBuffer* gapBuffer);
 void expandBuffer(GapBuffer* gapBuffer);
-void insertBuffer(GapBuffer* gapBuffer, char* text, size_t textSize);
+void reserveBuffer(GapBuffer* gapBuffer, size_t extra);
+void insertBuffer(GapBuffer* gapBuffer, const char* text, size_t textSize);
 void deleteFromBuffer(GapBuffer* gapBuffer);
+void deleteBufferRange(GapBuffer* gapBuffer, size_t start, size_t end);
 void cursorLeft(GapBuffer* gapBuffer);
 void cursorRight(GapBuffer* gapBuffer);
 size_t gapUsed(GapBuffer* gapBuffer);
 void moveCursor(GapBuffer* gapBuffer, size_t position);
 size_t moveCursorToEnd(GapBuffer* gapBuffer);
 void copyBuffer(GapBuffer* dest, GapBuffer* src);
+void truncateBuffer(GapBuffer* gapBuffer);
+size_t copyFromBuffer(GapBuffer* gapBuffer, size_t start, size_t end, char* dest);
 
 #endif
@@ -1,20 +1,370 @@
 #include "glyph.h"
+#include "scan.h"
+#include "utf8.h"
 #include <stdlib.h>
+#include <string.h>
 
+#define GLYPH_PADDING 1
+#define SOLID_SIZE 4
+#define MIN_TABLE 256
+#define MIN_ENTRIES 256
+#define IMAGE_WIDTH 512
 
-Glyph_Map* createGlyphMap(void)
+//SDL_ttf shares FreeType between fonts, so fonts are opened, closed and rendered one at a time.
+static SDL_mutex* fontLock;
+
+static unsigned int hashCodepoint(Uint32 codepoint)
+{
+    return codepoint * 2654435761u;
+}
+
+static int findSlot(Glyph_Map* glyphMap, Uint32 codepoint)
+{
+    int mask = glyphMap->tableSize - 1;
+    int i = hashCodepoint(codepoint) & mask;
+    while (glyphMap->table[i] >= 0) {
+        if (glyphMap->entries[glyphMap->table[i]].codepoint == codepoint) {
+            return i;
+        }
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void growTable(Glyph_Map* glyphMap)
+{
+    int* old = glyphMap->table;
+    int oldSize = glyphMap->tableSize;
+    glyphMap->tableSize = oldSize * 2;
+    glyphMap->table = (int*)malloc(sizeof(int) * glyphMap->tableSize);
+    memset(glyphMap->table, -1, sizeof(int) * glyphMap->tableSize);
+    for (int i = 0; i < oldSize; i++) {
+        if (old[i] >= 0) {
+            glyphMap->table[findSlot(glyphMap, glyphMap->entries[old[i]].codepoint)] = old[i];
+        }
+    }
+    free(old);
+}
+
+static void tableInsert(Glyph_Map* glyphMap, int index)
+{
+    if (glyphMap->entryCount * 2 >= glyphMap->tableSize) {
+        growTable(glyphMap);
+    }
+    glyphMap->table[findSlot(glyphMap, glyphMap->entries[index].codepoint)] = index;
+}
+
+//Linear probing without tombstones: entries after the removed one are shifted back if their probe
+//sequence passes through the hole.
+static void tableRemove(Glyph_Map* glyphMap, Uint32 codepoint)
+{
+    int mask = glyphMap->tableSize - 1;
+    int hole = findSlot(glyphMap, codepoint);
+    if (glyphMap->table[hole] < 0) {
+        return;
+    }
+    glyphMap->table[hole] = -1;
+    int i = hole;
+    while (1) {
+        i = (i + 1) & mask;
+        if (glyphMap->table[i] < 0) {
+            return;
+        }
+        int home = hashCodepoint(glyphMap->entries[glyphMap->table[i]].codepoint) & mask;
+        int between = hole <= i ? (home > hole && home <= i) : (home > hole || home <= i);
+        if (!between) {
+            glyphMap->table[hole] = glyphMap->table[i];
+            glyphMap->table[i] = -1;
+            hole = i;
+        }
+    }
+}
+
+static void unlinkEntry(Glyph_Map* glyphMap, Glyph_Entry* entry)
+{
+    if (entry->newer >= 0) {
+        glyphMap->entries[entry->newer].older = entry->older;
+    }
+    else {
+        glyphMap->newest = entry->older;
+    }
+    if (entry->older >= 0) {
+        glyphMap->entries[entry->older].newer = entry->newer;
+    }
+    else {
+        glyphMap->oldest = entry->newer;
+    }
+}
+
+static void pushNewest(Glyph_Map* glyphMap, int index)
+{
+    Glyph_Entry* entry = &glyphMap->entries[index];
+    entry->newer = -1;
+    entry->older = glyphMap->newest;
+    if (glyphMap->newest >= 0) {
+        glyphMap->entries[glyphMap->newest].newer = index;
+    }
+    else {
+        glyphMap->oldest = index;
+    }
+    glyphMap->newest = index;
+}
+
+static int createPage(Glyph_Map* glyphMap)
 {
-    Glyph_Map* glyphMap = (Glyph_Map*)malloc(sizeof(Glyph_Map));
+    if (glyphMap->pageCount == MAX_GLYPH_PAGES) {
+        return 0;
+    }
+    SDL_Texture* texture = SDL_CreateTexture(glyphMap->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC,
+                                             GLYPH_PAGE_SIZE, GLYPH_PAGE_SIZE);
+    if (texture == NULL) {
+        return 0;
+    }
+    SDL_SetTextureBlendMode(texture, SDL_BLENDMODE_BLEND);
+    glyphMap->textures[glyphMap->pageCount] = texture;
+    glyphMap->pages[glyphMap->pageCount] = (Glyph_Page){0};
+    glyphMap->pageCount++;
+    return 1;
+}
 
-    glyphMap->maxGlyphs = MAX_GLYPHS;
-    glyphMap->glyphs = (Glyph_Rect**)malloc(sizeof(Glyph_Rect*) * MAX_GLYPHS);
+//Puts a w by h slot on the lowest shelf it fits, shelves are at most a third taller than what goes
+//on them. Opens a new shelf when none fits.
+static int packSlot(Glyph_Page* page, int w, int h, Glyph_Rect* slot)
+{
+    int best = -1;
+    for (int i = 0; i < page->shelfCount; i++) {
+        Glyph_Shelf* shelf = &page->shelves[i];
+        if (shelf->height >= h && shelf->height * 3 <= h * 4 && shelf->x + w <= GLYPH_PAGE_SIZE) {
+            if (best < 0 || shelf->height < page->shelves[best].height) {
+                best = i;
+            }
+        }
+    }
+    if (best < 0) {
+        if (page->top + h > GLYPH_PAGE_SIZE || w > GLYPH_PAGE_SIZE) {
+            return 0;
+        }
+        if (page->shelfCount == page->shelfCapacity) {
+            page->shelfCapacity = page->shelfCapacity == 0 ? 16 : page->shelfCapacity * 2;
+            page->shelves = (Glyph_Shelf*)realloc(page->shelves, sizeof(Glyph_Shelf) * page->shelfCapacity);
+        }
+        best = page->shelfCount++;
+        page->shelves[best] = (Glyph_Shelf){.y = page->top, .height = h, .x = 0};
+        page->top += h;
+    }
+    Glyph_Shelf* shelf = &page->shelves[best];
+    *slot = (Glyph_Rect){.x = shelf->x, .y = shelf->y, .w = w, .h = shelf->height};
+    shelf->x += w;
+    return 1;
+}
 
-    for (int i = 0; i < glyphMap->maxGlyphs; i++) {
-        glyphMap->glyphs[i] = NULL;
+static int packGlyph(Glyph_Map* glyphMap, int w, int h, int* page, Glyph_Rect* slot)
+{
+    for (int i = 0; i < glyphMap->pageCount; i++) {
+        if (packSlot(&glyphMap->pages[i], w, h, slot)) {
+            *page = i;
+            return 1;
+        }
+    }
+    if (createPage(glyphMap) && packSlot(&glyphMap->pages[glyphMap->pageCount - 1], w, h, slot)) {
+        *page = glyphMap->pageCount - 1;
+        return 1;
+    }
+    return 0;
+}
+
+//Least recently used glyph that was not drawn this frame and whose slot can hold a w by h glyph.
+static int evictGlyph(Glyph_Map* glyphMap, int w, int h)
+{
+    for (int i = glyphMap->oldest; i >= 0; i = glyphMap->entries[i].newer) {
+        Glyph_Entry* entry = &glyphMap->entries[i];
+        if (entry->used != glyphMap->frame && entry->slot.w >= w && entry->slot.h >= h) {
+            tableRemove(glyphMap, entry->codepoint);
+            unlinkEntry(glyphMap, entry);
+            glyphMap->generation++;
+            return i;
+        }
     }
+    return -1;
+}
 
-    glyphMap->glyphHeight = 0;
+//White glyph of a code point as ARGB8888, or NULL if the font cannot render it.
+static SDL_Surface* renderGlyph(TTF_Font* font, Uint32 codepoint)
+{
+    SDL_Color white = {255, 255, 255, 255};
+    lockFonts();
+    SDL_Surface* surface = TTF_RenderGlyph32_Blended(font, codepoint, white);
+    unlockFonts();
+    if (surface == NULL || surface->format->format == SDL_PIXELFORMAT_ARGB8888) {
+        return surface;
+    }
+    SDL_Surface* converted = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+    SDL_FreeSurface(surface);
+    return converted;
+}
+
+static int newEntry(Glyph_Map* glyphMap)
+{
+    if (glyphMap->entryCount == glyphMap->entryCapacity) {
+        glyphMap->entryCapacity = glyphMap->entryCapacity == 0 ? MIN_ENTRIES : glyphMap->entryCapacity * 2;
+        glyphMap->entries = (Glyph_Entry*)realloc(glyphMap->entries, sizeof(Glyph_Entry) * glyphMap->entryCapacity);
+    }
+    return glyphMap->entryCount++;
+}
+
+//Rasterizes a code point into the atlas. Returns its entry or -1 if there is no room for it.
+static int bakeGlyph(Glyph_Map* glyphMap, Uint32 codepoint)
+{
+    SDL_Surface* surface = renderGlyph(glyphMap->font, codepoint);
+    if (surface == NULL) {
+        return -1;
+    }
+
+    int w = surface->w + GLYPH_PADDING;
+    int h = surface->h + GLYPH_PADDING;
+    int page = 0;
+    Glyph_Rect slot;
+    int index;
+    if (packGlyph(glyphMap, w, h, &page, &slot)) {
+        index = newEntry(glyphMap);
+    }
+    else {
+        index = evictGlyph(glyphMap, w, h);
+        if (index < 0) {
+            SDL_FreeSurface(surface);
+            return -1;
+        }
+        page = glyphMap->entries[index].page;
+        slot = glyphMap->entries[index].slot;
+    }
+
+    Glyph_Entry* entry = &glyphMap->entries[index];
+    entry->codepoint = codepoint;
+    entry->page = page;
+    entry->slot = slot;
+    entry->rect = (Glyph_Rect){.x = slot.x, .y = slot.y, .w = surface->w, .h = surface->h};
+    entry->used = glyphMap->frame;
+    SDL_Rect dest = {entry->rect.x, entry->rect.y, entry->rect.w, entry->rect.h};
+    SDL_UpdateTexture(glyphMap->textures[page], &dest, surface->pixels, surface->pitch);
+    SDL_FreeSurface(surface);
+
+    tableInsert(glyphMap, index);
+    pushNewest(glyphMap, index);
+    return index;
+}
+
+void initGlyphs(void)
+{
+    if (fontLock == NULL) {
+        fontLock = SDL_CreateMutex();
+    }
+}
 
+void lockFonts(void)
+{
+    SDL_LockMutex(fontLock);
+}
+
+void unlockFonts(void)
+{
+    SDL_UnlockMutex(fontLock);
+}
+
+void closeGlyphFont(TTF_Font* font)
+{
+    if (font == NULL) {
+        return;
+    }
+    lockFonts();
+    TTF_CloseFont(font);
+    unlockFonts();
+}
+
+static int fontHeight(TTF_Font* font)
+{
+    int height = TTF_FontHeight(font);
+    int ascent = TTF_FontAscent(font);
+    int descent = TTF_FontDescent(font);
+    if (ascent - descent != height) {
+        height = ascent - descent;
+    }
+    return height;
+}
+
+//The pixels are allocated with the image and freed with it.
+Glyph_Image* createGlyphImage(int width, int height)
+{
+    Glyph_Image* image = (Glyph_Image*)calloc(1, sizeof(Glyph_Image) + sizeof(Uint32) * width * height);
+    image->width = width;
+    image->height = height;
+    image->pixels = (Uint32*)(image + 1);
+    return image;
+}
+
+void freeGlyphImage(Glyph_Image* image)
+{
+    free(image);
+}
+
+//Rasterizes printable ASCII into rows of an image. Does not touch the renderer, so it can run on
+//any thread.
+Glyph_Image* bakeGlyphImage(TTF_Font* font)
+{
+    SDL_Surface* surfaces[GLYPH_ASCII] = {0};
+    Glyph_Rect rects[GLYPH_ASCII] = {0};
+    int x = SOLID_SIZE + GLYPH_PADDING;
+    int y = 0;
+    int rowHeight = SOLID_SIZE + GLYPH_PADDING;
+    for (Uint32 c = 32; c < 127; c++) {
+        SDL_Surface* surface = renderGlyph(font, c);
+        if (surface == NULL || surface->w + GLYPH_PADDING > IMAGE_WIDTH) {
+            if (surface != NULL) {
+                SDL_FreeSurface(surface);
+            }
+            continue;
+        }
+        if (x + surface->w + GLYPH_PADDING > IMAGE_WIDTH) {
+            y += rowHeight;
+            x = 0;
+            rowHeight = 0;
+        }
+        surfaces[c] = surface;
+        rects[c] = (Glyph_Rect){.x = x, .y = y, .w = surface->w, .h = surface->h};
+        x += surface->w + GLYPH_PADDING;
+        if (surface->h + GLYPH_PADDING > rowHeight) {
+            rowHeight = surface->h + GLYPH_PADDING;
+        }
+    }
+
+    Glyph_Image* image = createGlyphImage(IMAGE_WIDTH, y + rowHeight);
+    image->glyphHeight = fontHeight(font);
+    image->solid = (Glyph_Rect){.x = 0, .y = 0, .w = SOLID_SIZE, .h = SOLID_SIZE};
+    for (int row = 0; row < SOLID_SIZE; row++) {
+        memset(image->pixels + row * image->width, 0xFF, SOLID_SIZE * sizeof(Uint32));
+    }
+    memcpy(image->rects, rects, sizeof(rects));
+    for (int c = 0; c < GLYPH_ASCII; c++) {
+        SDL_Surface* surface = surfaces[c];
+        if (surface == NULL) {
+            continue;
+        }
+        for (int row = 0; row < surface->h; row++) {
+            memcpy(image->pixels + (rects[c].y + row) * image->width + rects[c].x,
+                   (const char*)surface->pixels + row * surface->pitch, surface->w * sizeof(Uint32));
+        }
+        SDL_FreeSurface(surface);
+    }
+    return image;
+}
+
+Glyph_Map* createGlyphMap(SDL_Renderer* renderer, TTF_Font* font, const Glyph_Image* image)
+{
+    Glyph_Map* glyphMap = (Glyph_Map*)calloc(1, sizeof(Glyph_Map));
+    glyphMap->renderer = renderer;
+    glyphMap->tableSize = MIN_TABLE;
+    glyphMap->table = (int*)malloc(sizeof(int) * MIN_TABLE);
+    createPage(glyphMap);
+    setGlyphFont(glyphMap, font, image);
     return glyphMap;
 }
 
@@ -23,50 +373,211 @@ void freeGlyphMap(Glyph_Map* glyphMap)
     if (glyphMap == NULL) {
         return;
     }
+    for (int i = 0; i < glyphMap->pageCount; i++) {
+        SDL_DestroyTexture(glyphMap->textures[i]);
+        free(glyphMap->pages[i].shelves);
+    }
+    free(glyphMap->entries);
+    free(glyphMap->table);
+    free(glyphMap);
+}
+
+//Drops every glyph and puts the ASCII baked for the new font in with one upload. The pages are kept
+//and packed again.
+void setGlyphFont(Glyph_Map* glyphMap, TTF_Font* font, const Glyph_Image* image)
+{
+    glyphMap->font = font;
+    glyphMap->entryCount = 0;
+    glyphMap->newest = -1;
+    glyphMap->oldest = -1;
+    glyphMap->generation++;
+    memset(glyphMap->table, -1, sizeof(int) * glyphMap->tableSize);
+    memset(glyphMap->ascii, -1, sizeof(glyphMap->ascii));
+    for (int i = 0; i < glyphMap->pageCount; i++) {
+        glyphMap->pages[i].shelfCount = 0;
+        glyphMap->pages[i].top = 0;
+    }
+    glyphMap->glyphHeight = image->glyphHeight;
 
-    for (int i = 0; i < glyphMap->maxGlyphs; ++i)
-    {
-        Glyph_Rect* rect = glyphMap->glyphs[i];
-        if (rect != NULL)
-        {
-            free(rect);
+    Glyph_Rect slot = {0};
+    int page = 0;
+    if (!packGlyph(glyphMap, image->width, image->height, &page, &slot)) {
+        return;
+    }
+    SDL_Rect dest = {slot.x, slot.y, image->width, image->height};
+    SDL_UpdateTexture(glyphMap->textures[page], &dest, image->pixels, image->width * sizeof(Uint32));
+    glyphMap->solid = image->solid;
+    glyphMap->solid.x += slot.x;
+    glyphMap->solid.y += slot.y;
+
+    //ASCII is pinned: it stays out of the hash and the recency list and is never evicted.
+    for (Uint32 c = 0; c < GLYPH_ASCII; c++) {
+        const Glyph_Rect* rect = &image->rects[c];
+        if (rect->h == 0) {
+            continue;
         }
+        int index = newEntry(glyphMap);
+        Glyph_Entry* entry = &glyphMap->entries[index];
+        entry->codepoint = c;
+        entry->page = page;
+        entry->rect = (Glyph_Rect){.x = slot.x + rect->x, .y = slot.y + rect->y, .w = rect->w, .h = rect->h};
+        entry->slot = (Glyph_Rect){.x = entry->rect.x, .y = entry->rect.y, .w = rect->w + GLYPH_PADDING,
+                                   .h = rect->h + GLYPH_PADDING};
+        entry->used = glyphMap->frame;
+        entry->newer = -1;
+        entry->older = -1;
+        glyphMap->ascii[c] = index;
     }
 
-    free(glyphMap->glyphs);
-    free(glyphMap);
+    memset(glyphMap->widths, 0, sizeof(glyphMap->widths));
+    glyphMap->advance = image->rects[' '].w;
+    for (Uint32 c = 32; c < 127; c++) {
+        glyphMap->widths[c] = (Uint16)image->rects[c].w;
+        if (image->rects[c].w != glyphMap->advance) {
+            glyphMap->advance = 0;
+        }
+    }
+    glyphMap->tabWidth = TAB_SIZE * (image->rects[' '].w > 0 ? image->rects[' '].w : image->glyphHeight / 2);
 }
 
-void addGlyph(Glyph_Map* glyphMap, char c, SDL_Rect* glyph)
+//Glyphs drawn in the current frame are never evicted to make room for another one.
+void nextGlyphFrame(Glyph_Map* glyphMap)
 {
-    int mapIndex = c - 32;
+    glyphMap->frame++;
+}
 
-    if (glyphMap == NULL) {
-        return;
+//Returns the glyph of a code point, rasterizing it if this is the first time it is drawn. Falls back
+//to '?' when it cannot be baked. The pointer is only valid until the next call.
+Glyph_Entry* findGlyph(Glyph_Map* glyphMap, Uint32 codepoint)
+{
+    if (codepoint < GLYPH_ASCII && glyphMap->ascii[codepoint] >= 0) {
+        return &glyphMap->entries[glyphMap->ascii[codepoint]];
+    }
+    int index = glyphMap->table[findSlot(glyphMap, codepoint)];
+    if (index >= 0) {
+        Glyph_Entry* entry = &glyphMap->entries[index];
+        entry->used = glyphMap->frame;
+        if (glyphMap->newest != index) {
+            unlinkEntry(glyphMap, entry);
+            pushNewest(glyphMap, index);
+        }
+        return entry;
+    }
+    index = bakeGlyph(glyphMap, codepoint);
+    if (index < 0) {
+        index = glyphMap->ascii['?'];
+    }
+    return &glyphMap->entries[index];
+}
+
+int glyphWidth(Glyph_Map* glyphMap, Uint32 codepoint)
+{
+    return findGlyph(glyphMap, codepoint)->rect.w;
+}
+
+//Next tab stop after x.
+int tabStop(Glyph_Map* glyphMap, int x)
+{
+    return (x / glyphMap->tabWidth + 1) * glyphMap->tabWidth;
+}
+
+//Width of a run of printable ASCII. Fixed pitch fonts multiply, otherwise the flat table is summed
+//with independent accumulators so the additions overlap.
+static int asciiWidth(Glyph_Map* glyphMap, const char* string, const char* end)
+{
+    if (glyphMap->advance > 0) {
+        return (int)(end - string) * glyphMap->advance;
+    }
+    const unsigned char* p = (const unsigned char*)string;
+    const unsigned char* last = (const unsigned char*)end;
+    int sums[4] = {0};
+    for (; last - p >= 4; p += 4) {
+        sums[0] += glyphMap->widths[p[0]];
+        sums[1] += glyphMap->widths[p[1]];
+        sums[2] += glyphMap->widths[p[2]];
+        sums[3] += glyphMap->widths[p[3]];
     }
+    for (; p < last; p++) {
+        sums[0] += glyphMap->widths[*p];
+    }
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
 
-    //Create a new node and add to the map if no node exists
-    if (glyphMap->glyphs[mapIndex] == NULL) {
-        Glyph_Rect* newGlyph = (Glyph_Rect*)malloc(sizeof(Glyph_Rect));
-        newGlyph->x = glyph->x;
-        newGlyph->y = glyph->y;
-        newGlyph->w = glyph->w;
-        newGlyph->h = glyph->h;
-        glyphMap->glyphs[mapIndex] = newGlyph;
+//Advance of the character at string that is not printable ASCII, with the pen at x. Tabs go to the
+//next stop and other control characters take no space.
+static int specialWidth(Glyph_Map* glyphMap, const char* string, const char* end, int x, size_t* length)
+{
+    if (*string == '\t') {
+        *length = 1;
+        return tabStop(glyphMap, x) - x;
     }
-    else {
-        //Rewrite the node if it exists.
-        Glyph_Rect* newGlyph = glyphMap->glyphs[mapIndex];
-        newGlyph->x = glyph->x;
-        newGlyph->y = glyph->y;
-        newGlyph->w = glyph->w;
-        newGlyph->h = glyph->h;
-        glyphMap->glyphs[mapIndex] = newGlyph;
+    Uint32 codepoint = decodeUtf8(string, end, length);
+    return codepoint < 32 ? 0 : glyphWidth(glyphMap, codepoint);
+}
+
+//Where the pen ends up after laying out string from x. Runs of printable ASCII are measured in one
+//go, only the characters between them are looked at one by one.
+int spanWidth(Glyph_Map* glyphMap, const char* string, const char* end, int x)
+{
+    const char* p = string;
+    while (p < end) {
+        const char* special = findSpecialByte(p, end);
+        if (special == NULL) {
+            return x + asciiWidth(glyphMap, p, end);
+        }
+        x += asciiWidth(glyphMap, p, special);
+        size_t length;
+        x += specialWidth(glyphMap, special, end, x, &length);
+        p = special + length;
+    }
+    return x;
+}
+
+//Lays out string from *x and returns the first character whose middle is past target, or end if
+//there is none. *x is left at the start of that character.
+const char* spanPosition(Glyph_Map* glyphMap, const char* string, const char* end, int* x, int target)
+{
+    const char* p = string;
+    int pen = *x;
+    while (p < end) {
+        const char* special = findSpecialByte(p, end);
+        const char* runEnd = special != NULL ? special : end;
+        if (glyphMap->advance > 0) {
+            int offset = target - pen - glyphMap->advance / 2;
+            size_t column = offset < 0 ? 0 : (size_t)(offset / glyphMap->advance) + 1;
+            if (column < (size_t)(runEnd - p)) {
+                *x = pen + (int)column * glyphMap->advance;
+                return p + column;
+            }
+            pen += (int)(runEnd - p) * glyphMap->advance;
+        }
+        else {
+            for (; p < runEnd; p++) {
+                int width = glyphMap->widths[(unsigned char)*p];
+                if (pen + width / 2 > target) {
+                    *x = pen;
+                    return p;
+                }
+                pen += width;
+            }
+        }
+        if (special == NULL) {
+            break;
+        }
+        size_t length;
+        int width = specialWidth(glyphMap, special, end, pen, &length);
+        if (pen + width / 2 > target) {
+            *x = pen;
+            return special;
+        }
+        pen += width;
+        p = special + length;
     }
-    return;
+    *x = pen;
+    return end;
 }
 
 void setGlyphHeight(Glyph_Map* glyphMap, int height)
 {
     glyphMap->glyphHeight = height;
-}
\ No newline at end of file
+}
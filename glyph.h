@@ -2,10 +2,17 @@
 #define GLYPH_H_
 
 #include <SDL.h>
+#include <SDL_ttf.h>
 
-//Generic map to hold glyph positions. Indexed based on ascii value of character.
+//Glyph atlas. Code points are rasterized the first time they are drawn and packed onto shelves of
+//fixed size texture pages. ASCII is baked up front and looked up by direct index, everything else
+//goes through an open addressing hash. Once every page is full the least recently used glyph whose
+//slot is big enough makes room.
 
-#define MAX_GLYPHS 200
+#define GLYPH_PAGE_SIZE 1024
+#define MAX_GLYPH_PAGES 4
+#define GLYPH_ASCII 128
+#define TAB_SIZE 4
 
 typedef struct {
     int x;
@@ -15,14 +22,85 @@ typedef struct {
 } Glyph_Rect;
 
 typedef struct {
-    int maxGlyphs;
-    Glyph_Rect** glyphs;
+    Uint32 codepoint;
+    int page;
+    //Part of the page with the glyph in it, and the slot it was packed into.
+    Glyph_Rect rect;
+    Glyph_Rect slot;
+    Uint32 used;
+    int newer;
+    int older;
+} Glyph_Entry;
+
+typedef struct {
+    int y;
+    int height;
+    int x;
+} Glyph_Shelf;
+
+typedef struct {
+    Glyph_Shelf* shelves;
+    int shelfCount;
+    int shelfCapacity;
+    int top;
+} Glyph_Page;
+
+//ASCII rasterized into one image next to the solid patch, so a font size goes into the atlas with a
+//single upload and can be kept on disk between runs. Code points without a glyph have a zero rect.
+typedef struct {
+    int glyphHeight;
+    int width;
+    int height;
+    Glyph_Rect solid;
+    Glyph_Rect rects[GLYPH_ASCII];
+    Uint32* pixels;
+} Glyph_Image;
+
+typedef struct {
+    SDL_Renderer* renderer;
+    TTF_Font* font;
     int glyphHeight;
+    SDL_Texture* textures[MAX_GLYPH_PAGES];
+    Glyph_Page pages[MAX_GLYPH_PAGES];
+    int pageCount;
+    Glyph_Entry* entries;
+    int entryCount;
+    int entryCapacity;
+    int* table;
+    int tableSize;
+    int ascii[GLYPH_ASCII];
+    //Advances of ASCII in one flat table, 0 for control characters, so runs of ASCII are measured
+    //without going through the entries.
+    Uint16 widths[GLYPH_ASCII];
+    //Advance shared by all of printable ASCII when the font is fixed pitch, 0 otherwise.
+    int advance;
+    int tabWidth;
+    //Recency list of the glyphs that can be evicted, ASCII is never evicted.
+    int newest;
+    int oldest;
+    Uint32 frame;
+    //Changes whenever a glyph moves, anything holding on to atlas coordinates has to be rebuilt.
+    Uint32 generation;
+    //White patch on the first page used to draw filled rectangles.
+    Glyph_Rect solid;
 } Glyph_Map;
 
-Glyph_Map* createGlyphMap(void);
+void initGlyphs(void);
+void lockFonts(void);
+void unlockFonts(void);
+void closeGlyphFont(TTF_Font* font);
+Glyph_Image* createGlyphImage(int width, int height);
+Glyph_Image* bakeGlyphImage(TTF_Font* font);
+void freeGlyphImage(Glyph_Image* image);
+Glyph_Map* createGlyphMap(SDL_Renderer* renderer, TTF_Font* font, const Glyph_Image* image);
 void freeGlyphMap(Glyph_Map* glyphMap);
-void addGlyph(Glyph_Map* glyphMap, char c, SDL_Rect* glyph);
+void setGlyphFont(Glyph_Map* glyphMap, TTF_Font* font, const Glyph_Image* image);
+void nextGlyphFrame(Glyph_Map* glyphMap);
+Glyph_Entry* findGlyph(Glyph_Map* glyphMap, Uint32 codepoint);
+int glyphWidth(Glyph_Map* glyphMap, Uint32 codepoint);
+int tabStop(Glyph_Map* glyphMap, int x);
+int spanWidth(Glyph_Map* glyphMap, const char* string, const char* end, int x);
+const char* spanPosition(Glyph_Map* glyphMap, const char* string, const char* end, int* x, int target);
 void setGlyphHeight(Glyph_Map* glyphMap, int height);
 
 #endif
@@ -0,0 +1,399 @@
+#include "grep.h"
+#include "scan.h"
+#include <regex.h>
+#include <string.h>
+
+// Matches are handed over and cancelling is checked after about this many bytes.
+#define SEARCH_BATCH_BYTES (256 * 1024)
+#define SNAPSHOT_BLOCK (1 << 20)
+// Copies of lines that changed since are dropped with the whole snapshot once there are this many
+// bytes of them more than half the copies.
+#define SNAPSHOT_SLACK (64 << 20)
+#define MIN_SNAPSHOT_LINES 1024
+#define MAX_LITERAL 256
+
+typedef struct {
+    const char* data;
+    size_t length;
+} SearchLine;
+
+typedef struct SnapshotBlock SnapshotBlock;
+
+struct SnapshotBlock {
+    SnapshotBlock* next;
+    size_t used;
+    size_t capacity;
+    char data[];
+};
+
+// The lines as they were when the search started. Unedited lines point into the read-only source,
+// edited ones are copied with their gap closed so the regex sees one string. Between searches only
+// the lines that changed are taken again.
+struct SearchSnapshot {
+    SearchLine* lines;
+    size_t count;
+    size_t capacity;
+    int taken;
+    SnapshotBlock* blocks;
+    size_t copiedBytes;
+    // Bytes of copies that lines which changed since no longer point to, at most.
+    size_t droppedBytes;
+};
+
+struct SearchJob {
+    regex_t regex;
+    char literal[MAX_LITERAL];
+    size_t literalLength;
+    SearchSnapshot* snapshot;
+    size_t firstLine;
+    Uint32 progressEvent;
+    SDL_Thread* thread;
+    // Lines are copied here to end them with a NUL if regexec can not be given the end.
+    char* scratch;
+    size_t scratchCapacity;
+    // Shared with the search thread, guarded by lock.
+    SDL_mutex* lock;
+    MatchList pending;
+    int notified;
+    int finished;
+    int cancel;
+};
+
+static const char* snapshotCopy(SearchSnapshot* snapshot, const LineSpan* line)
+{
+    size_t length = line->beforeLength + line->afterLength;
+    SnapshotBlock* block = snapshot->blocks;
+    if (block == NULL || block->capacity - block->used < length) {
+        size_t capacity = length > SNAPSHOT_BLOCK ? length : SNAPSHOT_BLOCK;
+        block = (SnapshotBlock*)malloc(sizeof(SnapshotBlock) + capacity);
+        block->next = snapshot->blocks;
+        block->used = 0;
+        block->capacity = capacity;
+        snapshot->blocks = block;
+    }
+    char* copy = block->data + block->used;
+    memcpy(copy, line->before, line->beforeLength);
+    memcpy(copy + line->beforeLength, line->after, line->afterLength);
+    block->used += length;
+    snapshot->copiedBytes += length;
+    return copy;
+}
+
+static void freeSnapshotBlocks(SearchSnapshot* snapshot)
+{
+    while (snapshot->blocks != NULL) {
+        SnapshotBlock* next = snapshot->blocks->next;
+        free(snapshot->blocks);
+        snapshot->blocks = next;
+    }
+    snapshot->copiedBytes = 0;
+    snapshot->droppedBytes = 0;
+}
+
+static void reserveSnapshotLines(SearchSnapshot* snapshot, size_t count)
+{
+    if (count + 1 <= snapshot->capacity) {
+        return;
+    }
+    while (count + 1 > snapshot->capacity) {
+        snapshot->capacity = snapshot->capacity == 0 ? MIN_SNAPSHOT_LINES : snapshot->capacity * 2;
+    }
+    snapshot->lines = (SearchLine*)realloc(snapshot->lines, sizeof(SearchLine) * snapshot->capacity);
+}
+
+static void takeLines(SearchSnapshot* snapshot, Text* text, size_t from, size_t to)
+{
+    for (size_t line = from; line < to; line++) {
+        LineSpan span = getLineSpan(text, line);
+        snapshot->lines[line].length = span.beforeLength + span.afterLength;
+        snapshot->lines[line].data = text->lines[line].buffer == NULL ? span.after : snapshotCopy(snapshot, &span);
+    }
+}
+
+// Brings the snapshot up to date with the text. The first time, and once the copies of lines that
+// changed since take too much memory, every line is taken. After that only the lines the text
+// reports as changed are taken again and the ones after them are moved along, like the text's own
+// line array is.
+static void updateSnapshot(SearchSnapshot* snapshot, Text* text)
+{
+    LineChange change;
+    int changed = takeLineChanges(text, &change);
+    int whole = !snapshot->taken || snapshot->droppedBytes > snapshot->copiedBytes / 2 + SNAPSHOT_SLACK ||
+                (changed && snapshot->count - change.oldEnd + change.newEnd != text->lineCount);
+    if (whole) {
+        freeSnapshotBlocks(snapshot);
+        reserveSnapshotLines(snapshot, text->lineCount);
+        takeLines(snapshot, text, 0, text->lineCount);
+        snapshot->count = text->lineCount;
+        snapshot->taken = 1;
+        return;
+    }
+    if (!changed) {
+        return;
+    }
+    for (size_t line = change.start; line < change.oldEnd; line++) {
+        snapshot->droppedBytes += snapshot->lines[line].length;
+    }
+    reserveSnapshotLines(snapshot, text->lineCount);
+    memmove(snapshot->lines + change.newEnd, snapshot->lines + change.oldEnd,
+            sizeof(SearchLine) * (snapshot->count - change.oldEnd));
+    takeLines(snapshot, text, change.start, change.newEnd);
+    snapshot->count = text->lineCount;
+}
+
+SearchSnapshot* createSnapshot(void)
+{
+    return (SearchSnapshot*)calloc(1, sizeof(SearchSnapshot));
+}
+
+void freeSnapshot(SearchSnapshot* snapshot)
+{
+    if (snapshot == NULL) {
+        return;
+    }
+    freeSnapshotBlocks(snapshot);
+    free(snapshot->lines);
+    free(snapshot);
+}
+
+// Skips a bracket expression, p is on its '['.
+static const char* skipBracket(const char* p)
+{
+    p++;
+    if (*p == '^') {
+        p++;
+    }
+    if (*p == ']') {
+        p++;
+    }
+    while (*p != '\0' && *p != ']') {
+        if (p[0] == '[' && (p[1] == ':' || p[1] == '=' || p[1] == '.')) {
+            char close = p[1];
+            for (p += 2; *p != '\0' && !(p[0] == close && p[1] == ']'); p++) {
+            }
+            if (*p != '\0') {
+                p++;
+            }
+        }
+        if (*p != '\0') {
+            p++;
+        }
+    }
+    return *p == ']' ? p + 1 : p;
+}
+
+// Longest run of plain characters outside any group that every match contains, so lines without it
+// are skipped before the regex runs on them. Empty if the pattern has an alternative at the top
+// level, since then nothing is needed by all matches.
+static size_t requiredLiteral(const char* pattern, char* literal)
+{
+    char run[MAX_LITERAL];
+    size_t runLength = 0;
+    size_t best = 0;
+    int depth = 0;
+    const char* p = pattern;
+    while (*p != '\0') {
+        int plain = 0;
+        char value = *p;
+        const char* next = p + 1;
+        if (*p == '\\' && p[1] != '\0') {
+            plain = !((p[1] >= 'a' && p[1] <= 'z') || (p[1] >= 'A' && p[1] <= 'Z') || (p[1] >= '0' && p[1] <= '9'));
+            value = p[1];
+            next = p + 2;
+        }
+        else if (*p == '[') {
+            next = skipBracket(p);
+        }
+        else if (*p == '(') {
+            depth++;
+        }
+        else if (*p == ')') {
+            depth = depth > 0 ? depth - 1 : 0;
+        }
+        else if (*p == '|' && depth == 0) {
+            return 0;
+        }
+        else {
+            plain = strchr(".*+?{}^$|", *p) == NULL;
+        }
+
+        // A character that may be left out or repeated ends the run, one that repeats ends it after.
+        int optional = *next == '*' || *next == '?' || *next == '{';
+        if (plain && depth == 0 && !optional && runLength < MAX_LITERAL) {
+            run[runLength++] = value;
+        }
+        if (!plain || depth > 0 || optional || *next == '+') {
+            if (runLength > best) {
+                best = runLength;
+                memcpy(literal, run, runLength);
+            }
+            runLength = 0;
+        }
+        p = next;
+    }
+    if (runLength > best) {
+        best = runLength;
+        memcpy(literal, run, runLength);
+    }
+    return best;
+}
+
+// Runs the regex from offset on. The match is relative to string.
+static int matchFrom(SearchJob* job, const char* string, size_t length, size_t offset, regmatch_t* match)
+{
+    int flags = offset > 0 ? REG_NOTBOL : 0;
+#ifdef REG_STARTEND
+    match->rm_so = (regoff_t)offset;
+    match->rm_eo = (regoff_t)length;
+    return regexec(&job->regex, string, 1, match, flags | REG_STARTEND) == 0;
+#else
+    if (length + 1 > job->scratchCapacity) {
+        job->scratchCapacity = length + 1;
+        job->scratch = (char*)realloc(job->scratch, job->scratchCapacity);
+    }
+    memcpy(job->scratch, string + offset, length - offset);
+    job->scratch[length - offset] = '\0';
+    if (regexec(&job->regex, job->scratch, 1, match, flags) != 0) {
+        return 0;
+    }
+    match->rm_so += (regoff_t)offset;
+    match->rm_eo += (regoff_t)offset;
+    return 1;
+#endif
+}
+
+// Empty matches are stepped over, there is nothing to show for them.
+static void searchLine(SearchJob* job, size_t index, MatchList* found)
+{
+    const SearchLine* line = &job->snapshot->lines[index];
+    if (job->literalLength > 0 &&
+        findLiteral(line->data, line->data + line->length, job->literal, job->literalLength) == NULL) {
+        return;
+    }
+    size_t lineNumber = index;
+    size_t offset = 0;
+    regmatch_t result;
+    while (offset <= line->length && matchFrom(job, line->data, line->length, offset, &result)) {
+        size_t start = (size_t)result.rm_so;
+        size_t end = (size_t)result.rm_eo;
+        if (end > start) {
+            Match match = {.start = {.line = lineNumber, .index = start}, .end = {.line = lineNumber, .index = end}};
+            addMatch(found, match);
+        }
+        offset = end > start ? end : end + 1;
+    }
+}
+
+// Moves the matches found since the last call to the job. Returns 0 if the search was cancelled.
+static int handOver(SearchJob* job, MatchList* found, int done)
+{
+    SDL_LockMutex(job->lock);
+    for (size_t i = 0; i < found->count; i++) {
+        addMatch(&job->pending, found->matches[i]);
+    }
+    found->count = 0;
+    job->finished = done;
+    int notify = !job->notified && (job->pending.count > 0 || done);
+    job->notified |= notify;
+    int cancel = job->cancel;
+    SDL_UnlockMutex(job->lock);
+
+    if (notify && job->progressEvent != 0) {
+        SDL_Event event = {0};
+        event.type = job->progressEvent;
+        event.user.data1 = job;
+        SDL_PushEvent(&event);
+    }
+    return !cancel;
+}
+
+static int searchThread(void* data)
+{
+    SearchJob* job = (SearchJob*)data;
+    MatchList found = {0};
+    size_t bytes = 0;
+    for (size_t i = job->firstLine; i < job->snapshot->count; i++) {
+        searchLine(job, i, &found);
+        bytes += job->snapshot->lines[i].length + 1;
+        if (bytes >= SEARCH_BATCH_BYTES) {
+            bytes = 0;
+            if (!handOver(job, &found, 0)) {
+                freeMatchList(&found);
+                return 0;
+            }
+        }
+    }
+    handOver(job, &found, 1);
+    freeMatchList(&found);
+    return 0;
+}
+
+static void freeSearchJob(SearchJob* job)
+{
+    regfree(&job->regex);
+    freeMatchList(&job->pending);
+    SDL_DestroyMutex(job->lock);
+    free(job->scratch);
+    free(job);
+}
+
+// Searches the lines from firstLine on for pattern. previous is cancelled first, then the snapshot
+// is brought up to date with the text, which only looks at the lines that changed since it was
+// last searched. Returns NULL if the pattern is not a valid regular expression.
+SearchJob* startSearch(const char* pattern, Text* text, SearchSnapshot* snapshot, size_t firstLine,
+                       SearchJob* previous, Uint32 progressEvent)
+{
+    cancelSearch(previous);
+    SearchJob* job = (SearchJob*)calloc(1, sizeof(SearchJob));
+    if (regcomp(&job->regex, pattern, REG_EXTENDED) != 0) {
+        free(job);
+        return NULL;
+    }
+    updateSnapshot(snapshot, text);
+    job->literalLength = requiredLiteral(pattern, job->literal);
+    job->snapshot = snapshot;
+    job->firstLine = firstLine;
+    job->progressEvent = progressEvent;
+    job->lock = SDL_CreateMutex();
+    job->thread = SDL_CreateThread(searchThread, "search", job);
+    if (job->thread == NULL) {
+        searchThread(job);
+    }
+    return job;
+}
+
+// Stops the search and frees it.
+void cancelSearch(SearchJob* job)
+{
+    if (job == NULL) {
+        return;
+    }
+    SDL_LockMutex(job->lock);
+    job->cancel = 1;
+    SDL_UnlockMutex(job->lock);
+    SDL_WaitThread(job->thread, NULL);
+    freeSearchJob(job);
+}
+
+// Appends the matches found since the last call to matches, in the order they are in the text.
+// Returns how many matches there are now.
+size_t takeMatches(SearchJob* job, MatchList* matches)
+{
+    SDL_LockMutex(job->lock);
+    for (size_t i = 0; i < job->pending.count; i++) {
+        addMatch(matches, job->pending.matches[i]);
+    }
+    job->pending.count = 0;
+    job->notified = 0;
+    SDL_UnlockMutex(job->lock);
+    return matches->count;
+}
+
+// Whether every line was searched and all matches were taken.
+int searchFinished(SearchJob* job)
+{
+    SDL_LockMutex(job->lock);
+    int finished = job->finished && job->pending.count == 0;
+    SDL_UnlockMutex(job->lock);
+    return finished;
+}
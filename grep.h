@@ -0,0 +1,25 @@
+#ifndef GREP_H_
+#define GREP_H_
+
+#include <SDL.h>
+#include "line.h"
+#include "search.h"
+
+// Regular expression search, POSIX extended syntax, on a background thread. The job searches a
+// snapshot of the text, so editing goes on while it runs, and hands its matches over in batches.
+// progressEvent is pushed when there are matches to take or the search is done. A search is
+// cancelled and started again when the pattern or the text changes. The snapshot is kept by the
+// caller from one search to the next, so only the lines that changed in between are taken again.
+
+typedef struct SearchJob SearchJob;
+typedef struct SearchSnapshot SearchSnapshot;
+
+SearchSnapshot* createSnapshot(void);
+void freeSnapshot(SearchSnapshot* snapshot);
+SearchJob* startSearch(const char* pattern, Text* text, SearchSnapshot* snapshot, size_t firstLine,
+                       SearchJob* previous, Uint32 progressEvent);
+void cancelSearch(SearchJob* job);
+size_t takeMatches(SearchJob* job, MatchList* matches);
+int searchFinished(SearchJob* job);
+
+#endif
@@ -0,0 +1,132 @@
+#include "highlight.h"
+#include <string.h>
+
+#define MIN_TOKENS 16
+// Longer lines are not lexed, they end in the state they start in and are drawn as plain text.
+#define MAX_LEXED_LINE (64 * 1024)
+// A line drawn further than this below the last line lexed in order is drawn as if it started in
+// LEX_START, until highlightLines gets there.
+#define START_STATE_LINES 256
+
+// Starts a token at start, unless the token before is of the same kind and simply goes on.
+void addToken(TokenList* tokens, size_t start, TokenKind kind)
+{
+    if (tokens->count > 0 && tokens->spans[tokens->count - 1].kind == kind) {
+        return;
+    }
+    if (tokens->count == tokens->capacity) {
+        tokens->capacity = tokens->capacity == 0 ? MIN_TOKENS : tokens->capacity * 2;
+        tokens->spans = (TokenSpan*)realloc(tokens->spans, sizeof(TokenSpan) * tokens->capacity);
+    }
+    tokens->spans[tokens->count++] = (TokenSpan){.start = start, .kind = kind};
+}
+
+// NULL if there is no lexer, the text is drawn plain then.
+Highlighter* createHighlighter(const Lexer* lexer)
+{
+    if (lexer == NULL) {
+        return NULL;
+    }
+    Highlighter* highlighter = (Highlighter*)calloc(1, sizeof(Highlighter));
+    highlighter->lexer = lexer;
+    return highlighter;
+}
+
+void freeHighlighter(Highlighter* highlighter)
+{
+    if (highlighter == NULL) {
+        return;
+    }
+    free(highlighter->tokens.spans);
+    free(highlighter->scratch);
+    free(highlighter);
+}
+
+// Lexes a line that starts in state into the highlighter's tokens. If store is set the state it
+// ends in is kept, and if that is not the state the line ended in before the line after is stale.
+static int lexLine(Highlighter* highlighter, Text* text, size_t line, int state, int store)
+{
+    LineSpan span = getLineSpan(text, line);
+    size_t length = span.beforeLength + span.afterLength;
+    const char* string = span.beforeLength > 0 ? span.before : span.after;
+    if (span.beforeLength > 0 && span.afterLength > 0 && length <= MAX_LEXED_LINE) {
+        if (length > highlighter->scratchCapacity) {
+            highlighter->scratchCapacity = length;
+            highlighter->scratch = (char*)realloc(highlighter->scratch, length);
+        }
+        memcpy(highlighter->scratch, span.before, span.beforeLength);
+        memcpy(highlighter->scratch + span.beforeLength, span.after, span.afterLength);
+        string = highlighter->scratch;
+    }
+
+    highlighter->tokens.count = 0;
+    int end = state;
+    if (length <= MAX_LEXED_LINE) {
+        end = highlighter->lexer->lex(state, string, length, &highlighter->tokens);
+    }
+    if (!store) {
+        return end;
+    }
+    if (end != text->lines[line].lexState && line + 1 < text->lineCount) {
+        text->lines[line + 1].lexStale = 1;
+    }
+    text->lines[line].lexState = end;
+    text->lines[line].lexStale = 0;
+    return end;
+}
+
+// State a line starts in. If the line before is stale, lines are lexed from the nearest one above
+// that is not. When that is more than START_STATE_LINES above, nothing is lexed and the state is
+// guessed to be LEX_START, *guessed is set then.
+static int startState(Highlighter* highlighter, Text* text, size_t line, int* guessed)
+{
+    size_t known = line;
+    while (known > 0 && text->lines[known - 1].lexStale && line - known < START_STATE_LINES) {
+        known--;
+    }
+    *guessed = known > 0 && text->lines[known - 1].lexStale;
+    if (*guessed) {
+        return LEX_START;
+    }
+    int state = known == 0 ? LEX_START : text->lines[known - 1].lexState;
+    for (; known < line; known++) {
+        state = lexLine(highlighter, text, known, state, 1);
+    }
+    return state;
+}
+
+int lineStartState(Highlighter* highlighter, Text* text, size_t line)
+{
+    int guessed;
+    return startState(highlighter, text, line, &guessed);
+}
+
+// Tokens of a line, valid until the next call. A line lexed from a guessed state stays stale.
+const TokenList* highlightLine(Highlighter* highlighter, Text* text, size_t line)
+{
+    int guessed;
+    int state = startState(highlighter, text, line, &guessed);
+    lexLine(highlighter, text, line, state, !guessed);
+    return &highlighter->tokens;
+}
+
+// Lexes up to budget lines from the first one that may be wrong. Once a line ends in the state it
+// ended in before, the lines up to the next stale one are skipped. Returns whether a line between
+// first and last starts in a different state now.
+int highlightLines(Highlighter* highlighter, Text* text, int budget, size_t first, size_t last)
+{
+    int changed = 0;
+    for (int i = 0; i < budget && text->lexFrontier < text->lineCount; i++) {
+        size_t line = text->lexFrontier++;
+        int old = text->lines[line].lexState;
+        int state = lexLine(highlighter, text, line, line == 0 ? LEX_START : text->lines[line - 1].lexState, 1);
+        if (state != old) {
+            changed |= line + 1 >= first && line + 1 < last;
+            continue;
+        }
+        while (text->lexFrontier < text->lineCount && !text->lines[text->lexFrontier].lexStale) {
+            text->lexFrontier++;
+        }
+    }
+    return changed;
+}
@@ -0,0 +1,59 @@
+#ifndef HIGHLIGHT_H_
+#define HIGHLIGHT_H_
+
+#include "line.h"
+
+// Syntax highlighting. A lexer splits one line into tokens given the state the line before ended
+// in, e.g. inside a block comment, and returns the state the line ends in. That state is kept on
+// each line, so a line is lexed on its own when it is drawn. After an edit lines are lexed again from
+// the first edited line until a line ends in the same state as before, the lines after it are
+// known to be right already.
+
+#define LEX_START 0
+
+typedef enum {
+    TOKEN_TEXT,
+    TOKEN_KEYWORD,
+    TOKEN_TYPE,
+    TOKEN_NUMBER,
+    TOKEN_STRING,
+    TOKEN_COMMENT,
+    TOKEN_PREPROCESSOR,
+    TOKEN_KINDS
+} TokenKind;
+
+// Tokens start where the previous one ends, the first at 0.
+typedef struct {
+    size_t start;
+    TokenKind kind;
+} TokenSpan;
+
+typedef struct {
+    TokenSpan* spans;
+    size_t count;
+    size_t capacity;
+} TokenList;
+
+typedef struct {
+    const char* name;
+    const char* const* extensions;
+    int (*lex)(int state, const char* string, size_t length, TokenList* tokens);
+} Lexer;
+
+typedef struct {
+    const Lexer* lexer;
+    TokenList tokens;
+    // Lines are lexed from one piece of memory, lines with the gap in the middle are copied here.
+    char* scratch;
+    size_t scratchCapacity;
+} Highlighter;
+
+const Lexer* findLexer(const char* path);
+void addToken(TokenList* tokens, size_t start, TokenKind kind);
+Highlighter* createHighlighter(const Lexer* lexer);
+void freeHighlighter(Highlighter* highlighter);
+int lineStartState(Highlighter* highlighter, Text* text, size_t line);
+const TokenList* highlightLine(Highlighter* highlighter, Text* text, size_t line);
+int highlightLines(Highlighter* highlighter, Text* text, int budget, size_t first, size_t last);
+
+#endif
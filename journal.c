@@ -0,0 +1,458 @@
+#define _POSIX_C_SOURCE 200809L
+#include "journal.h"
+#include "varint.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define JOURNAL_MAGIC "TXTJRNL1"
+#define COMMIT_DELAY 100
+#define COMMIT_SIZE (64 * 1024)
+#define MAX_RECORD_HEADER 31
+
+// Identifies the version of the file the records apply to. A journal whose header does not match
+// the file on disk any more is not replayed.
+typedef struct {
+    char magic[8];
+    uint64_t size;
+    int64_t seconds;
+    int64_t nanoseconds;
+} JournalHeader;
+
+struct Journal {
+    char* path;
+    char* fileName;
+    int fd;
+    SyncPolicy policy;
+    SDL_Thread* writer;
+    // Shared with the writer thread, guarded by lock.
+    SDL_mutex* lock;
+    SDL_cond* wake;
+    SDL_cond* committed;
+    char* pending;
+    size_t pendingLength;
+    size_t pendingCapacity;
+    char* spare;
+    size_t spareCapacity;
+    int writing;
+    int flush;
+    int quit;
+    int failed;
+    // Bytes of records appended since the header, and how many of them are in the file.
+    size_t recorded;
+    size_t written;
+};
+
+static JournalHeader fileHeader(char const* fileName)
+{
+    JournalHeader header = {0};
+    memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+    struct stat info;
+    if (stat(fileName, &info) == 0) {
+        header.size = (uint64_t)info.st_size;
+        header.seconds = (int64_t)info.st_mtim.tv_sec;
+        header.nanoseconds = (int64_t)info.st_mtim.tv_nsec;
+    }
+    return header;
+}
+
+static int writeAll(int fd, const char* data, size_t length)
+{
+    while (length > 0) {
+        ssize_t count = write(fd, data, length);
+        if (count < 0) {
+            return -1;
+        }
+        data += count;
+        length -= (size_t)count;
+    }
+    return 0;
+}
+
+// Writes everything recorded so far as one group. Called with the lock held, which is released
+// while the data goes to disk so recording never waits for the write.
+static void commitPending(Journal* journal)
+{
+    char* data = journal->pending;
+    size_t length = journal->pendingLength;
+    size_t capacity = journal->pendingCapacity;
+    journal->pending = journal->spare;
+    journal->pendingCapacity = journal->spareCapacity;
+    journal->pendingLength = 0;
+    journal->writing = 1;
+    SDL_UnlockMutex(journal->lock);
+
+    int result = writeAll(journal->fd, data, length);
+    if (result == 0 && journal->policy != SYNC_NONE) {
+        result = fdatasync(journal->fd);
+    }
+
+    SDL_LockMutex(journal->lock);
+    if (result != 0 && !journal->failed) {
+        fprintf(stderr, "Could not write journal %s\n", journal->path);
+        journal->failed = 1;
+    }
+    journal->spare = data;
+    journal->spareCapacity = capacity;
+    journal->written += length;
+    journal->writing = 0;
+    SDL_CondBroadcast(journal->committed);
+}
+
+// Writer thread. Waits for the first record of a group, then gives the editor a moment to add more
+// so a burst of typing turns into a single write.
+static int writeJournal(void* data)
+{
+    Journal* journal = (Journal*)data;
+    SDL_LockMutex(journal->lock);
+    while (!journal->quit) {
+        if (journal->pendingLength == 0) {
+            SDL_CondWait(journal->wake, journal->lock);
+            continue;
+        }
+        if (!journal->flush && journal->pendingLength < COMMIT_SIZE) {
+            SDL_CondWaitTimeout(journal->wake, journal->lock, COMMIT_DELAY);
+        }
+        commitPending(journal);
+        journal->flush = 0;
+    }
+    if (journal->pendingLength > 0) {
+        commitPending(journal);
+    }
+    SDL_UnlockMutex(journal->lock);
+    return 0;
+}
+
+// Waits until every record is in the file and the writer is idle. Called with the lock held.
+static void waitCommitted(Journal* journal)
+{
+    while (journal->pendingLength > 0 || journal->writing) {
+        journal->flush = 1;
+        SDL_CondSignal(journal->wake);
+        SDL_CondWait(journal->committed, journal->lock);
+    }
+}
+
+// Creates a journal file holding header and the records in data, and swaps it in for the old one.
+static int replaceJournal(Journal* journal, JournalHeader* header, const char* data, size_t length)
+{
+    size_t pathLength = strlen(journal->path);
+    char* tempName = (char*)malloc(pathLength + 8);
+    memcpy(tempName, journal->path, pathLength);
+    memcpy(tempName + pathLength, ".XXXXXX", 8);
+    int fd = mkstemp(tempName);
+    if (fd < 0) {
+        free(tempName);
+        return -1;
+    }
+    int result = writeAll(fd, (const char*)header, sizeof(JournalHeader));
+    if (result == 0) {
+        result = writeAll(fd, data, length);
+    }
+    if (result == 0 && journal->policy != SYNC_NONE) {
+        result = fsync(fd);
+    }
+    if (result == 0) {
+        result = rename(tempName, journal->path);
+    }
+    if (result != 0) {
+        close(fd);
+        unlink(tempName);
+        free(tempName);
+        return -1;
+    }
+    free(tempName);
+    if (journal->fd >= 0) {
+        close(journal->fd);
+    }
+    journal->fd = fd;
+    return 0;
+}
+
+// Opens the journal of fileName. A journal left behind for the same version of the file is kept so
+// it can be replayed and appended to, anything else is replaced by an empty one. Returns NULL if the
+// journal cannot be written.
+Journal* openJournal(char const* fileName, SyncPolicy policy)
+{
+    Journal* journal = (Journal*)calloc(1, sizeof(Journal));
+    size_t nameLength = strlen(fileName);
+    journal->fileName = (char*)malloc(nameLength + 1);
+    memcpy(journal->fileName, fileName, nameLength + 1);
+    journal->path = (char*)malloc(nameLength + 9);
+    memcpy(journal->path, fileName, nameLength);
+    memcpy(journal->path + nameLength, ".journal", 9);
+    journal->policy = policy;
+
+    JournalHeader header = fileHeader(fileName);
+    journal->fd = open(journal->path, O_RDWR);
+    if (journal->fd >= 0) {
+        JournalHeader existing;
+        struct stat info;
+        if (read(journal->fd, &existing, sizeof(existing)) == (ssize_t)sizeof(existing)
+            && memcmp(&existing, &header, sizeof(header)) == 0 && fstat(journal->fd, &info) == 0) {
+            journal->recorded = journal->written = (size_t)info.st_size - sizeof(header);
+            lseek(journal->fd, 0, SEEK_END);
+        }
+        else {
+            fprintf(stderr, "%s does not match %s, starting a new journal\n", journal->path, fileName);
+            close(journal->fd);
+            journal->fd = -1;
+        }
+    }
+    if (journal->fd < 0 && replaceJournal(journal, &header, NULL, 0) != 0) {
+        fprintf(stderr, "Could not create journal %s\n", journal->path);
+        free(journal->path);
+        free(journal->fileName);
+        free(journal);
+        return NULL;
+    }
+
+    journal->lock = SDL_CreateMutex();
+    journal->wake = SDL_CreateCond();
+    journal->committed = SDL_CreateCond();
+    journal->writer = SDL_CreateThread(writeJournal, "journal", journal);
+    return journal;
+}
+
+// Commits what is left and removes the journal if nothing happened since the last save. Otherwise
+// it stays behind and the edits are recovered the next time the file is opened.
+void closeJournal(Journal* journal)
+{
+    if (journal == NULL) {
+        return;
+    }
+    SDL_LockMutex(journal->lock);
+    journal->quit = 1;
+    SDL_CondSignal(journal->wake);
+    SDL_UnlockMutex(journal->lock);
+    if (journal->writer != NULL) {
+        SDL_WaitThread(journal->writer, NULL);
+    }
+    else if (journal->pendingLength > 0) {
+        SDL_LockMutex(journal->lock);
+        commitPending(journal);
+        SDL_UnlockMutex(journal->lock);
+    }
+    close(journal->fd);
+    if (journal->recorded == 0) {
+        unlink(journal->path);
+    }
+    else {
+        printf("Unsaved edits kept in %s\n", journal->path);
+    }
+    SDL_DestroyCond(journal->committed);
+    SDL_DestroyCond(journal->wake);
+    SDL_DestroyMutex(journal->lock);
+    free(journal->pending);
+    free(journal->spare);
+    free(journal->path);
+    free(journal->fileName);
+    free(journal);
+}
+
+// Records with a length after the position. Deleting text stores only how much went.
+static int hasLength(int op)
+{
+    return op == JOURNAL_INSERT || op == JOURNAL_INSERT_TEXT || op == JOURNAL_REPLACE ||
+           op == JOURNAL_DELETE_TEXT || op == JOURNAL_REPLACE_LINES;
+}
+
+static int hasData(int op)
+{
+    return hasLength(op) && op != JOURNAL_DELETE_TEXT;
+}
+
+// Records one edit. Only copies it into memory, the writer thread takes care of the file.
+void journalRecord(Journal* journal, JournalOp op, size_t line, size_t linePos, const char* data, size_t length)
+{
+    unsigned char header[MAX_RECORD_HEADER];
+    size_t headerLength = 0;
+    header[headerLength++] = (unsigned char)op;
+    headerLength += putVarint(header + headerLength, line);
+    headerLength += putVarint(header + headerLength, linePos);
+    if (hasLength(op)) {
+        headerLength += putVarint(header + headerLength, length);
+    }
+    if (!hasData(op)) {
+        length = 0;
+    }
+
+    SDL_LockMutex(journal->lock);
+    size_t needed = journal->pendingLength + headerLength + length;
+    if (needed > journal->pendingCapacity) {
+        size_t capacity = journal->pendingCapacity == 0 ? COMMIT_SIZE : journal->pendingCapacity;
+        while (capacity < needed) {
+            capacity *= 2;
+        }
+        journal->pending = (char*)realloc(journal->pending, capacity);
+        journal->pendingCapacity = capacity;
+    }
+    int wasEmpty = journal->pendingLength == 0;
+    memcpy(journal->pending + journal->pendingLength, header, headerLength);
+    if (length > 0) {
+        memcpy(journal->pending + journal->pendingLength + headerLength, data, length);
+    }
+    journal->pendingLength = needed;
+    journal->recorded += headerLength + length;
+    if (wasEmpty || needed >= COMMIT_SIZE) {
+        SDL_CondSignal(journal->wake);
+    }
+    SDL_UnlockMutex(journal->lock);
+}
+
+// True if the journal holds edits from an earlier session.
+int journalPending(Journal* journal)
+{
+    return journal != NULL && journal->written > 0;
+}
+
+// Checks that a record can be applied to the text as it is now.
+static int validRecord(Text* text, int op, size_t line, size_t linePos)
+{
+    switch (op) {
+    case JOURNAL_INSERT:
+    case JOURNAL_INSERT_TEXT:
+        return line < text->lineCount && linePos <= lineLength(text, line);
+    case JOURNAL_DELETE:
+        return line < text->lineCount && linePos > 0 && linePos <= lineLength(text, line);
+    case JOURNAL_NEWLINE:
+        return line > 0 && line <= text->lineCount && linePos <= lineLength(text, line - 1);
+    case JOURNAL_JOIN:
+        return line > 0 && line < text->lineCount && linePos <= lineLength(text, line);
+    case JOURNAL_REPLACE:
+        return linePos > 0;
+    case JOURNAL_DELETE_TEXT:
+        return line < text->lineCount && linePos <= lineLength(text, line);
+    case JOURNAL_REPLACE_LINES:
+        return line <= 1;
+    }
+    return 0;
+}
+
+// Applies the records in the journal to a text loaded from the file. Must run before any other edit
+// and with text->journal unset. A torn or damaged tail, e.g. from a crash in the middle of a write,
+// is cut off so new records follow the last good one. Returns the number of edits replayed.
+size_t replayJournal(Journal* journal, Text* text)
+{
+    if (!journalPending(journal)) {
+        return 0;
+    }
+    size_t length = journal->written;
+    unsigned char* records = (unsigned char*)malloc(length);
+    ssize_t count = pread(journal->fd, records, length, sizeof(JournalHeader));
+    if (count < 0) {
+        count = 0;
+    }
+    const unsigned char* p = records;
+    const unsigned char* end = records + count;
+    size_t replayed = 0;
+    while (p < end) {
+        const unsigned char* record = p;
+        int op = *p++;
+        size_t line, linePos, dataLength = 0, used;
+        if ((used = getVarint(p, end, &line)) == 0) {
+            p = record;
+            break;
+        }
+        p += used;
+        if ((used = getVarint(p, end, &linePos)) == 0) {
+            p = record;
+            break;
+        }
+        p += used;
+        if (hasLength(op)) {
+            if ((used = getVarint(p, end, &dataLength)) == 0 ||
+                (hasData(op) && dataLength > (size_t)(end - p - used))) {
+                p = record;
+                break;
+            }
+            p += used;
+        }
+        if (!validRecord(text, op, line, linePos) || (op == JOURNAL_REPLACE && linePos > dataLength)) {
+            p = record;
+            break;
+        }
+        switch (op) {
+        case JOURNAL_INSERT:
+            insertOnLine(text, (int)line, linePos, (const char*)p, dataLength);
+            break;
+        case JOURNAL_INSERT_TEXT:
+            insertTextOnLine(text, &line, &linePos, (const char*)p, dataLength);
+            break;
+        case JOURNAL_DELETE:
+            deleteFromLine(text, (int)line, linePos);
+            break;
+        case JOURNAL_NEWLINE:
+            createNewLine(text, line, linePos);
+            break;
+        case JOURNAL_JOIN:
+            deleteLine(text, line, linePos);
+            break;
+        case JOURNAL_REPLACE:
+            // linePos is the length of the needle, the replacement follows it.
+            replaceAll(text, (const char*)p, linePos, (const char*)p + linePos, dataLength - linePos);
+            break;
+        case JOURNAL_DELETE_TEXT:
+            deleteText(text, line, linePos, dataLength);
+            break;
+        case JOURNAL_REPLACE_LINES:
+            // line tells whether the replace was undone.
+            applyReplacement(text, (const char*)p, dataLength, (int)line);
+            break;
+        }
+        if (hasData(op)) {
+            p += dataLength;
+        }
+        replayed++;
+    }
+
+    size_t good = (size_t)(p - records);
+    if (good < length) {
+        fprintf(stderr, "Dropped %zu damaged bytes at the end of %s\n", length - good, journal->path);
+        if (ftruncate(journal->fd, sizeof(JournalHeader) + good) == 0) {
+            lseek(journal->fd, 0, SEEK_END);
+        }
+        journal->recorded = journal->written = good;
+    }
+    free(records);
+    return replayed;
+}
+
+// Position in the journal to pass to journalCheckpoint once a snapshot taken now has been saved.
+size_t journalMark(Journal* journal)
+{
+    if (journal == NULL) {
+        return 0;
+    }
+    SDL_LockMutex(journal->lock);
+    size_t mark = journal->recorded;
+    SDL_UnlockMutex(journal->lock);
+    return mark;
+}
+
+// The file now holds every edit before mark. Starts the journal over against the saved file, keeping
+// only the edits made while the save was running.
+void journalCheckpoint(Journal* journal, size_t mark)
+{
+    if (journal == NULL) {
+        return;
+    }
+    SDL_LockMutex(journal->lock);
+    waitCommitted(journal);
+    size_t length = journal->written - mark;
+    char* records = (char*)malloc(length + 1);
+    ssize_t count = pread(journal->fd, records, length, sizeof(JournalHeader) + mark);
+    JournalHeader header = fileHeader(journal->fileName);
+    if (count == (ssize_t)length && replaceJournal(journal, &header, records, length) == 0) {
+        journal->recorded -= mark;
+        journal->written -= mark;
+    }
+    else {
+        fprintf(stderr, "Could not reset journal %s\n", journal->path);
+    }
+    free(records);
+    SDL_UnlockMutex(journal->lock);
+}
@@ -0,0 +1,30 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include "file.h"
+
+// Append-only log of the edits made since the file was last saved, kept next to it as
+// "<file>.journal". Edits are buffered in memory and a writer thread appends them to the log in
+// groups, so recording one costs a memcpy. After a crash the log is replayed against the file on
+// disk to get the unsaved edits back.
+
+typedef enum {
+    JOURNAL_INSERT = 1,
+    JOURNAL_DELETE,
+    JOURNAL_NEWLINE,
+    JOURNAL_JOIN,
+    JOURNAL_INSERT_TEXT,
+    JOURNAL_REPLACE,
+    JOURNAL_DELETE_TEXT,
+    JOURNAL_REPLACE_LINES
+} JournalOp;
+
+Journal* openJournal(char const* fileName, SyncPolicy policy);
+void closeJournal(Journal* journal);
+void journalRecord(Journal* journal, JournalOp op, size_t line, size_t linePos, const char* data, size_t length);
+int journalPending(Journal* journal);
+size_t replayJournal(Journal* journal, Text* text);
+size_t journalMark(Journal* journal);
+void journalCheckpoint(Journal* journal, size_t mark);
+
+#endif
@@ -0,0 +1,150 @@
+#include "highlight.h"
+#include <string.h>
+
+// Lexers the highlighter can use, picked by the extension of the file.
+
+enum {
+    C_NORMAL = LEX_START,
+    C_COMMENT,
+    C_PREPROCESSOR,
+};
+
+static const char* const cKeywords[] = {
+    "auto", "break", "case", "const", "continue", "default", "do", "else", "enum", "extern", "for", "goto",
+    "if", "inline", "register", "restrict", "return", "sizeof", "static", "struct", "switch", "typedef",
+    "union", "volatile", "while", "NULL", "true", "false", NULL};
+
+static const char* const cTypes[] = {
+    "bool", "char", "double", "float", "int", "long", "short", "signed", "unsigned", "void", "size_t",
+    "ssize_t", "int8_t", "int16_t", "int32_t", "int64_t", "uint8_t", "uint16_t", "uint32_t", "uint64_t",
+    "uintptr_t", "_Bool", NULL};
+
+static const char* const cExtensions[] = {"c", "h", "cc", "cpp", "hpp", NULL};
+
+static int isWordStart(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' || (unsigned char)c >= 0x80;
+}
+
+static int isWordChar(char c)
+{
+    return isWordStart(c) || (c >= '0' && c <= '9');
+}
+
+static int isWord(const char* string, size_t length, const char* const* words)
+{
+    for (; *words != NULL; words++) {
+        if (strncmp(*words, string, length) == 0 && (*words)[length] == '\0') {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Offset just past the "*/" that ends a block comment, 0 if the line does not end it.
+static size_t commentEnd(const char* string, size_t length, size_t from)
+{
+    for (size_t i = from; i + 1 < length; i++) {
+        if (string[i] == '*' && string[i + 1] == '/') {
+            return i + 2;
+        }
+    }
+    return 0;
+}
+
+// A directive goes on on the next line if this one ends in a backslash.
+static int directiveEnd(const char* string, size_t length)
+{
+    return length > 0 && string[length - 1] == '\\' ? C_PREPROCESSOR : C_NORMAL;
+}
+
+static int lexC(int state, const char* string, size_t length, TokenList* tokens)
+{
+    size_t i = 0;
+    if (state == C_COMMENT) {
+        addToken(tokens, 0, TOKEN_COMMENT);
+        i = commentEnd(string, length, 0);
+        if (i == 0) {
+            return C_COMMENT;
+        }
+    }
+    else if (state == C_PREPROCESSOR) {
+        addToken(tokens, 0, TOKEN_PREPROCESSOR);
+        return directiveEnd(string, length);
+    }
+
+    int lineStart = 1;
+    while (i < length) {
+        char c = string[i];
+        char next = i + 1 < length ? string[i + 1] : '\0';
+        if (c == '/' && next == '/') {
+            addToken(tokens, i, TOKEN_COMMENT);
+            return C_NORMAL;
+        }
+        if (c == '/' && next == '*') {
+            addToken(tokens, i, TOKEN_COMMENT);
+            i = commentEnd(string, length, i + 2);
+            if (i == 0) {
+                return C_COMMENT;
+            }
+        }
+        else if (c == '#' && lineStart) {
+            addToken(tokens, i, TOKEN_PREPROCESSOR);
+            return directiveEnd(string, length);
+        }
+        else if (c == '"' || c == '\'') {
+            addToken(tokens, i, TOKEN_STRING);
+            for (i++; i < length && string[i] != c; i++) {
+                if (string[i] == '\\') {
+                    i++;
+                }
+            }
+            i = i < length ? i + 1 : length;
+        }
+        else if ((c >= '0' && c <= '9') || (c == '.' && next >= '0' && next <= '9')) {
+            addToken(tokens, i, TOKEN_NUMBER);
+            for (i++; i < length && (isWordChar(string[i]) || string[i] == '.'); i++) {
+            }
+        }
+        else if (isWordStart(c)) {
+            size_t start = i;
+            for (i++; i < length && isWordChar(string[i]); i++) {
+            }
+            TokenKind kind = TOKEN_TEXT;
+            if (isWord(string + start, i - start, cKeywords)) {
+                kind = TOKEN_KEYWORD;
+            }
+            else if (isWord(string + start, i - start, cTypes)) {
+                kind = TOKEN_TYPE;
+            }
+            addToken(tokens, start, kind);
+        }
+        else {
+            addToken(tokens, i, TOKEN_TEXT);
+            i++;
+        }
+        lineStart = lineStart && (c == ' ' || c == '\t');
+    }
+    return C_NORMAL;
+}
+
+static const Lexer cLexer = {.name = "C", .extensions = cExtensions, .lex = lexC};
+
+static const Lexer* const lexers[] = {&cLexer, NULL};
+
+// Lexer for the extension of path, NULL if there is none.
+const Lexer* findLexer(const char* path)
+{
+    const char* dot = path != NULL ? strrchr(path, '.') : NULL;
+    if (dot == NULL || strchr(dot, '/') != NULL) {
+        return NULL;
+    }
+    for (const Lexer* const* lexer = lexers; *lexer != NULL; lexer++) {
+        for (const char* const* extension = (*lexer)->extensions; *extension != NULL; extension++) {
+            if (strcmp(dot + 1, *extension) == 0) {
+                return *lexer;
+            }
+        }
+    }
+    return NULL;
+}
@@ -1,27 +1,413 @@
 #include "line.h"
+#include "journal.h"
+#include "scan.h"
+#include "search.h"
+#include "undo.h"
+#include "varint.h"
+#include "utf8.h"
+#include <stdint.h>
 #include <string.h>
 #include <stdio.h>
 
 #define MIN_LINES 100
 
 // Creates the Text object that holds line data. Initially only the first line is set to a buffer.
-// The rest is set to NULL.
+// The rest is set to NULL. Line buffers are allocated from an arena owned by the Text.
 Text* createText(void)
 {
     Text* text = (Text*)malloc(sizeof(Text));
-    text->lines = (GapBuffer**)calloc(MIN_LINES, sizeof(GapBuffer*));
+    text->lines = (Line*)calloc(MIN_LINES, sizeof(Line));
     text->maxSize = MIN_LINES;
     text->lineCount = 1;
-    text->lines[0] = createBuffer();
+    text->arena = createArena();
+    text->source = NULL;
+    text->journal = NULL;
+    text->undo = NULL;
+    text->version = 0;
+    text->widths = createWidthIndex();
+    text->unmeasured = 1;
+    text->measureNext = 0;
+    text->rows = createRowTree();
+    text->rowsFrom = 0;
+    text->lines[0].buffer = createBuffer(text->arena, 0);
+    text->lines[0].version = ++text->version;
+    text->lines[0].width = LINE_UNMEASURED;
+    text->lines[0].rows = 1;
+    text->lines[0].lexState = LEX_UNKNOWN;
+    text->lines[0].lexStale = 1;
+    text->lexFrontier = 0;
+    text->editCount = 0;
+    text->linesChanged = 0;
     return text;
 }
 
+// Every line buffer lives in the arena, so they all go away with it. The source belongs to whoever
+// opened it.
 void freeText(Text* text)
+{
+    freeArena(text->arena);
+    freeWidthIndex(text->widths);
+    freeRowTree(text->rows);
+    free(text->lines);
+    free(text);
+}
+
+// Grows the line array so it can hold at least lineCount lines.
+static void reserveLines(Text* text, size_t lineCount)
+{
+    if (lineCount < text->maxSize) {
+        return;
+    }
+    while (lineCount >= text->maxSize) {
+        text->maxSize = text->maxSize * 2;
+    }
+    text->lines = (Line*)realloc(text->lines, sizeof(Line) * text->maxSize);
+}
+
+// Lines from line on have to be lexed again before their highlighting can be trusted.
+static void forgetLexStates(Text* text, size_t line)
+{
+    if (line < text->lexFrontier) {
+        text->lexFrontier = line;
+    }
+}
+
+// Lines from line on moved, their part of the row tree is built again when it is next needed.
+static void forgetRows(Text* text, size_t line)
+{
+    if (line < text->rowsFrom) {
+        text->rowsFrom = line;
+    }
+}
+
+// Lines added at the end go into the row tree as they are, unless it is already out of date.
+static void appendLineRows(Text* text, size_t count)
+{
+    if (text->rowsFrom >= text->lineCount && text->rows->count + count == text->lineCount) {
+        for (size_t i = 0; i < count; i++) {
+            appendRows(text->rows, 1);
+        }
+    }
+    else {
+        forgetRows(text, text->lineCount - count);
+    }
+}
+
+// Adds a line at the end that reads its text from the source until it is edited.
+void appendSourceLine(Text* text, size_t offset, size_t length)
+{
+    reserveLines(text, text->lineCount + 1);
+    text->lines[text->lineCount++] =
+        (Line){.buffer = NULL, .offset = offset, .length = length, .width = LINE_UNMEASURED, .rows = 1,
+               .lexState = LEX_UNKNOWN, .lexStale = 1};
+    text->unmeasured++;
+    markLinesChanged(text, text->lineCount - 1, 0, 1);
+    appendLineRows(text, 1);
+    forgetLexStates(text, text->lineCount - 1);
+}
+
+// Appends one source line ending at each of the newline offsets, the first starting at start.
+// Returns where the line after the last newline starts.
+size_t appendSourceLines(Text* text, size_t start, const size_t* newLines, size_t count)
+{
+    reserveLines(text, text->lineCount + count);
+    Line* lines = text->lines + text->lineCount;
+    for (size_t i = 0; i < count; i++) {
+        lines[i] = (Line){.buffer = NULL, .offset = start, .length = newLines[i] - start, .width = LINE_UNMEASURED,
+                          .rows = 1, .lexState = LEX_UNKNOWN, .lexStale = 1};
+        start = newLines[i] + 1;
+    }
+    forgetLexStates(text, text->lineCount);
+    markLinesChanged(text, text->lineCount, 0, count);
+    text->lineCount += count;
+    text->unmeasured += count;
+    appendLineRows(text, count);
+    return start;
+}
+
+LineSpan getLineSpan(Text* text, size_t line)
+{
+    GapBuffer* buffer = text->lines[line].buffer;
+    if (buffer == NULL) {
+        return (LineSpan){
+            .before = text->source + text->lines[line].offset,
+            .beforeLength = 0,
+            .after = text->source + text->lines[line].offset,
+            .afterLength = text->lines[line].length};
+    }
+    return (LineSpan){
+        .before = buffer->string,
+        .beforeLength = buffer->cursor,
+        .after = buffer->string + buffer->gapEnd,
+        .afterLength = buffer->length - buffer->gapEnd};
+}
+
+size_t lineLength(Text* text, size_t line)
+{
+    GapBuffer* buffer = text->lines[line].buffer;
+    return buffer == NULL ? text->lines[line].length : gapUsed(buffer);
+}
+
+// Stores the width a line was measured at since it last changed.
+void setLineWidth(Text* text, size_t line, int width)
+{
+    Line* current = &text->lines[line];
+    if (current->width == LINE_UNMEASURED) {
+        text->unmeasured--;
+    }
+    else {
+        removeWidth(text->widths, current->width);
+    }
+    current->width = width;
+    addWidth(text->widths, width);
+}
+
+// Forgets every width, e.g. because the font changed. Lines are measured again as they are drawn or
+// swept.
+void resetLineWidths(Text* text)
 {
     for (size_t i = 0; i < text->lineCount; i++) {
-        freeBuffer(text->lines[i]);
+        text->lines[i].width = LINE_UNMEASURED;
     }
-    free(text);
+    clearWidths(text->widths);
+    text->unmeasured = text->lineCount;
+    text->measureNext = 0;
+}
+
+// Next line that needs measuring, going round from where the last search stopped. Only call it
+// while unmeasured is not 0.
+size_t nextUnmeasuredLine(Text* text)
+{
+    while (1) {
+        if (text->measureNext >= text->lineCount) {
+            text->measureNext = 0;
+        }
+        size_t line = text->measureNext++;
+        if (text->lines[line].width == LINE_UNMEASURED) {
+            return line;
+        }
+    }
+}
+
+// Stores how many rows a line takes now that it was laid out wrapped.
+void setLineRows(Text* text, size_t line, int rows)
+{
+    Line* current = &text->lines[line];
+    if (line < text->rowsFrom && rows != current->rows) {
+        addRows(text->rows, line, (long)rows - current->rows);
+    }
+    current->rows = rows;
+}
+
+// The row tree, with the part of it after the first line that moved built again. That costs as
+// much as the memmove of the line array that moved the lines.
+static RowTree* lineRows(Text* text)
+{
+    size_t from = text->rowsFrom < text->rows->count ? text->rowsFrom : text->rows->count;
+    if (from < text->lineCount || text->rows->count != text->lineCount) {
+        buildRowTreeFrom(text->rows, &text->lines[0].rows, text->lineCount, sizeof(Line), from);
+    }
+    text->rowsFrom = SIZE_MAX;
+    return text->rows;
+}
+
+// First row of a line.
+size_t rowOfLine(Text* text, size_t line)
+{
+    return rowsBefore(lineRows(text), line);
+}
+
+// Line that row is part of, the last line if row is past the end.
+size_t lineAtRow(Text* text, size_t row, size_t* rowInLine)
+{
+    size_t line = findRow(lineRows(text), row, rowInLine);
+    if (line >= text->lineCount) {
+        line = text->lineCount - 1;
+        *rowInLine = text->lines[line].rows - 1;
+    }
+    return line;
+}
+
+size_t totalRows(Text* text)
+{
+    return rowsBefore(lineRows(text), text->lineCount);
+}
+
+// Something that stays the same for a line while it exists, its buffer or where it is in the source.
+// Together with the version it tells whether a line still has the same text.
+const void* lineIdentity(Text* text, size_t line)
+{
+    GapBuffer* buffer = text->lines[line].buffer;
+    return buffer == NULL ? (const void*)(text->source + text->lines[line].offset) : (const void*)buffer;
+}
+
+// Folds the edits that took a line from the state identity/version to the one it is in now into
+// change. Returns 0 if some of them were not recorded, e.g. lines were split or joined.
+int lineChangeSince(Text* text, size_t line, const void* identity, size_t version, LineChange* change)
+{
+    size_t first = text->editCount > LINE_EDITS ? text->editCount - LINE_EDITS : 0;
+    int found = 0;
+    for (size_t i = first; i < text->editCount; i++) {
+        const LineEdit* edit = &text->edits[i % LINE_EDITS];
+        if (edit->identity != identity || edit->version != version) {
+            continue;
+        }
+        if (!found) {
+            *change = (LineChange){.start = edit->at, .oldEnd = edit->at, .newEnd = edit->at};
+            found = 1;
+        }
+        if (edit->at < change->start) {
+            change->start = edit->at;
+        }
+        if (edit->at + edit->removed > change->newEnd) {
+            change->oldEnd += edit->at + edit->removed - change->newEnd;
+            change->newEnd = edit->at + edit->removed;
+        }
+        change->newEnd = change->newEnd + edit->inserted - edit->removed;
+        identity = edit->newIdentity;
+        version = edit->newVersion;
+    }
+    return found && identity == lineIdentity(text, line) && version == text->lines[line].version;
+}
+
+// Records that removed lines at line were replaced by inserted ones, an edit of one line being one
+// replaced by one. Lines before the change and the ones after it keep their text.
+void markLinesChanged(Text* text, size_t line, size_t removed, size_t inserted)
+{
+    LineChange* change = &text->changedLines;
+    if (!text->linesChanged) {
+        *change = (LineChange){.start = line, .oldEnd = line, .newEnd = line};
+        text->linesChanged = 1;
+    }
+    if (line < change->start) {
+        change->start = line;
+    }
+    if (line + removed > change->newEnd) {
+        change->oldEnd += line + removed - change->newEnd;
+        change->newEnd = line + removed;
+    }
+    change->newEnd = change->newEnd + inserted - removed;
+}
+
+// Hands over the lines changed since the last call: the lines before change->start did not change
+// and the ones from change->oldEnd on are at change->newEnd now. Returns 0 if no line changed.
+int takeLineChanges(Text* text, LineChange* change)
+{
+    int changed = text->linesChanged;
+    *change = text->changedLines;
+    text->linesChanged = 0;
+    return changed;
+}
+
+// The state of a line before it is edited, for endLineEdit.
+static LineEdit beginLineEdit(Text* text, size_t line)
+{
+    return (LineEdit){.identity = lineIdentity(text, line), .version = text->lines[line].version};
+}
+
+// Records an edit within a line once it is made.
+static void endLineEdit(Text* text, size_t line, LineEdit edit, size_t at, size_t removed, size_t inserted)
+{
+    edit.newIdentity = lineIdentity(text, line);
+    edit.newVersion = text->lines[line].version;
+    edit.at = at;
+    edit.removed = removed;
+    edit.inserted = inserted;
+    text->edits[text->editCount++ % LINE_EDITS] = edit;
+}
+
+// Byte index of the code point after the one at index.
+size_t nextCharIndex(Text* text, size_t line, size_t index)
+{
+    char bytes[4];
+    size_t count = copyFromLine(text, line, index, index + 4, bytes);
+    if (count == 0) {
+        return index;
+    }
+    size_t length;
+    decodeUtf8(bytes, bytes + count, &length);
+    return index + length;
+}
+
+// Byte index of the code point before the one at index. Bytes that are not part of a valid sequence
+// count as a character each, the same way they are drawn.
+size_t prevCharIndex(Text* text, size_t line, size_t index)
+{
+    if (index == 0) {
+        return 0;
+    }
+    size_t start = index > 4 ? index - 4 : 0;
+    char bytes[4];
+    size_t count = copyFromLine(text, line, start, index, bytes);
+    for (size_t back = count; back > 1; back--) {
+        size_t length;
+        decodeUtf8(bytes + count - back, bytes + count, &length);
+        if (length == back) {
+            return index - back;
+        }
+    }
+    return index - 1;
+}
+
+// The line has to be measured again, its old width no longer counts.
+static void forgetLineWidth(Text* text, Line* line)
+{
+    if (line->width != LINE_UNMEASURED) {
+        removeWidth(text->widths, line->width);
+        line->width = LINE_UNMEASURED;
+        text->unmeasured++;
+    }
+}
+
+// Gives a line a version that no earlier state of any line had.
+static void touchLine(Text* text, size_t line)
+{
+    text->lines[line].version = ++text->version;
+    text->lines[line].lexStale = 1;
+    markLinesChanged(text, line, 1, 1);
+    forgetLexStates(text, line);
+    forgetLineWidth(text, &text->lines[line]);
+}
+
+// Copies the text between start and end of a line into dest. Returns bytes copied.
+size_t copyFromLine(Text* text, size_t line, size_t start, size_t end, char* dest)
+{
+    GapBuffer* buffer = text->lines[line].buffer;
+    if (buffer != NULL) {
+        return copyFromBuffer(buffer, start, end, dest);
+    }
+    size_t length = text->lines[line].length;
+    if (end > length) {
+        end = length;
+    }
+    if (start >= end) {
+        return 0;
+    }
+    memcpy(dest, text->source + text->lines[line].offset + start, end - start);
+    return end - start;
+}
+
+// Returns the gap buffer of a line, copying it out of the source the first time it is edited.
+GapBuffer* editLine(Text* text, size_t line)
+{
+    Line* current = &text->lines[line];
+    if (current->buffer == NULL) {
+        current->buffer = createBuffer(text->arena, current->length);
+        insertBuffer(current->buffer, text->source + current->offset, current->length);
+        touchLine(text, line);
+    }
+    return current->buffer;
+}
+
+static void setBufferLine(Text* text, size_t index, GapBuffer* buffer)
+{
+    text->lines[index] = (Line){.buffer = buffer, .offset = 0, .length = 0, .version = ++text->version,
+                                .width = LINE_UNMEASURED, .rows = 1, .lexState = LEX_UNKNOWN,
+                                .lexStale = 1};
+    text->unmeasured++;
+    markLinesChanged(text, index, 0, 1);
+    forgetRows(text, index);
+    forgetLexStates(text, index);
 }
 
 // Creates a new line. Checks to see if there is enough space in the array.
@@ -31,31 +417,33 @@ void createNewLine(Text* text, size_t index, size_t linePos)
     if (index > text->lineCount) {
         return;
     }
-    text->lineCount++;
-    if (text->lineCount >= text->maxSize) {
-        text->maxSize = text->maxSize * 2;
-        text->lines = (GapBuffer**)realloc(text->lines, sizeof(GapBuffer*) * text->maxSize);
+    if (text->journal != NULL) {
+        journalRecord(text->journal, JOURNAL_NEWLINE, index, linePos, NULL, 0);
+    }
+    if (text->undo != NULL) {
+        undoRecord(text->undo, UNDO_SPLIT, index - 1, linePos, NULL, 0);
     }
+    text->lineCount++;
+    reserveLines(text, text->lineCount);
     if (index == text->lineCount - 1) {
-        text->lines[index] = createBuffer();
+        setBufferLine(text, index, createBuffer(text->arena, 0));
     }
     else {
         // Inserting in the middle so shift by one
-        memmove(text->lines + index + 1, text->lines + index, sizeof(GapBuffer*) * (text->lineCount - 1) - index);
-        text->lines[index] = createBuffer();
+        memmove(text->lines + index + 1, text->lines + index, sizeof(Line) * (text->lineCount - 1 - index));
+        setBufferLine(text, index, createBuffer(text->arena, 0));
     }
 
-    // Move text from previous line buffer dependant on the cursor's index.
-    size_t oldLine = index - 1;
-    size_t endLine = text->lines[oldLine]->cursor + text->lines[oldLine]->length - text->lines[oldLine]->gapEnd;
-    if (linePos < endLine) {
-        copyBuffer(text->lines[index], text->lines[oldLine]);
-        // Delete what we just copied from the buffer
-        size_t deleteSize = text->lines[oldLine]->length - text->lines[oldLine]->gapEnd;
-        moveCursor(text->lines[oldLine], endLine);
-        for (size_t i = 0; i < deleteSize; i++) {
-            deleteFromBuffer(text->lines[oldLine]);
-        }
+    // Move text after linePos from the previous line buffer to the new line.
+    size_t oldLength = lineLength(text, index - 1);
+    if (linePos < oldLength) {
+        LineEdit edit = beginLineEdit(text, index - 1);
+        GapBuffer* oldLine = editLine(text, index - 1);
+        moveCursor(oldLine, linePos);
+        copyBuffer(text->lines[index].buffer, oldLine);
+        truncateBuffer(oldLine);
+        touchLine(text, index - 1);
+        endLineEdit(text, index - 1, edit, linePos, oldLength - linePos, 0);
     }
     return;
 }
@@ -63,31 +451,413 @@ void createNewLine(Text* text, size_t index, size_t linePos)
 //Deletes line at position lineNum and free's the associated buffer. Returns the new index of the combined line.
 size_t deleteLine(Text* text, size_t lineNum, size_t linePos)
 {
+    if (text->journal != NULL) {
+        journalRecord(text->journal, JOURNAL_JOIN, lineNum, linePos, NULL, 0);
+    }
+    if (text->undo != NULL) {
+        // The bytes before linePos are dropped, undoing the join puts them back.
+        size_t dropped = linePos < lineLength(text, lineNum) ? linePos : lineLength(text, lineNum);
+        char* data = undoReserve(text->undo, UNDO_JOIN, lineNum - 1, lineLength(text, lineNum - 1), dropped);
+        if (data != NULL) {
+            copyFromLine(text, lineNum, 0, dropped, data);
+        }
+    }
     text->lineCount--;
-    GapBuffer* oldBuffer = text->lines[lineNum];
+    GapBuffer* oldBuffer = text->lines[lineNum].buffer;
 
-    //Copy contents after cursor to end of line
-    size_t endLine = oldBuffer->cursor + oldBuffer->length - oldBuffer->gapEnd;
-    size_t newCursorIndex = moveCursorToEnd(text->lines[lineNum - 1]);
-    if (linePos < endLine) {
-        copyBuffer(text->lines[lineNum - 1], oldBuffer);
+    //Copy contents after linePos to end of the previous line
+    LineEdit edit = beginLineEdit(text, lineNum - 1);
+    GapBuffer* previous = editLine(text, lineNum - 1);
+    size_t newCursorIndex = moveCursorToEnd(previous);
+    if (oldBuffer == NULL) {
+        Line* oldLine = &text->lines[lineNum];
+        if (linePos < oldLine->length) {
+            insertBuffer(previous, text->source + oldLine->offset + linePos, oldLine->length - linePos);
+        }
+    }
+    else if (linePos < gapUsed(oldBuffer)) {
+        moveCursor(oldBuffer, linePos);
+        copyBuffer(previous, oldBuffer);
     }
+    touchLine(text, lineNum - 1);
+    endLineEdit(text, lineNum - 1, edit, newCursorIndex, 0, gapUsed(previous) - newCursorIndex);
+    forgetLineWidth(text, &text->lines[lineNum]);
+    text->unmeasured--;
+    markLinesChanged(text, lineNum, 1, 0);
+    forgetRows(text, lineNum);
 
     if (lineNum < text->lineCount) {
-        memmove(text->lines + lineNum, text->lines + lineNum + 1, sizeof(GapBuffer*) * (text->lineCount - 1) - lineNum);
+        memmove(text->lines + lineNum, text->lines + lineNum + 1, sizeof(Line) * (text->lineCount - lineNum));
     }
 
-    free(oldBuffer);
-    moveCursor(text->lines[lineNum - 1], newCursorIndex);
+    freeBuffer(oldBuffer);
     return newCursorIndex;
 }
 
-void insertOnLine(Text* text, int line, char* string, size_t stringLength)
+// The gap is only moved when the edit is somewhere else than the last one.
+static void insertAt(Text* text, size_t line, size_t linePos, const char* string, size_t stringLength)
 {
-    insertBuffer(text->lines[line], string, stringLength);
+    LineEdit edit = beginLineEdit(text, line);
+    GapBuffer* buffer = editLine(text, line);
+    if (buffer->cursor != linePos) {
+        moveCursor(buffer, linePos);
+    }
+    insertBuffer(buffer, string, stringLength);
+    touchLine(text, line);
+    endLineEdit(text, line, edit, linePos, 0, stringLength);
 }
 
-void deleteFromLine(Text* text, int line)
+// Inserts string at linePos.
+void insertOnLine(Text* text, int line, size_t linePos, const char* string, size_t stringLength)
 {
-    deleteFromBuffer(text->lines[line]);
+    if (text->journal != NULL) {
+        journalRecord(text->journal, JOURNAL_INSERT, line, linePos, string, stringLength);
+    }
+    if (text->undo != NULL) {
+        undoRecord(text->undo, UNDO_INSERT, line, linePos, string, stringLength);
+    }
+    insertAt(text, line, linePos, string, stringLength);
+}
+
+// Deletes the character before linePos.
+void deleteFromLine(Text* text, int line, size_t linePos)
+{
+    if (text->journal != NULL) {
+        journalRecord(text->journal, JOURNAL_DELETE, line, linePos, NULL, 0);
+    }
+    if (text->undo != NULL && linePos > 0) {
+        char deleted;
+        copyFromLine(text, line, linePos - 1, linePos, &deleted);
+        undoRecord(text->undo, UNDO_DELETE, line, linePos - 1, &deleted, 1);
+    }
+    LineEdit edit = beginLineEdit(text, line);
+    GapBuffer* buffer = editLine(text, line);
+    if (buffer->cursor != linePos) {
+        moveCursor(buffer, linePos);
+    }
+    deleteFromBuffer(buffer);
+    touchLine(text, line);
+    if (linePos > 0) {
+        endLineEdit(text, line, edit, linePos - 1, 1, 0);
+    }
+}
+
+// Inserts a block of text that may span several lines at line/linePos and moves line/linePos to the
+// end of the inserted text. All new lines are spliced into the array with one memmove and every
+// line segment is copied with a single memcpy into a buffer sized for it.
+void insertTextOnLine(Text* text, size_t* line, size_t* linePos, const char* string, size_t stringLength)
+{
+    if (text->journal != NULL) {
+        journalRecord(text->journal, JOURNAL_INSERT_TEXT, *line, *linePos, string, stringLength);
+    }
+    if (text->undo != NULL) {
+        undoRecord(text->undo, UNDO_INSERT, *line, *linePos, string, stringLength);
+    }
+    const char* end = string + stringLength;
+    size_t newLines = countNewLines(string, end);
+    if (newLines == 0) {
+        insertAt(text, *line, *linePos, string, stringLength);
+        *linePos += stringLength;
+        return;
+    }
+
+    // The text after linePos ends up behind the last inserted line.
+    LineEdit edit = beginLineEdit(text, *line);
+    GapBuffer* first = editLine(text, *line);
+    moveCursor(first, *linePos);
+    size_t tailLength = first->length - first->gapEnd;
+
+    reserveLines(text, text->lineCount + newLines);
+    memmove(text->lines + *line + 1 + newLines, text->lines + *line + 1, sizeof(Line) * (text->lineCount - *line - 1));
+    text->lineCount += newLines;
+
+    const char* firstNewLine = findNewLine(string, end);
+    const char* segment = firstNewLine + 1;
+    for (size_t i = 1; i < newLines; i++) {
+        const char* segmentEnd = findNewLine(segment, end);
+        GapBuffer* buffer = createBuffer(text->arena, segmentEnd - segment);
+        insertBuffer(buffer, segment, segmentEnd - segment);
+        setBufferLine(text, *line + i, buffer);
+        segment = segmentEnd + 1;
+    }
+    size_t lastLength = end - segment;
+    GapBuffer* last = createBuffer(text->arena, lastLength + tailLength);
+    insertBuffer(last, segment, lastLength);
+    copyBuffer(last, first);
+    setBufferLine(text, *line + newLines, last);
+
+    truncateBuffer(first);
+    insertBuffer(first, string, firstNewLine - string);
+    touchLine(text, *line);
+    endLineEdit(text, *line, edit, *linePos, tailLength, firstNewLine - string);
+
+    *line += newLines;
+    *linePos = lastLength;
+}
+
+// Copies length bytes starting at line/linePos into dest, with a newline between lines.
+static void copyText(Text* text, size_t line, size_t linePos, size_t length, char* dest)
+{
+    while (length > 0) {
+        size_t copied = copyFromLine(text, line, linePos, linePos + length, dest);
+        dest += copied;
+        length -= copied;
+        if (length > 0) {
+            *dest++ = '\n';
+            length--;
+        }
+        line++;
+        linePos = 0;
+    }
+}
+
+// Deletes length bytes starting at linePos, each line break counting as one. The lines in between
+// are dropped with one memmove and the rest of the last line is joined to the first, so the cost
+// does not depend on how much text goes.
+void deleteText(Text* text, size_t line, size_t linePos, size_t length)
+{
+    size_t endLine = line;
+    size_t endPos = linePos;
+    size_t remaining = length;
+    while (remaining > 0) {
+        size_t available = lineLength(text, endLine) - endPos;
+        if (remaining <= available || endLine + 1 >= text->lineCount) {
+            size_t taken = remaining < available ? remaining : available;
+            endPos += taken;
+            remaining -= taken;
+            break;
+        }
+        remaining -= available + 1;
+        endLine++;
+        endPos = 0;
+    }
+    length -= remaining;
+    if (length == 0) {
+        return;
+    }
+    if (text->journal != NULL) {
+        journalRecord(text->journal, JOURNAL_DELETE_TEXT, line, linePos, NULL, length);
+    }
+    if (text->undo != NULL) {
+        char* data = undoReserve(text->undo, UNDO_DELETE, line, linePos, length);
+        if (data != NULL) {
+            copyText(text, line, linePos, length, data);
+        }
+    }
+
+    LineEdit edit = beginLineEdit(text, line);
+    size_t firstLength = lineLength(text, line);
+    GapBuffer* first = editLine(text, line);
+    if (endLine == line) {
+        deleteBufferRange(first, linePos, endPos);
+        touchLine(text, line);
+        endLineEdit(text, line, edit, linePos, endPos - linePos, 0);
+        return;
+    }
+    moveCursor(first, linePos);
+    truncateBuffer(first);
+    Line* last = &text->lines[endLine];
+    if (last->buffer == NULL) {
+        insertBuffer(first, text->source + last->offset + endPos, last->length - endPos);
+    }
+    else {
+        moveCursor(last->buffer, endPos);
+        copyBuffer(first, last->buffer);
+    }
+    touchLine(text, line);
+    endLineEdit(text, line, edit, linePos, firstLength - linePos, gapUsed(first) - linePos);
+    for (size_t i = line + 1; i <= endLine; i++) {
+        forgetLineWidth(text, &text->lines[i]);
+        text->unmeasured--;
+        freeBuffer(text->lines[i].buffer);
+    }
+    memmove(text->lines + line + 1, text->lines + endLine + 1, sizeof(Line) * (text->lineCount - endLine - 1));
+    text->lineCount -= endLine - line;
+    markLinesChanged(text, line + 1, endLine - line, 0);
+    forgetRows(text, line + 1);
+}
+
+// Copies the bytes from..to of a line to the end of buffer, which has to have room for them.
+static void appendLineRange(GapBuffer* buffer, Text* text, size_t line, size_t from, size_t to)
+{
+    buffer->cursor += copyFromLine(text, line, from, to, buffer->string + buffer->cursor);
+}
+
+// Writes a line once into a buffer of its new size, with replacement in place of the length bytes at
+// each offset, and puts it in place of the old one.
+static void rebuildLine(Text* text, size_t line, const size_t* offsets, size_t count, size_t length,
+                        const char* replacement, size_t replacementLength)
+{
+    size_t oldLength = lineLength(text, line);
+    GapBuffer* buffer = createBuffer(text->arena, oldLength - count * length + count * replacementLength);
+    size_t from = 0;
+    for (size_t i = 0; i < count; i++) {
+        appendLineRange(buffer, text, line, from, offsets[i]);
+        insertBuffer(buffer, replacement, replacementLength);
+        from = offsets[i] + length;
+    }
+    appendLineRange(buffer, text, line, from, oldLength);
+    freeBuffer(text->lines[line].buffer);
+    text->lines[line].buffer = buffer;
+    touchLine(text, line);
+}
+
+// Where a replace-all changed the text, kept to undo it: the needle and the replacement, then for
+// each line with a match how far it is from the one before, how many matches it has and the
+// distance of each from the end of the one before it. All numbers are varints.
+typedef struct {
+    char* data;
+    size_t length;
+    size_t capacity;
+} ReplaceRecord;
+
+static void putRecordBytes(ReplaceRecord* record, const void* bytes, size_t length)
+{
+    if (record->length + length > record->capacity) {
+        record->capacity = record->capacity == 0 ? 256 : record->capacity * 2;
+        if (record->capacity < record->length + length) {
+            record->capacity = record->length + length;
+        }
+        record->data = (char*)realloc(record->data, record->capacity);
+    }
+    memcpy(record->data + record->length, bytes, length);
+    record->length += length;
+}
+
+static void putRecordVarint(ReplaceRecord* record, size_t value)
+{
+    unsigned char bytes[MAX_VARINT];
+    putRecordBytes(record, bytes, putVarint(bytes, value));
+}
+
+// Replaces every occurrence of needle. Each line with a match is written once into a buffer of its
+// new size that replaces the old one, so the gap never moves and nothing is shifted per match.
+// Neither string can hold a line break. Returns how many were replaced.
+size_t replaceAll(Text* text, const char* needle, size_t needleLength, const char* replacement,
+                  size_t replacementLength)
+{
+    if (needleLength == 0 || memchr(needle, '\n', needleLength) != NULL ||
+        memchr(replacement, '\n', replacementLength) != NULL) {
+        return 0;
+    }
+    if (text->journal != NULL) {
+        char* data = (char*)malloc(needleLength + replacementLength);
+        memcpy(data, needle, needleLength);
+        memcpy(data + needleLength, replacement, replacementLength);
+        journalRecord(text->journal, JOURNAL_REPLACE, 0, needleLength, data, needleLength + replacementLength);
+        free(data);
+    }
+    ReplaceRecord record = {0};
+    if (text->undo != NULL) {
+        putRecordVarint(&record, needleLength);
+        putRecordBytes(&record, needle, needleLength);
+        putRecordVarint(&record, replacementLength);
+        putRecordBytes(&record, replacement, replacementLength);
+    }
+
+    size_t* matches = NULL;
+    size_t capacity = 0;
+    size_t replaced = 0;
+    size_t firstLine = 0;
+    size_t previousLine = 0;
+    for (size_t line = 0; line < text->lineCount; line++) {
+        size_t count = 0;
+        size_t index = 0;
+        while (findInLine(text, line, index, needle, needleLength, &index)) {
+            if (count == capacity) {
+                capacity = capacity == 0 ? 64 : capacity * 2;
+                matches = (size_t*)realloc(matches, sizeof(size_t) * capacity);
+            }
+            matches[count++] = index;
+            index += needleLength;
+        }
+        if (count == 0) {
+            continue;
+        }
+        if (text->undo != NULL) {
+            putRecordVarint(&record, line - previousLine);
+            putRecordVarint(&record, count);
+            for (size_t i = 0; i < count; i++) {
+                putRecordVarint(&record, matches[i] - (i == 0 ? 0 : matches[i - 1] + needleLength));
+            }
+        }
+        firstLine = replaced == 0 ? line : firstLine;
+        previousLine = line;
+        rebuildLine(text, line, matches, count, needleLength, replacement, replacementLength);
+        replaced += count;
+    }
+    if (text->undo != NULL && replaced > 0) {
+        undoRecord(text->undo, UNDO_REPLACE, firstLine, 0, record.data, record.length);
+    }
+    free(record.data);
+    free(matches);
+    return replaced;
+}
+
+// Replays a replace-all from its undo record, or reverses it by putting the needle back where each
+// replacement went.
+void applyReplacement(Text* text, const char* data, size_t length, int reverse)
+{
+    if (text->journal != NULL) {
+        journalRecord(text->journal, JOURNAL_REPLACE_LINES, reverse, 0, data, length);
+    }
+    const unsigned char* p = (const unsigned char*)data;
+    const unsigned char* end = p + length;
+    size_t needleLength, replacementLength, used;
+    if ((used = getVarint(p, end, &needleLength)) == 0 || needleLength > (size_t)(end - p - used)) {
+        return;
+    }
+    const char* needle = (const char*)p + used;
+    p += used + needleLength;
+    if ((used = getVarint(p, end, &replacementLength)) == 0 || replacementLength > (size_t)(end - p - used)) {
+        return;
+    }
+    const char* replacement = (const char*)p + used;
+    p += used + replacementLength;
+    if (reverse) {
+        const char* swap = needle;
+        needle = replacement;
+        replacement = swap;
+        size_t swapLength = needleLength;
+        needleLength = replacementLength;
+        replacementLength = swapLength;
+    }
+
+    size_t* offsets = NULL;
+    size_t capacity = 0;
+    size_t line = 0;
+    while (p < end) {
+        size_t delta, count;
+        if ((used = getVarint(p, end, &delta)) == 0) {
+            break;
+        }
+        p += used;
+        if ((used = getVarint(p, end, &count)) == 0 || count > (size_t)(end - p)) {
+            break;
+        }
+        p += used;
+        line += delta;
+        if (count > capacity) {
+            capacity = count;
+            offsets = (size_t*)realloc(offsets, sizeof(size_t) * capacity);
+        }
+        // Each gap is measured from the end of the match before it, which is the replacement once
+        // the replace has been made.
+        size_t offset = 0;
+        size_t i = 0;
+        for (; i < count; i++) {
+            size_t gap;
+            if ((used = getVarint(p, end, &gap)) == 0) {
+                break;
+            }
+            p += used;
+            offsets[i] = offset + gap;
+            offset = offsets[i] + needleLength;
+        }
+        if (i < count || line >= text->lineCount || (count > 0 && offset > lineLength(text, line))) {
+            break;
+        }
+        rebuildLine(text, line, offsets, count, needleLength, replacement, replacementLength);
+    }
+    free(offsets);
 }
@@ -2,19 +2,124 @@
 #define LINE_H_
 
 #include "gap.h"
+#include "rows.h"
+#include "width.h"
+
+// A line is either an editable gap buffer or, until it is first modified, a run of bytes in the
+// read-only source the file was opened from. version changes whenever the line is edited. width is
+// the laid out width in pixels, LINE_UNMEASURED until it is measured and again after every edit.
+// rows is how many screen rows the line takes when wrapped, 1 until it is laid out and the last count
+// until it is laid out again. lexState is the state the highlighting lexer ended the line in,
+// LEX_UNKNOWN until it is first lexed. lexStale is set when the line or the state it starts in
+// changed since, lexState is kept to tell whether lexing it again ends in the same state.
+typedef struct {
+    GapBuffer* buffer;
+    size_t offset;
+    size_t length;
+    size_t version;
+    int width;
+    int rows;
+    int lexState;
+    unsigned char lexStale;
+} Line;
+
+#define LINE_UNMEASURED -1
+#define LEX_UNKNOWN -1
+
+// The text of a line as the runs before and after the gap.
+typedef struct {
+    const char* before;
+    size_t beforeLength;
+    const char* after;
+    size_t afterLength;
+} LineSpan;
+
+// One edit within a line: removed bytes at at were replaced by inserted ones, taking the line from
+// the state identity/version to newIdentity/newVersion.
+typedef struct {
+    const void* identity;
+    size_t version;
+    const void* newIdentity;
+    size_t newVersion;
+    size_t at;
+    size_t removed;
+    size_t inserted;
+} LineEdit;
+
+// A run of edits folded into one: bytes before start did not change and the bytes from oldEnd on
+// are at newEnd now.
+typedef struct {
+    size_t start;
+    size_t oldEnd;
+    size_t newEnd;
+} LineChange;
+
+#define LINE_EDITS 16
+
+typedef struct Journal Journal;
+typedef struct UndoLog UndoLog;
 
 typedef struct {
     size_t lineCount;
-    GapBuffer** lines;
+    Line* lines;
     size_t maxSize;
+    Arena* arena;
+    const char* source;
+    Journal* journal;
+    // Edits are recorded here to be undone, unless it is NULL.
+    UndoLog* undo;
+    size_t version;
+    // Widths of the measured lines, how many are not measured and where to look for them next.
+    WidthIndex* widths;
+    size_t unmeasured;
+    size_t measureNext;
+    // Rows of every line. Once lines were inserted or removed the tree is built again from rowsFrom
+    // on when it is next needed.
+    RowTree* rows;
+    size_t rowsFrom;
+    // Lines before this one were lexed starting in the state the line before them ended in, the
+    // ones after it that are not stale were too unless the highlighter has not got to them yet.
+    size_t lexFrontier;
+    // The last LINE_EDITS edits within a line, so what is known about a line before them can be
+    // brought up to date instead of made again.
+    LineEdit edits[LINE_EDITS];
+    size_t editCount;
+    // Lines edited, inserted or removed since takeLineChanges was last called, folded into one
+    // change. Only meaningful while linesChanged is set.
+    LineChange changedLines;
+    int linesChanged;
 } Text;
 
 Text* createText(void);
 void freeText(Text* lines);
+void appendSourceLine(Text* text, size_t offset, size_t length);
+size_t appendSourceLines(Text* text, size_t start, const size_t* newLines, size_t count);
+LineSpan getLineSpan(Text* text, size_t line);
+size_t lineLength(Text* text, size_t line);
+void setLineWidth(Text* text, size_t line, int width);
+void resetLineWidths(Text* text);
+size_t nextUnmeasuredLine(Text* text);
+void setLineRows(Text* text, size_t line, int rows);
+size_t rowOfLine(Text* text, size_t line);
+size_t lineAtRow(Text* text, size_t row, size_t* rowInLine);
+size_t totalRows(Text* text);
+const void* lineIdentity(Text* text, size_t line);
+int lineChangeSince(Text* text, size_t line, const void* identity, size_t version, LineChange* change);
+void markLinesChanged(Text* text, size_t line, size_t removed, size_t inserted);
+int takeLineChanges(Text* text, LineChange* change);
+size_t nextCharIndex(Text* text, size_t line, size_t index);
+size_t prevCharIndex(Text* text, size_t line, size_t index);
+size_t copyFromLine(Text* text, size_t line, size_t start, size_t end, char* dest);
+GapBuffer* editLine(Text* text, size_t line);
 void createNewLine(Text* text, size_t index, size_t linePos);
 size_t deleteLine(Text* text, size_t lineNum, size_t linePos);
-void insertOnLine(Text* text, int line, char* string, size_t stringLength);
-void deleteFromLine(Text* text, int line);
+void insertOnLine(Text* text, int line, size_t linePos, const char* string, size_t stringLength);
+void insertTextOnLine(Text* text, size_t* line, size_t* linePos, const char* string, size_t stringLength);
+void deleteFromLine(Text* text, int line, size_t linePos);
+void deleteText(Text* text, size_t line, size_t linePos, size_t length);
+size_t replaceAll(Text* text, const char* needle, size_t needleLength, const char* replacement,
+                  size_t replacementLength);
+void applyReplacement(Text* text, const char* data, size_t length, int reverse);
 
 
 #endif
@@ -1,17 +1,43 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdlib.h>
+#include <float.h>
+#include <time.h>
 #include <SDL.h>
 #include <SDL_ttf.h>
 #include "vec.h"
 #include "glyph.h"
+#include "grep.h"
+#include "atlas.h"
+#include "batch.h"
+#include "cache.h"
+#include "checkpoint.h"
 #include "gap.h"
+#include "highlight.h"
 #include "line.h"
 #include "file.h"
+#include "journal.h"
+#include "scan.h"
+#include "search.h"
+#include "selection.h"
+#include "undo.h"
+#include "utf8.h"
 
 #define MAX_BUFFER_SIZE 1024
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define BLINK_INTERVAL 500
+#define STATS_INTERVAL 60000
+#define LINE_CACHE_KB 4096
+#define UNDO_MB 128
+#define MEASURE_BATCH 4096
+#define HIGHLIGHT_BATCH 2048
+#define FONT_FILE "DejaVuSansMono.ttf"
+#define FONT_SIZE 24
+#define ZOOM_STEP 2
+#define MIN_FONT_SIZE 8
+#define MAX_FONT_SIZE 40
 
 typedef struct
 {
@@ -21,14 +47,6 @@ typedef struct
     int preferred_x;
 } Cursor;
 
-typedef struct
-{
-    size_t start_line;
-    size_t start_index;
-    size_t end_line;
-    size_t end_index;
-} Selection;
-
 typedef struct
 {
     int x;
@@ -37,8 +55,48 @@ typedef struct
     int max_y;
     int win_w;
     int win_h;
+    // Lines are wrapped at the window width, y counts screen rows instead of lines then.
+    bool wrap;
 } ScrollState;
 
+// Find mode, typed text goes into the query instead of the text. Searching starts over from origin,
+// where the cursor was when find mode started, whenever the query changes.
+typedef struct
+{
+    bool active;
+    char query[MAX_BUFFER_SIZE];
+    size_t length;
+    TextPosition origin;
+    // Tab switches typing over to the replacement, Ctrl+Enter replaces every match with it.
+    bool replacing;
+    char replacement[MAX_BUFFER_SIZE];
+    size_t replacement_length;
+    // Matches on the lines on screen, collected again every frame.
+    MatchList matches;
+    // Alt+R switches to regular expressions, searched on a background thread. found holds the
+    // matches handed over so far in text order. The search covers the text as it was at
+    // searched_version, lines loaded since are searched once it is done. The snapshot searched is
+    // kept until regex search is turned off.
+    bool regex;
+    bool invalid;
+    SearchJob *job;
+    SearchSnapshot *snapshot;
+    MatchList found;
+    size_t searched_version;
+    size_t searched_lines;
+} FindState;
+
+// Frames drawn and CPU time used, printed once a minute when TEXT_STATS is set. Timings of single
+// operations, like startup and replacing, are only printed then as well.
+typedef struct
+{
+    bool enabled;
+    Uint32 start;
+    clock_t cpu_start;
+    int frames;
+    int inputs;
+} FrameStats;
+
 void sdl_cc(int code)
 {
     if (code < 0)
@@ -58,459 +116,1171 @@ void *sdl_cp(void *ptr)
     return ptr;
 }
 
-void loadFont(const char *fontFile, int fontSize, TTF_Font **font_ptr)
+// Opens the font at fontSize with its baked ASCII and has the sizes a zoom step away baked in the
+// background, so zooming to them only takes an upload.
+TTF_Font *loadFont(AtlasCache *atlas, int fontSize, Glyph_Image **image)
 {
-    if (font_ptr != NULL && *font_ptr != NULL)
+    TTF_Font *font = sdl_cp(loadAtlas(atlas, fontSize, image));
+    if (fontSize - ZOOM_STEP >= MIN_FONT_SIZE)
     {
-        TTF_CloseFont(*font_ptr);
+        prebakeAtlas(atlas, fontSize - ZOOM_STEP);
     }
-    *font_ptr = sdl_cp(TTF_OpenFont(fontFile, fontSize));
+    if (fontSize + ZOOM_STEP <= MAX_FONT_SIZE)
+    {
+        prebakeAtlas(atlas, fontSize + ZOOM_STEP);
+    }
+    return font;
 }
 
-void copyRect_GS(Glyph_Rect *srcRect, SDL_Rect *dstRect)
+void zoomFont(AtlasCache *atlas, Glyph_Map *glyphMap, TTF_Font **font_ptr, int fontSize)
 {
-    dstRect->x = srcRect->x;
-    dstRect->y = srcRect->y;
-    dstRect->w = srcRect->w;
-    dstRect->h = srcRect->h;
+    Glyph_Image *image = NULL;
+    TTF_Font *font = loadFont(atlas, fontSize, &image);
+    setGlyphFont(glyphMap, font, image);
+    freeGlyphImage(image);
+    closeGlyphFont(*font_ptr);
+    *font_ptr = font;
 }
 
-SDL_Texture *cacheTexture(SDL_Renderer *renderer, TTF_Font *font, Glyph_Map *glyphMap)
+// Long lines are laid out from the nearest checkpoint instead of from their start. When lines are
+// wrapped this is the x on the row the cursor is on.
+int calculateCursorX(Text *text, size_t line_num, Glyph_Map *glyphMap, CheckpointCache *checkpoints,
+                     size_t cursor_pos)
 {
-    SDL_Color color = {255, 255, 255, 255};
-    int height = TTF_FontHeight(font);
-    int ascent = TTF_FontAscent(font);
-    int descent = TTF_FontDescent(font);
-
-    if (ascent - descent != height)
+    LineSpan line = getLineSpan(text, line_num);
+    size_t length = line.beforeLength + line.afterLength;
+    cursor_pos = MIN(cursor_pos, length);
+    Checkpoint start = {0, 0};
+    if (checkpoints->wrapWidth > 0)
     {
-        height = ascent - descent;
+        const RowStarts *rows = findRowStarts(checkpoints, text, line_num, glyphMap);
+        start.offset = rows->starts[rowOfIndex(rows, cursor_pos)];
     }
-
-    int maxWidth = height * 12;
-    int maxHeight = height * 12;
-    glyphMap->glyphHeight = height;
-
-    SDL_Surface *cacheSurface = sdl_cp(SDL_CreateRGBSurface(SDL_SWSURFACE, maxWidth, maxHeight, 32,
-                                                            0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000));
-
-    char asciiString[95] = "";
-    for (int i = 0; i < 95; i++)
+    else if (length > LONG_LINE_BYTES)
     {
-        asciiString[i] = (char)(32 + i);
+        start = checkpointAt(findCheckpoints(checkpoints, text, line_num, glyphMap), cursor_pos);
     }
+    return lineRangeWidth(glyphMap, &line, start.offset, cursor_pos, start.x);
+}
 
-    SDL_Rect cacheCursor = {.x = 0, .y = 0, .w = 0, .h = height};
-    for (size_t i = 0; i < strlen(asciiString); i++)
+size_t findCursorPosition(Text *text, size_t line_num, Glyph_Map *glyphMap, CheckpointCache *checkpoints,
+                          int target_x)
+{
+    LineSpan line = getLineSpan(text, line_num);
+    Checkpoint start = {0, 0};
+    if (line.beforeLength + line.afterLength > LONG_LINE_BYTES)
     {
-        SDL_Surface *glyphSurface = sdl_cp(TTF_RenderGlyph_Blended(font, asciiString[i], color));
-        sdl_cc(SDL_SetSurfaceBlendMode(glyphSurface, SDL_BLENDMODE_NONE));
-
-        if (cacheCursor.x + glyphSurface->w >= maxWidth)
-        {
-            cacheCursor.x = 0;
-            cacheCursor.y += height;
-        }
+        start = checkpointBefore(findCheckpoints(checkpoints, text, line_num, glyphMap), target_x);
+    }
+    int x = start.x;
+    return lineRangePosition(glyphMap, &line, start.offset, &x, target_x);
+}
 
-        cacheCursor.w = glyphSurface->w;
-        cacheCursor.h = glyphSurface->h;
-        SDL_Rect srcRect = {0, 0, glyphSurface->w, glyphSurface->h};
-        SDL_Rect dstRect = {cacheCursor.x, cacheCursor.y, cacheCursor.w, cacheCursor.h};
-        sdl_cc(SDL_BlitSurface(glyphSurface, &srcRect, cacheSurface, &dstRect));
-        addGlyph(glyphMap, asciiString[i], &cacheCursor);
-        cacheCursor.x += glyphSurface->w;
-        SDL_FreeSurface(glyphSurface);
+// How many screen rows a line takes, 1 unless lines are wrapped.
+size_t lineRowCount(Text *text, size_t line_num, Glyph_Map *glyphMap, CheckpointCache *checkpoints)
+{
+    if (checkpoints->wrapWidth == 0)
+    {
+        return 1;
     }
+    return findRowStarts(checkpoints, text, line_num, glyphMap)->count;
+}
 
-    SDL_Texture *cacheTexture = sdl_cp(SDL_CreateTextureFromSurface(renderer, cacheSurface));
-    SDL_FreeSurface(cacheSurface);
-    return cacheTexture;
+// Which row of its line the cursor is on, 0 unless lines are wrapped.
+size_t cursorRow(Text *text, size_t line_num, size_t cursor_pos, Glyph_Map *glyphMap, CheckpointCache *checkpoints)
+{
+    if (checkpoints->wrapWidth == 0)
+    {
+        return 0;
+    }
+    return rowOfIndex(findRowStarts(checkpoints, text, line_num, glyphMap), cursor_pos);
 }
 
-int calculateCursorX(GapBuffer *line, Glyph_Map *glyphMap, size_t cursor_pos)
+// Index closest to target_x on one row of a line. A row that is followed by another ends before its
+// last character, so the cursor does not end up at the start of the next row instead.
+size_t findRowPosition(Text *text, size_t line_num, size_t row, Glyph_Map *glyphMap, CheckpointCache *checkpoints,
+                       int target_x)
 {
+    if (checkpoints->wrapWidth == 0)
+    {
+        return findCursorPosition(text, line_num, glyphMap, checkpoints, target_x);
+    }
+    const RowStarts *rows = findRowStarts(checkpoints, text, line_num, glyphMap);
+    row = MIN(row, rows->count - 1);
+    LineSpan line = getLineSpan(text, line_num);
     int x = 0;
-    for (size_t i = 0; i < cursor_pos && i < line->cursor; i++)
+    size_t index = lineRangePosition(glyphMap, &line, rows->starts[row], &x, target_x);
+    if (row + 1 < rows->count && index >= rows->starts[row + 1])
+    {
+        index = prevCharIndex(text, line_num, rows->starts[row + 1]);
+    }
+    return index;
+}
+
+// Moves the cursor one screen row up or down near preferred_x. Returns false on the first or last row.
+bool moveCursorRow(Text *text, Cursor *cursor, int direction, Glyph_Map *glyphMap, CheckpointCache *checkpoints)
+{
+    size_t line = cursor->line;
+    size_t row = cursorRow(text, line, cursor->index, glyphMap, checkpoints);
+    if (direction < 0)
     {
-        int glyph = line->string[i];
-        if (glyph >= 32 && glyph <= 126)
+        if (row > 0)
+        {
+            row--;
+        }
+        else if (line > 0)
         {
-            x += glyphMap->glyphs[glyph - 32]->w;
+            line--;
+            row = lineRowCount(text, line, glyphMap, checkpoints) - 1;
+        }
+        else
+        {
+            return false;
         }
     }
-    for (size_t i = line->gapEnd; i < line->length && i < line->gapEnd + (cursor_pos - line->cursor); i++)
+    else
     {
-        int glyph = line->string[i];
-        if (glyph >= 32 && glyph <= 126)
+        if (row + 1 < lineRowCount(text, line, glyphMap, checkpoints))
         {
-            x += glyphMap->glyphs[glyph - 32]->w;
+            row++;
+        }
+        else if (line + 1 < text->lineCount)
+        {
+            line++;
+            row = 0;
+        }
+        else
+        {
+            return false;
         }
     }
-    return x;
+    cursor->line = line;
+    cursor->index = findRowPosition(text, line, row, glyphMap, checkpoints, cursor->preferred_x);
+    return true;
 }
 
-size_t findCursorPosition(GapBuffer *line, Glyph_Map *glyphMap, int target_x)
+// Screen row the first row of a line is on when the window is not scrolled.
+size_t screenRowOfLine(Text *text, ScrollState *scroll, size_t line_num)
 {
-    int current_x = 0;
-    size_t pos = 0;
+    return scroll->wrap ? rowOfLine(text, line_num) : line_num;
+}
+
+int cursorScreenRow(Text *text, Cursor *cursor, Glyph_Map *glyphMap, CheckpointCache *checkpoints,
+                    ScrollState *scroll)
+{
+    return (int)(screenRowOfLine(text, scroll, cursor->line) +
+                 cursorRow(text, cursor->line, cursor->index, glyphMap, checkpoints));
+}
 
-    // Check characters before gap
-    for (; pos < line->cursor; pos++)
+// Line and row of the line shown on a screen row. Returns false below the last line.
+bool lineOnScreenRow(Text *text, ScrollState *scroll, int screen_row, size_t *line_num, size_t *row)
+{
+    if (screen_row < 0)
     {
-        int glyph = line->string[pos];
-        if (glyph >= 32 && glyph <= 126)
-        {
-            int char_width = glyphMap->glyphs[glyph - 32]->w;
-            if (current_x + char_width / 2 > target_x)
-            {
-                return pos;
-            }
-            current_x += char_width;
-        }
+        return false;
     }
-
-    // Check characters after gap
-    for (size_t i = line->gapEnd; i < line->length; i++)
+    if (!scroll->wrap)
     {
-        int glyph = line->string[i];
-        if (glyph >= 32 && glyph <= 126)
-        {
-            int char_width = glyphMap->glyphs[glyph - 32]->w;
-            if (current_x + char_width / 2 > target_x)
-            {
-                return pos;
-            }
-            current_x += char_width;
-            pos++;
-        }
+        *line_num = screen_row;
+        *row = 0;
+        return *line_num < text->lineCount;
     }
-
-    return pos;
+    if ((size_t)screen_row >= totalRows(text))
+    {
+        return false;
+    }
+    *line_num = lineAtRow(text, screen_row, row);
+    return true;
 }
 
-void renderCursor(SDL_Renderer *renderer, Cursor *cursor, GapBuffer *text,
-                  SDL_Texture *cursorTexture, Glyph_Map *glyphMap, ScrollState *scroll)
+void renderCursor(GlyphBatch *batch, Cursor *cursor, Text *text,
+                  Glyph_Map *glyphMap, CheckpointCache *checkpoints, ScrollState *scroll)
 {
     SDL_Rect destRect = {
         .x = -scroll->x,
-        .y = (int)(cursor->line - scroll->y) * glyphMap->glyphHeight,
+        .y = (cursorScreenRow(text, cursor, glyphMap, checkpoints, scroll) - scroll->y) * glyphMap->glyphHeight,
         .w = glyphMap->glyphHeight / 2,
         .h = glyphMap->glyphHeight};
 
-    destRect.x += calculateCursorX(text, glyphMap, cursor->index);
-    sdl_cc(SDL_RenderCopy(renderer, cursorTexture, NULL, &destRect));
+    destRect.x += calculateCursorX(text, cursor->line, glyphMap, checkpoints, cursor->index);
+    SDL_Color cursorColor = {255, 255, 255, 170};
+    batchRect(batch, &destRect, &glyphMap->solid, cursorColor);
 }
 
-void renderSelection(SDL_Renderer *renderer, Selection *selection, Text *text,
-                     Glyph_Map *glyphMap, ScrollState *scroll)
+TextPosition cursorPosition(Cursor *cursor)
 {
-    if (selection->start_line == selection->end_line &&
-        selection->start_index == selection->end_index)
+    return (TextPosition){.line = cursor->line, .index = cursor->index};
+}
+
+// Part of a wrapped line, one rectangle per row. Only rows on screen are looked at.
+void renderWrappedRange(GlyphBatch *batch, Text *text, size_t line_num, size_t start_idx, size_t end_idx,
+                        SDL_Color color, Glyph_Map *glyphMap, CheckpointCache *checkpoints, ScrollState *scroll)
+{
+    const RowStarts *rows = findRowStarts(checkpoints, text, line_num, glyphMap);
+    LineSpan line = getLineSpan(text, line_num);
+    size_t length = line.beforeLength + line.afterLength;
+    int line_row = (int)rowOfLine(text, line_num) - scroll->y;
+    int rows_visible = scroll->win_h / glyphMap->glyphHeight + 1;
+    size_t row = rowOfIndex(rows, start_idx);
+    if (line_row < 0)
     {
-        return;
+        row = MAX(row, (size_t)-line_row);
     }
-
-    // Determine the actual start and end of selection
-    size_t sel_start_line, sel_start_index, sel_end_line, sel_end_index;
-    if (selection->start_line < selection->end_line ||
-        (selection->start_line == selection->end_line &&
-         selection->start_index <= selection->end_index))
+    for (; row < rows->count && line_row + (int)row < rows_visible && rows->starts[row] < end_idx; row++)
     {
-        sel_start_line = selection->start_line;
-        sel_start_index = selection->start_index;
-        sel_end_line = selection->end_line;
-        sel_end_index = selection->end_index;
+        size_t row_start = rows->starts[row];
+        size_t row_end = row + 1 < rows->count ? rows->starts[row + 1] : length;
+        int start_x = lineRangeWidth(glyphMap, &line, row_start, MAX(start_idx, row_start), 0);
+        int end_x = lineRangeWidth(glyphMap, &line, row_start, MIN(end_idx, row_end), 0);
+        SDL_Rect range_rect = {
+            .x = start_x,
+            .y = (line_row + (int)row) * glyphMap->glyphHeight,
+            .w = end_x - start_x,
+            .h = glyphMap->glyphHeight};
+        batchRect(batch, &range_rect, &glyphMap->solid, color);
     }
-    else
+}
+
+// Rectangle behind the bytes start_idx..end_idx of a line, or one per row when wrapping.
+void renderLineRange(GlyphBatch *batch, Text *text, size_t line_num, size_t start_idx, size_t end_idx,
+                     SDL_Color color, Glyph_Map *glyphMap, CheckpointCache *checkpoints, ScrollState *scroll)
+{
+    if (scroll->wrap)
     {
-        sel_start_line = selection->end_line;
-        sel_start_index = selection->end_index;
-        sel_end_line = selection->start_line;
-        sel_end_index = selection->start_index;
+        renderWrappedRange(batch, text, line_num, start_idx, end_idx, color, glyphMap, checkpoints, scroll);
+        return;
     }
 
-    // Set selection color with transparency
-    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_BLEND);
-    SDL_SetRenderDrawColor(renderer, 100, 150, 255, 100); // Azul claro semi-transparente
+    // Whole lines end at the width they were measured at.
+    size_t length = lineLength(text, line_num);
+    int start_x = start_idx == 0 ? 0 : calculateCursorX(text, line_num, glyphMap, checkpoints, start_idx);
+    int end_x = end_idx == length && text->lines[line_num].width != LINE_UNMEASURED
+                    ? text->lines[line_num].width
+                    : calculateCursorX(text, line_num, glyphMap, checkpoints, end_idx);
+    SDL_Rect range_rect = {
+        .x = start_x - scroll->x,
+        .y = (int)(line_num - scroll->y) * glyphMap->glyphHeight,
+        .w = end_x - start_x,
+        .h = glyphMap->glyphHeight};
+    batchRect(batch, &range_rect, &glyphMap->solid, color);
+}
 
-    // Render selection for each line
-    for (size_t line = sel_start_line; line <= sel_end_line; line++)
+// Only the ranges that reach the visible lines are looked at, so a selection covering the whole
+// document costs no more than one covering the screen.
+void renderSelection(GlyphBatch *batch, Selection *selection, Text *text, Glyph_Map *glyphMap,
+                     CheckpointCache *checkpoints, ScrollState *scroll, size_t first_line, size_t last_line)
+{
+    SDL_Color selectionColor = {100, 150, 255, 100};
+    for (size_t i = firstRangeFrom(selection, first_line); i < selection->count; i++)
     {
-        if (line >= text->lineCount)
+        SelectionRange *range = &selection->ranges[i];
+        if (range->start.line >= last_line)
+        {
             break;
+        }
+        size_t from = MAX(range->start.line, first_line);
+        size_t to = MIN(range->end.line + 1, MIN(last_line, text->lineCount));
+        for (size_t line = from; line < to; line++)
+        {
+            size_t length = lineLength(text, line);
+            size_t start_idx = line == range->start.line ? range->start.index : 0;
+            size_t end_idx = line == range->end.line ? MIN(range->end.index, length) : length;
+            if (start_idx >= end_idx)
+                continue;
+            renderLineRange(batch, text, line, start_idx, end_idx, selectionColor, glyphMap, checkpoints, scroll);
+        }
+    }
+}
 
-        GapBuffer *current_line = text->lines[line];
-        int line_y = (int)(line - scroll->y) * glyphMap->glyphHeight;
-
-        size_t start_idx = (line == sel_start_line) ? sel_start_index : 0;
-        size_t end_idx = (line == sel_end_line) ? sel_end_index : gapUsed(current_line);
+// Every match of the find query on the visible lines. Literals are searched on those lines only,
+// regex matches are looked up in the ones the background search found.
+void renderMatches(GlyphBatch *batch, FindState *find, Text *text, Glyph_Map *glyphMap,
+                   CheckpointCache *checkpoints, ScrollState *scroll, size_t first_line, size_t last_line)
+{
+    SDL_Color matchColor = {255, 200, 0, 80};
+    if (!find->active)
+    {
+        return;
+    }
+    MatchList *matches = &find->matches;
+    size_t i = 0;
+    if (find->regex)
+    {
+        matches = &find->found;
+        i = firstMatchFrom(matches, first_line);
+    }
+    else
+    {
+        collectMatches(text, first_line, last_line, find->query, find->length, matches);
+    }
+    for (; i < matches->count && matches->matches[i].start.line < last_line; i++)
+    {
+        Match *match = &matches->matches[i];
+        renderLineRange(batch, text, match->start.line, match->start.index, match->end.index, matchColor, glyphMap,
+                        checkpoints, scroll);
+    }
+}
 
-        if (start_idx >= end_idx)
+// Colors of the token kinds, plain text is drawn in the text color.
+static const SDL_Color token_colors[TOKEN_KINDS] = {
+    [TOKEN_TEXT] = {255, 255, 255, 255},
+    [TOKEN_KEYWORD] = {198, 120, 221, 255},
+    [TOKEN_TYPE] = {229, 192, 123, 255},
+    [TOKEN_NUMBER] = {209, 154, 102, 255},
+    [TOKEN_STRING] = {152, 195, 121, 255},
+    [TOKEN_COMMENT] = {127, 132, 142, 255},
+    [TOKEN_PREPROCESSOR] = {97, 175, 239, 255},
+};
+
+// Glyphs that end left of left are skipped and layout stops once x passes right.
+float renderSpan(QuadList *quads, const char *string, size_t length, float x, float y, float left, float right,
+                 SDL_Color color, Glyph_Map *glyphMap)
+{
+    const char *end = string + length;
+    size_t used;
+    for (const char *c = string; c < end && x < right; c += used)
+    {
+        Uint32 codepoint = decodeUtf8(c, end, &used);
+        if (codepoint == '\t')
+        {
+            x = (float)tabStop(glyphMap, (int)x);
+            continue;
+        }
+        if (codepoint < 32)
             continue;
 
-        int start_x = calculateCursorX(current_line, glyphMap, start_idx) - scroll->x;
-        int end_x = calculateCursorX(current_line, glyphMap, end_idx) - scroll->x;
+        Glyph_Entry *glyph = findGlyph(glyphMap, codepoint);
+        if (x + glyph->rect.w > left)
+        {
+            addGlyphQuad(quads, x, y, glyph, color);
+        }
+        x += glyph->rect.w;
+    }
+    return x;
+}
 
-        SDL_Rect selection_rect = {
-            .x = start_x,
-            .y = line_y,
-            .w = end_x - start_x,
-            .h = glyphMap->glyphHeight};
+// Lays out the bytes from..to of a line with the pen at x, y.
+float renderRange(QuadList *quads, LineSpan *line, size_t from, size_t to, float x, float y, float left,
+                  float right, SDL_Color color, Glyph_Map *glyphMap)
+{
+    if (from < line->beforeLength)
+    {
+        size_t end = MIN(to, line->beforeLength);
+        x = renderSpan(quads, line->before + from, end - from, x, y, left, right, color, glyphMap);
+        from = end;
+    }
+    if (to > from)
+    {
+        size_t after = from - line->beforeLength;
+        x = renderSpan(quads, line->after + after, to - from, x, y, left, right, color, glyphMap);
+    }
+    return x;
+}
 
-        SDL_RenderFillRect(renderer, &selection_rect);
+// Lays out from..to in the colors of the tokens it is made of, all in color if there are none.
+// Glyph colors end up in the vertices, so colored text still goes out in the same draw calls.
+float renderTokens(QuadList *quads, LineSpan *line, size_t from, size_t to, float x, float y,
+                   const TokenList *tokens, SDL_Color color, Glyph_Map *glyphMap)
+{
+    if (tokens == NULL || tokens->count == 0)
+    {
+        return renderRange(quads, line, from, to, x, y, 0, FLT_MAX, color, glyphMap);
+    }
+    size_t token = 0;
+    while (token + 1 < tokens->count && tokens->spans[token + 1].start <= from)
+    {
+        token++;
     }
+    for (; from < to; token++)
+    {
+        size_t end = token + 1 < tokens->count ? MIN(to, tokens->spans[token + 1].start) : to;
+        TokenKind kind = tokens->spans[token].kind;
+        x = renderRange(quads, line, from, end, x, y, 0, FLT_MAX, kind == TOKEN_TEXT ? color : token_colors[kind],
+                        glyphMap);
+        from = end;
+    }
+    return x;
+}
 
-    // Reset blend mode
-    SDL_SetRenderDrawBlendMode(renderer, SDL_BLENDMODE_NONE);
+// Lays out a line starting at 0, 0. Returns its width.
+int renderLine(QuadList *quads, LineSpan *line, const TokenList *tokens, SDL_Color color, Glyph_Map *glyphMap)
+{
+    size_t length = line->beforeLength + line->afterLength;
+    return (int)renderTokens(quads, line, 0, length, 0, 0, tokens, color, glyphMap);
 }
 
-void renderChar(SDL_Renderer *renderer, const char c, Vec2 *pos,
-                SDL_Texture *font, SDL_Color color, Glyph_Map *glyphMap)
+// Lays out a line wrapped at width, each row below the one before. Returns how many rows it took.
+int renderWrappedLine(QuadList *quads, LineSpan *line, int width, const TokenList *tokens, SDL_Color color,
+                      Glyph_Map *glyphMap)
 {
-    (void)color;
+    size_t length = line->beforeLength + line->afterLength;
+    size_t start = 0;
+    int rows = 0;
+    do
+    {
+        size_t end = wrapRowEnd(glyphMap, line, start, width);
+        renderTokens(quads, line, start, end, 0, (float)(rows * glyphMap->glyphHeight), tokens, color, glyphMap);
+        rows++;
+        start = end;
+    } while (start < length);
+    return rows;
+}
 
-    size_t index = (int)c - 32;
-    if (c < 32)
-        return;
-    if (index >= 95)
-        index = 94;
+// Lays out only the part of a long line between left and right, starting from the last checkpoint
+// left of it, so the cost does not depend on the length of the line or on how far it is scrolled.
+void renderLineWindow(QuadList *quads, LineSpan *line, LineCheckpoints *checkpoints, int left, int right,
+                      SDL_Color color, Glyph_Map *glyphMap)
+{
+    Checkpoint start = checkpointBefore(checkpoints, left);
+    size_t length = line->beforeLength + line->afterLength;
+    renderRange(quads, line, start.offset, length, (float)start.x, 0, left, right, color, glyphMap);
+}
+
+// Horizontal scrolling goes as far as the widest line of the document that has been measured.
+void updateScrollWidth(ScrollState *scroll, Text *text)
+{
+    scroll->max_x = scroll->wrap ? 0 : MAX(0, widestWidth(text->widths) - scroll->win_w);
+}
+
+void updateScrollMax(ScrollState *scroll, Text *text, Glyph_Map *glyphMap)
+{
+    int lines_visible = scroll->win_h / glyphMap->glyphHeight;
+    size_t rows = scroll->wrap ? totalRows(text) : text->lineCount;
+    scroll->max_y = MAX(0, (int)rows - lines_visible);
+    scroll->y = MIN(scroll->y, scroll->max_y);
+}
 
-    SDL_Rect fontRect = {0};
-    copyRect_GS(glyphMap->glyphs[index], &fontRect);
-    SDL_Rect destRect = {pos->x, pos->y, fontRect.w, fontRect.h};
-    sdl_cc(SDL_RenderCopy(renderer, font, &fontRect, &destRect));
-    pos->x += fontRect.w;
+// First line on screen and which of its rows is at the top.
+size_t firstVisibleLine(Text *text, ScrollState *scroll, size_t *first_row)
+{
+    *first_row = 0;
+    return scroll->wrap ? lineAtRow(text, scroll->y, first_row) : MIN((size_t)scroll->y, text->lineCount - 1);
 }
 
-void renderLine(SDL_Renderer *renderer, Vec2 *linePos, GapBuffer *line,
-                SDL_Texture *font, SDL_Color color, Glyph_Map *glyphMap)
+// Lines wrap a cursor's width before the right edge of the window, so the cursor after the last
+// character of a row stays on screen.
+void updateWrapWidth(ScrollState *scroll, Text *text, LineCache *lineCache, CheckpointCache *checkpoints,
+                     Glyph_Map *glyphMap)
 {
-    for (size_t i = 0; i < line->cursor; i++)
+    int width = scroll->wrap ? MAX(scroll->win_w - glyphMap->glyphHeight / 2, glyphMap->glyphHeight) : 0;
+    if (width != checkpoints->wrapWidth)
     {
-        renderChar(renderer, line->string[i], linePos, font, color, glyphMap);
+        // Lines keep the rows they had until they are measured again, on screen when they are
+        // drawn and between frames for the rest.
+        setWrapWidth(checkpoints, width);
+        clearLineCache(lineCache);
+        resetLineWidths(text);
     }
-    for (size_t i = line->gapEnd; i < line->length; i++)
+}
+
+// Measures up to MEASURE_BATCH lines that changed or were loaded since they were last measured.
+// Visible lines are measured when they are drawn, this catches up on the rest between frames. When
+// lines are wrapped the line at the top of the window stays there while the rows above it change.
+// Returns whether the window has to be drawn again.
+bool measureLines(Text *text, Glyph_Map *glyphMap, CheckpointCache *checkpoints, ScrollState *scroll)
+{
+    size_t top_row = 0;
+    size_t top_line = scroll->wrap ? lineAtRow(text, scroll->y, &top_row) : 0;
+    int y = scroll->y;
+    int max_y = scroll->max_y;
+    for (int i = 0; i < MEASURE_BATCH && text->unmeasured > 0; i++)
     {
-        renderChar(renderer, line->string[i], linePos, font, color, glyphMap);
+        size_t line_num = nextUnmeasuredLine(text);
+        LineSpan line = getLineSpan(text, line_num);
+        size_t length = line.beforeLength + line.afterLength;
+        // Long lines take their width from their checkpoints, which an edit only measures again
+        // around the edited bytes.
+        int width = length > LONG_LINE_BYTES ? findCheckpoints(checkpoints, text, line_num, glyphMap)->width
+                                             : lineRangeWidth(glyphMap, &line, 0, length, 0);
+        setLineWidth(text, line_num, width);
+        if (checkpoints->wrapWidth > 0)
+        {
+            int rows = width <= checkpoints->wrapWidth ? 1 : countWrappedRows(glyphMap, &line, checkpoints->wrapWidth);
+            setLineRows(text, line_num, rows);
+        }
     }
+    if (scroll->wrap)
+    {
+        scroll->y = (int)(rowOfLine(text, top_line) + MIN(top_row, (size_t)text->lines[top_line].rows - 1));
+        updateScrollMax(scroll, text, glyphMap);
+    }
+    updateScrollWidth(scroll, text);
+    return scroll->y != y || scroll->max_y != max_y;
 }
 
-void renderText(SDL_Renderer *renderer, Text *text, Cursor *cursor, Selection *selection,
-                SDL_Texture *fontTexture, SDL_Texture *cursorTexture,
-                SDL_Color color, Glyph_Map *glyphMap, ScrollState *scroll)
+// Visible rows of a wrapped long line, laid out from where each row starts.
+void renderWrappedWindow(GlyphBatch *batch, LineSpan *line, const RowStarts *rows, int line_row, int rows_visible,
+                         SDL_Color color, Glyph_Map *glyphMap)
 {
-    Vec2 pen = {.x = -scroll->x, .y = 0};
-    int lines_visible = scroll->win_h / glyphMap->glyphHeight;
-    int first_line = scroll->y;
-    int last_line = MIN((int)text->lineCount, first_line + lines_visible + 1);
-
-    // Calculate max line width for horizontal scrolling
-    scroll->max_x = 0;
-    for (int i = first_line; i < last_line; i++)
+    size_t length = line->beforeLength + line->afterLength;
+    for (size_t row = line_row < 0 ? (size_t)-line_row : 0; row < rows->count && line_row + (int)row < rows_visible;
+         row++)
     {
-        int line_width = 0;
-        GapBuffer *line = text->lines[i];
+        size_t end = row + 1 < rows->count ? rows->starts[row + 1] : length;
+        clearQuads(&batch->scratch);
+        renderRange(&batch->scratch, line, rows->starts[row], end, 0, 0, 0, FLT_MAX, color, glyphMap);
+        batchQuads(batch, &batch->scratch, 0, (line_row + (int)row) * glyphMap->glyphHeight);
+    }
+}
 
-        for (size_t j = 0; j < line->cursor; j++)
+// Glyphs, selection and cursor all come from the glyph atlas and go out in one draw call per atlas
+// page. Lines that did not change since they were last drawn are copied from the line cache instead
+// of laid out again. When lines are wrapped scroll->y is a screen row, the line it is part of is
+// looked up in the row tree and lines are drawn from there until the window is full.
+void renderText(SDL_Renderer *renderer, GlyphBatch *batch, LineCache *lineCache, CheckpointCache *checkpoints,
+                Highlighter *highlighter, Text *text, Cursor *cursor, bool cursor_visible, Selection *selection,
+                FindState *find, SDL_Color color, Glyph_Map *glyphMap, ScrollState *scroll)
+{
+    int rows_visible = scroll->win_h / glyphMap->glyphHeight + 1;
+    size_t first_row = 0;
+    size_t first_line = firstVisibleLine(text, scroll, &first_row);
+    size_t last_line = first_line;
+
+    // Render visible lines, measuring them on the way. Cached lines point into
+    // the atlas, so they are dropped whenever glyphs moved. If that happens while laying out this
+    // frame the lines are laid out once more, then every glyph comes from this frame and stays put.
+    nextGlyphFrame(glyphMap);
+    for (int pass = 0; pass < 2; pass++)
+    {
+        if (lineCache->generation != glyphMap->generation)
         {
-            int glyph = line->string[j];
-            if (glyph >= 32 && glyph <= 126)
-            {
-                line_width += glyphMap->glyphs[glyph - 32]->w;
-            }
+            clearLineCache(lineCache);
+            lineCache->generation = glyphMap->generation;
         }
-
-        for (size_t j = line->gapEnd; j < line->length; j++)
+        Uint32 generation = glyphMap->generation;
+        beginBatch(batch, glyphMap);
+        int row = -(int)first_row;
+        size_t i = first_line;
+        for (; i < text->lineCount && row < rows_visible; i++)
         {
-            int glyph = line->string[j];
-            if (glyph >= 32 && glyph <= 126)
+            int y = row * glyphMap->glyphHeight;
+            if (lineLength(text, i) > LONG_LINE_BYTES)
+            {
+                LineCheckpoints *points = findCheckpoints(checkpoints, text, i, glyphMap);
+                LineSpan line = getLineSpan(text, i);
+                if (scroll->wrap)
+                {
+                    const RowStarts *rows = findRowStarts(checkpoints, text, i, glyphMap);
+                    renderWrappedWindow(batch, &line, rows, row, rows_visible, color, glyphMap);
+                    setLineRows(text, i, (int)rows->count);
+                }
+                else
+                {
+                    clearQuads(&batch->scratch);
+                    renderLineWindow(&batch->scratch, &line, points, scroll->x, scroll->x + scroll->win_w, color,
+                                     glyphMap);
+                    batchQuads(batch, &batch->scratch, -scroll->x, y);
+                }
+                if (text->lines[i].width == LINE_UNMEASURED)
+                {
+                    setLineWidth(text, i, points->width);
+                }
+                row += scroll->wrap ? text->lines[i].rows : 1;
+                continue;
+            }
+            // Runs are drawn in the colors of the state the line started in when they were laid out.
+            const void *identity = lineIdentity(text, i);
+            int state = highlighter != NULL ? lineStartState(highlighter, text, i) : LEX_START;
+            LineRun *run = findLineRun(lineCache, identity, text->lines[i].version);
+            if (run != NULL && run->state != state)
+            {
+                run = NULL;
+            }
+            if (run == NULL)
+            {
+                clearQuads(&batch->scratch);
+                LineSpan line = getLineSpan(text, i);
+                const TokenList *tokens = highlighter != NULL ? highlightLine(highlighter, text, i) : NULL;
+                int rows = 1;
+                int width;
+                if (scroll->wrap)
+                {
+                    rows = renderWrappedLine(&batch->scratch, &line, checkpoints->wrapWidth, tokens, color, glyphMap);
+                    width = lineRangeWidth(glyphMap, &line, 0, line.beforeLength + line.afterLength, 0);
+                }
+                else
+                {
+                    width = renderLine(&batch->scratch, &line, tokens, color, glyphMap);
+                }
+                run = storeLineRun(lineCache, identity, text->lines[i].version, &batch->scratch, width, rows, state);
+            }
+            batchQuads(batch, &run->quads, -scroll->x, y);
+            if (text->lines[i].width == LINE_UNMEASURED)
+            {
+                setLineWidth(text, i, run->width);
+            }
+            if (scroll->wrap)
             {
-                line_width += glyphMap->glyphs[glyph - 32]->w;
+                setLineRows(text, i, run->rows);
             }
+            row += run->rows;
         }
-
-        if (line_width > scroll->max_x)
+        last_line = i;
+        if (glyphMap->generation == generation)
         {
-            scroll->max_x = line_width;
+            break;
         }
     }
-
-    scroll->max_x = MAX(0, scroll->max_x - scroll->win_w);
-
-    // Render visible lines
-    for (int i = first_line; i < last_line; i++)
+    if (scroll->wrap)
     {
-        pen.y = (i - first_line) * glyphMap->glyphHeight;
-        renderLine(renderer, &pen, text->lines[i], fontTexture, color, glyphMap);
-        pen.x = -scroll->x;
+        updateScrollMax(scroll, text, glyphMap);
     }
+    updateScrollWidth(scroll, text);
 
-    // Render selection
-    renderSelection(renderer, selection, text, glyphMap, scroll);
+    // Render matches and selection
+    renderMatches(batch, find, text, glyphMap, checkpoints, scroll, first_line, last_line);
+    renderSelection(batch, selection, text, glyphMap, checkpoints, scroll, first_line, last_line);
 
     // Render cursor if visible
-    if (cursor->line >= (size_t)first_line && cursor->line < (size_t)last_line)
+    if (cursor_visible && cursor->line >= first_line && cursor->line < last_line)
     {
-        renderCursor(renderer, cursor, text->lines[cursor->line], cursorTexture, glyphMap, scroll);
+        renderCursor(batch, cursor, text, glyphMap, checkpoints, scroll);
     }
+    flushBatch(batch, renderer);
 }
 
-void updateScrollMax(ScrollState *scroll, Text *text, Glyph_Map *glyphMap)
+void keepCursorVisible(Text *text, Cursor *cursor, Glyph_Map *glyphMap, CheckpointCache *checkpoints,
+                       ScrollState *scroll)
 {
+    // Keep cursor visible vertically
     int lines_visible = scroll->win_h / glyphMap->glyphHeight;
-    scroll->max_y = MAX(0, (int)text->lineCount - lines_visible);
-    scroll->y = MIN(scroll->y, scroll->max_y);
+    int cursor_row = cursorScreenRow(text, cursor, glyphMap, checkpoints, scroll);
+    if (cursor_row < scroll->y)
+    {
+        scroll->y = cursor_row;
+    }
+    else if (cursor_row >= scroll->y + lines_visible)
+    {
+        scroll->y = cursor_row - lines_visible + 1;
+    }
+
+    // Keep cursor visible horizontally
+    int cursor_x = calculateCursorX(text, cursor->line, glyphMap, checkpoints, cursor->index);
+    if (cursor_x < scroll->x)
+    {
+        scroll->x = MAX(0, cursor_x - 20);
+    }
+    else if (cursor_x > scroll->x + scroll->win_w - 20)
+    {
+        scroll->x = MIN(scroll->max_x, cursor_x - scroll->win_w + 20);
+    }
 }
 
-void copySelectedText(Text *text, Selection *selection, char *clipboard, size_t clipboard_size)
+// Thin bar along the bottom of the window while the file is still being loaded.
+void renderLoadProgress(SDL_Renderer *renderer, FileSource *file, ScrollState *scroll)
 {
-    if (selection->start_line == selection->end_line &&
-        selection->start_index == selection->end_index)
+    float progress = loadProgress(file);
+    if (progress >= 1.0f)
     {
-        clipboard[0] = '\0';
         return;
     }
+    SDL_Rect bar = {
+        .x = 0,
+        .y = scroll->win_h - 3,
+        .w = (int)(scroll->win_w * progress),
+        .h = 3};
+    SDL_SetRenderDrawColor(renderer, 100, 150, 255, 255);
+    SDL_RenderFillRect(renderer, &bar);
+}
+
+// Selects the first match at or after from and puts the cursor at its end, so the next search goes on
+// past it. Returns false if the query is not in the text.
+bool findNext(FindState *find, Text *text, TextPosition from, Cursor *cursor, Selection *selection,
+              Glyph_Map *glyphMap, CheckpointCache *checkpoints)
+{
+    Match match;
+    bool found = find->regex ? nextMatchInList(&find->found, from, &match)
+                             : findNextMatch(text, from, find->query, find->length, &match);
+    if (!found)
+    {
+        return false;
+    }
+    selectRange(selection, match.start, match.end);
+    cursor->line = match.end.line;
+    cursor->index = match.end.index;
+    cursor->preferred_x = calculateCursorX(text, cursor->line, glyphMap, checkpoints, cursor->index);
+    return true;
+}
 
-    // Determine the actual start and end of selection
-    size_t sel_start_line, sel_start_index, sel_end_line, sel_end_index;
-    if (selection->start_line < selection->end_line ||
-        (selection->start_line == selection->end_line &&
-         selection->start_index <= selection->end_index))
+// Starts the regex search over on the lines from first_line on. Matches on the lines before are kept.
+void restartRegexSearch(FindState *find, Text *text, size_t first_line, Uint32 search_event)
+{
+    find->found.count = first_line == 0 ? 0 : firstMatchFrom(&find->found, first_line);
+    find->searched_version = text->version;
+    find->searched_lines = text->lineCount;
+    if (find->length == 0)
     {
-        sel_start_line = selection->start_line;
-        sel_start_index = selection->start_index;
-        sel_end_line = selection->end_line;
-        sel_end_index = selection->end_index;
+        cancelSearch(find->job);
+        find->job = NULL;
+        find->invalid = false;
+        return;
     }
-    else
+    if (find->snapshot == NULL)
     {
-        sel_start_line = selection->end_line;
-        sel_start_index = selection->end_index;
-        sel_end_line = selection->start_line;
-        sel_end_index = selection->start_index;
+        find->snapshot = createSnapshot();
     }
+    find->job = startSearch(find->query, text, find->snapshot, first_line, find->job, search_event);
+    find->invalid = find->job == NULL;
+}
 
-    size_t clipboard_pos = 0;
-    for (size_t line = sel_start_line; line <= sel_end_line && clipboard_pos < clipboard_size - 1; line++)
+void stopRegexSearch(FindState *find)
+{
+    cancelSearch(find->job);
+    find->job = NULL;
+    freeSnapshot(find->snapshot);
+    find->snapshot = NULL;
+    find->invalid = false;
+    find->found.count = 0;
+}
+
+// Searches again from where find mode started after the query changed. If there is no match the
+// cursor goes back there. Regex matches come in later, they are gone to with Enter.
+void updateFind(FindState *find, Text *text, Cursor *cursor, Selection *selection, Glyph_Map *glyphMap,
+                CheckpointCache *checkpoints, Uint32 search_event)
+{
+    if (find->regex)
     {
-        if (line >= text->lineCount)
-            break;
+        restartRegexSearch(find, text, 0, search_event);
+        return;
+    }
+    if (find->length > 0 && findNext(find, text, find->origin, cursor, selection, glyphMap, checkpoints))
+    {
+        return;
+    }
+    clearSelection(selection);
+    cursor->line = find->origin.line;
+    cursor->index = find->origin.index;
+    cursor->preferred_x = calculateCursorX(text, cursor->line, glyphMap, checkpoints, cursor->index);
+}
 
-        GapBuffer *current_line = text->lines[line];
-        size_t start_idx = (line == sel_start_line) ? sel_start_index : 0;
-        size_t end_idx = (line == sel_end_line) ? sel_end_index : gapUsed(current_line);
+// Adds typed text to a find field. Returns false if it does not fit.
+bool appendFindText(char *field, size_t *length, const char *string)
+{
+    size_t string_length = strlen(string);
+    if (*length + string_length >= MAX_BUFFER_SIZE)
+    {
+        return false;
+    }
+    memcpy(field + *length, string, string_length + 1);
+    *length += string_length;
+    return true;
+}
 
-        if (start_idx >= end_idx)
-            continue;
+// Removes the last character of a find field, with the continuation bytes of it. Returns false if
+// the field is empty.
+bool eraseFindChar(char *field, size_t *length)
+{
+    if (*length == 0)
+    {
+        return false;
+    }
+    do
+    {
+        (*length)--;
+    } while (*length > 0 && ((unsigned char)field[*length] & 0xC0) == 0x80);
+    field[*length] = '\0';
+    return true;
+}
 
-        // Copy characters before gap
-        for (size_t i = start_idx; i < MIN(end_idx, current_line->cursor) && clipboard_pos < clipboard_size - 1; i++)
-        {
-            clipboard[clipboard_pos++] = current_line->string[i];
-        }
+// Replaces every match of the literal query in one pass over the text, and with TEXT_STATS set
+// reports how long it took.
+void replaceMatches(FindState *find, Text *text, Cursor *cursor, Selection *selection, Glyph_Map *glyphMap,
+                    CheckpointCache *checkpoints, FrameStats *stats)
+{
+    Uint64 start = SDL_GetPerformanceCounter();
+    beginUndoGroup(text->undo);
+    size_t replaced = replaceAll(text, find->query, find->length, find->replacement, find->replacement_length);
+    endUndoGroup(text->undo);
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+    if (stats->enabled)
+    {
+        printf("Replaced %zu matches in %.2f ms (%.0f per second)\n", replaced, seconds * 1000.0,
+               seconds > 0.0 ? (double)replaced / seconds : 0.0);
+    }
 
-        // Copy characters after gap
-        for (size_t i = current_line->gapEnd;
-             i < current_line->length &&
-             i < current_line->gapEnd + (end_idx - current_line->cursor) &&
-             clipboard_pos < clipboard_size - 1;
-             i++)
+    // The cursor stays on its line, which may have got shorter.
+    clearSelection(selection);
+    cursor->index = MIN(cursor->index, lineLength(text, cursor->line));
+    cursor->preferred_x = calculateCursorX(text, cursor->line, glyphMap, checkpoints, cursor->index);
+    find->origin = cursorPosition(cursor);
+}
+
+// Undoes the last edit, or redoes the last undone one, and puts the cursor where it happened.
+void undoOrRedo(Text *text, Cursor *cursor, Selection *selection, Glyph_Map *glyphMap,
+                CheckpointCache *checkpoints, bool redo)
+{
+    TextPosition position;
+    if (!(redo ? redoEdit(text, &position) : undoEdit(text, &position)))
+    {
+        return;
+    }
+    clearSelection(selection);
+    cursor->line = MIN(position.line, text->lineCount - 1);
+    cursor->index = MIN(position.index, lineLength(text, cursor->line));
+    cursor->preferred_x = calculateCursorX(text, cursor->line, glyphMap, checkpoints, cursor->index);
+}
+
+// The query is shown in the window title while find mode is on.
+void updateFindTitle(SDL_Window *window, FindState *find)
+{
+    if (!find->active)
+    {
+        SDL_SetWindowTitle(window, "Text Editor");
+        return;
+    }
+    char title[2 * MAX_BUFFER_SIZE + 64];
+    if (find->replacing)
+    {
+        snprintf(title, sizeof(title), "Find: %s, replace with: %s", find->query, find->replacement);
+    }
+    else if (!find->regex)
+    {
+        snprintf(title, sizeof(title), "Find: %s", find->query);
+    }
+    else if (find->invalid)
+    {
+        snprintf(title, sizeof(title), "Find regex: %s (invalid)", find->query);
+    }
+    else
+    {
+        bool searching = find->job != NULL && !searchFinished(find->job);
+        snprintf(title, sizeof(title), "Find regex: %s (%zu matches%s)", find->query, find->found.count,
+                 searching ? ", searching" : "");
+    }
+    SDL_SetWindowTitle(window, title);
+}
+
+// Bytes in the selected text, with a newline between lines and between ranges.
+size_t selectedTextLength(Text *text, Selection *selection)
+{
+    size_t length = selection->count > 0 ? selection->count - 1 : 0;
+    for (size_t i = 0; i < selection->count; i++)
+    {
+        SelectionRange *range = &selection->ranges[i];
+        for (size_t line = range->start.line; line <= range->end.line && line < text->lineCount; line++)
         {
-            clipboard[clipboard_pos++] = current_line->string[i];
+            size_t start_idx = (line == range->start.line) ? range->start.index : 0;
+            size_t end_idx = (line == range->end.line) ? range->end.index : lineLength(text, line);
+            end_idx = MIN(end_idx, lineLength(text, line));
+            length += (start_idx < end_idx ? end_idx - start_idx : 0) + (line != range->end.line ? 1 : 0);
         }
+    }
+    return length;
+}
 
-        // Add newline if not the last line
-        if (line != sel_end_line && clipboard_pos < clipboard_size - 1)
+// Copies the selected text into one string sized for it, ranges are separated by a newline. The
+// length is counted first so the string is allocated once, then each line is copied from both sides
+// of its gap without moving it. The caller frees the string.
+char *copySelectedText(Text *text, Selection *selection, size_t *length)
+{
+    char *clipboard = (char *)malloc(selectedTextLength(text, selection) + 1);
+    size_t clipboard_pos = 0;
+    for (size_t i = 0; i < selection->count; i++)
+    {
+        SelectionRange *range = &selection->ranges[i];
+        if (i > 0)
         {
             clipboard[clipboard_pos++] = '\n';
         }
+        for (size_t line = range->start.line; line <= range->end.line && line < text->lineCount; line++)
+        {
+            size_t start_idx = (line == range->start.line) ? range->start.index : 0;
+            size_t end_idx = (line == range->end.line) ? range->end.index : lineLength(text, line);
+            clipboard_pos += copyFromLine(text, line, start_idx, end_idx, clipboard + clipboard_pos);
+
+            // Add newline if not the last line
+            if (line != range->end.line)
+            {
+                clipboard[clipboard_pos++] = '\n';
+            }
+        }
     }
     clipboard[clipboard_pos] = '\0';
+    *length = clipboard_pos;
+    return clipboard;
 }
 
-void pasteText(Text *text, Cursor *cursor, Selection *selection, const char *clipboard)
+// Line breaks from the system clipboard may be "\r\n", they are turned into "\n" in place.
+size_t dropCarriageReturns(char *string, size_t length)
 {
-    // Delete selected text if any
-    if (selection->start_line != selection->end_line || selection->start_index != selection->end_index)
+    char *cr = memchr(string, '\r', length);
+    if (cr == NULL)
+    {
+        return length;
+    }
+    char *out = cr;
+    const char *end = string + length;
+    for (const char *in = cr; in < end; in++)
     {
-        // TODO: Implement deletion of selected text
-        selection->start_line = selection->end_line = cursor->line;
-        selection->start_index = selection->end_index = cursor->index;
+        if (*in != '\r' || in + 1 >= end || in[1] != '\n')
+        {
+            *out++ = *in;
+        }
     }
+    return (size_t)(out - string);
+}
 
-    // Insert clipboard content
-    const char *ptr = clipboard;
-    while (*ptr != '\0')
+// Deletes every selected range and puts the cursor where the first one started. The ranges are
+// deleted from the last one back, so the ones before it stay where they are. Callers that edit
+// after it group the edits, so undo puts the selection back with them.
+void deleteSelectedText(Text *text, Cursor *cursor, Selection *selection)
+{
+    for (size_t i = selection->count; i-- > 0;)
     {
-        if (*ptr == '\n')
+        SelectionRange *range = &selection->ranges[i];
+        if (range->start.line >= text->lineCount)
         {
-            cursor->line++;
-            createNewLine(text, cursor->line, cursor->index);
-            cursor->index = 0;
+            continue;
         }
-        else
+        size_t start_pos = MIN(range->start.index, lineLength(text, range->start.line));
+        size_t length = 0;
+        for (size_t line = range->start.line; line <= range->end.line && line < text->lineCount; line++)
         {
-            char ch[2] = {*ptr, '\0'};
-            insertOnLine(text, cursor->line, ch, 1);
-            cursor->index++;
+            size_t start_idx = (line == range->start.line) ? start_pos : 0;
+            size_t end_idx = (line == range->end.line) ? range->end.index : lineLength(text, line);
+            end_idx = MIN(end_idx, lineLength(text, line));
+            length += (start_idx < end_idx ? end_idx - start_idx : 0) + (line != range->end.line ? 1 : 0);
         }
-        ptr++;
+        deleteText(text, range->start.line, start_pos, length);
     }
+    TextPosition start = selectionStart(selection);
+    cursor->line = MIN(start.line, text->lineCount - 1);
+    cursor->index = MIN(start.index, lineLength(text, cursor->line));
+    clearSelection(selection);
+}
+
+// The whole clipboard goes in with one multi-line insert. It replaces the selection, both are
+// undone as one edit.
+void pasteText(Text *text, Cursor *cursor, Selection *selection, const char *clipboard, size_t length)
+{
+    beginUndoGroup(text->undo);
+    if (!selectionEmpty(selection))
+    {
+        deleteSelectedText(text, cursor, selection);
+    }
+    insertTextOnLine(text, &cursor->line, &cursor->index, clipboard, length);
+    endUndoGroup(text->undo);
 }
 
 void selectAll(Text *text, Selection *selection)
 {
-    selection->start_line = 0;
-    selection->start_index = 0;
-    selection->end_line = text->lineCount - 1;
-    selection->end_index = gapUsed(text->lines[text->lineCount - 1]);
+    TextPosition end = {.line = text->lineCount - 1, .index = lineLength(text, text->lineCount - 1)};
+    selectRange(selection, (TextPosition){0}, end);
+}
+
+void startFrameStats(FrameStats *stats)
+{
+    stats->start = SDL_GetTicks();
+    stats->cpu_start = clock();
+    stats->frames = 0;
+    stats->inputs = 0;
+}
+
+// Milliseconds until the next report, -1 if stats are off.
+int statsTimeout(FrameStats *stats)
+{
+    if (!stats->enabled)
+    {
+        return -1;
+    }
+    Uint32 elapsed = SDL_GetTicks() - stats->start;
+    return elapsed >= STATS_INTERVAL ? 0 : (int)(STATS_INTERVAL - elapsed);
+}
+
+// A minute with any keyboard or mouse input is reported as typing, otherwise as idle.
+void reportFrameStats(FrameStats *stats, LineCache *lineCache)
+{
+    if (statsTimeout(stats) != 0)
+    {
+        return;
+    }
+    double minutes = (double)(SDL_GetTicks() - stats->start) / STATS_INTERVAL;
+    double cpu = (double)(clock() - stats->cpu_start) / CLOCKS_PER_SEC;
+    printf("%s: %.1f frames, %.3f s CPU per minute, %d input events\n", stats->inputs > 0 ? "Typing" : "Idle",
+           stats->frames / minutes, cpu / minutes, stats->inputs);
+    size_t lookups = lineCache->hits + lineCache->misses;
+    printf("Line cache: %.1f%% hits, %zu lines in %zu KB of %zu KB\n",
+           lookups > 0 ? 100.0 * lineCache->hits / lookups : 0.0, lineCache->runCount,
+           lineCache->bytes / 1024, lineCache->budget / 1024);
+    lineCache->hits = 0;
+    lineCache->misses = 0;
+    startFrameStats(stats);
+}
+
+// Blocks until an event arrives or timeout milliseconds pass, forever if timeout is negative.
+int waitForEvent(SDL_Event *event, int timeout)
+{
+    if (timeout < 0)
+    {
+        return SDL_WaitEvent(event);
+    }
+    return SDL_WaitEventTimeout(event, timeout);
+}
+
+// Waits for a save to finish. Once the file holds the snapshot the journal only needs the edits made
+// after it was taken.
+void completeSave(SaveJob *job, Journal *journal, size_t mark, const char *fileName)
+{
+    if (job == NULL)
+    {
+        return;
+    }
+    if (finishSave(job) != 0)
+    {
+        fprintf(stderr, "Could not save %s\n", fileName);
+        return;
+    }
+    journalCheckpoint(journal, mark);
 }
 
 int main(int argc, char const *argv[])
 {
+    Uint64 start_time = SDL_GetPerformanceCounter();
     sdl_cc(SDL_Init(SDL_INIT_VIDEO));
     sdl_cc(TTF_Init());
-
-    TTF_Font *font = NULL;
-    loadFont("DejaVuSansMono.ttf", 24, &font);
+    initScanner();
+    initGlyphs();
+
+    // Baked ASCII is kept on disk, opening a size that was used before rasterizes nothing.
+    AtlasCache *atlas = openAtlasCache(FONT_FILE);
+    int font_size = FONT_SIZE;
+    Glyph_Image *font_image = NULL;
+    TTF_Font *font = loadFont(atlas, font_size, &font_image);
     SDL_Window *window = sdl_cp(SDL_CreateWindow("Text Editor", SDL_WINDOWPOS_CENTERED,
                                                  SDL_WINDOWPOS_CENTERED, 800, 600, SDL_WINDOW_RESIZABLE));
-    SDL_Renderer *renderer = sdl_cp(SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED));
+    // TEXT_VSYNC=1 caps redraws at the display refresh rate.
+    Uint32 renderer_flags = SDL_RENDERER_ACCELERATED;
+    const char *vsync = getenv("TEXT_VSYNC");
+    if (vsync != NULL && strcmp(vsync, "0") != 0)
+    {
+        renderer_flags |= SDL_RENDERER_PRESENTVSYNC;
+    }
+    SDL_Renderer *renderer = sdl_cp(SDL_CreateRenderer(window, -1, renderer_flags));
 
     SDL_Color color = {255, 255, 255, 255};
-    Glyph_Map *glyphMap = createGlyphMap();
-    SDL_Texture *fontTexture = cacheTexture(renderer, font, glyphMap);
-
-    SDL_Surface *cursorSurface = sdl_cp(SDL_CreateRGBSurface(SDL_SWSURFACE, 8, 8, 32,
-                                                             0x000000FF, 0x0000FF00, 0x00FF0000, 0xFF000000));
-    sdl_cc(SDL_FillRect(cursorSurface, NULL, 0xAAFFFFFF));
-    SDL_Texture *cursorTexture = sdl_cp(SDL_CreateTextureFromSurface(renderer, cursorSurface));
-    SDL_FreeSurface(cursorSurface);
+    Glyph_Map *glyphMap = createGlyphMap(renderer, font, font_image);
+    freeGlyphImage(font_image);
+    GlyphBatch *batch = createBatch();
+
+    // Laid out lines are kept up to TEXT_LINE_CACHE_KB kilobytes.
+    size_t line_cache_kb = LINE_CACHE_KB;
+    const char *line_cache_size = getenv("TEXT_LINE_CACHE_KB");
+    if (line_cache_size != NULL)
+    {
+        line_cache_kb = strtoul(line_cache_size, NULL, 10);
+    }
+    LineCache *lineCache = createLineCache(line_cache_kb * 1024);
+    CheckpointCache *checkpoints = createCheckpointCache();
+    // Files are highlighted by the lexer for their extension, if there is one.
+    Highlighter *highlighter = createHighlighter(argc >= 2 ? findLexer(argv[1]) : NULL);
 
     Cursor cursor = {0};
     cursor.preferred_x = 0;
     Selection selection = {0};
+    FindState find = {0};
     Text *text = createText();
     ScrollState scroll = {0};
     SDL_GetWindowSize(window, &scroll.win_w, &scroll.win_h);
 
+    // The file is loaded by a background thread, its lines are published as they are found.
+    Uint32 load_event = SDL_RegisterEvents(1);
+    FileSource *file = NULL;
     if (argc >= 2)
     {
-        openFile(argv[1], text);
-        moveCursor(text->lines[0], 0);
-        updateScrollMax(&scroll, text, glyphMap);
+        file = openFile(argv[1], load_event);
     }
 
-    char clipboard[MAX_BUFFER_SIZE] = {0};
+    // Regex searches run on a background thread and hand their matches over as they find them.
+    Uint32 search_event = SDL_RegisterEvents(1);
+
+    // Saves are written by a background thread from a snapshot of the text.
+    Uint32 save_event = SDL_RegisterEvents(1);
+    SyncPolicy sync_policy = syncPolicyFromEnv();
+    SaveJob *save_job = NULL;
+    size_t save_mark = 0;
+    // Ctrl+S only asks for a save. It starts once the file is fully loaded and the save before it is
+    // written, any number of presses in between make one save.
+    bool save_requested = false;
+
+    FrameStats stats = {0};
+    stats.enabled = getenv("TEXT_STATS") != NULL;
+
+    // Edits are journaled next to the file. If the last session did not save them they are replayed
+    // once the file is fully loaded. Journaling starts with the first published lines, since edits
+    // to the empty line the text starts with could not be replayed against the file.
+    Journal *journal = NULL;
+    if (argc >= 2)
+    {
+        journal = openJournal(argv[1], sync_policy);
+        if (journalPending(journal))
+        {
+            finishLoading(file, text);
+            size_t recovered = replayJournal(journal, text);
+            if (stats.enabled)
+            {
+                printf("Recovered %zu edits from the journal\n", recovered);
+            }
+        }
+    }
+
+    // Undo history is kept up to TEXT_UNDO_MB megabytes, the oldest edits are dropped after that.
+    size_t undo_mb = UNDO_MB;
+    const char *undo_size = getenv("TEXT_UNDO_MB");
+    if (undo_size != NULL)
+    {
+        undo_mb = strtoul(undo_size, NULL, 10);
+    }
+    UndoLog *undo = createUndoLog(undo_mb * 1024 * 1024);
+
+    // Nothing is edited before the first lines are in, so every edit is journaled and can be undone.
+    waitForLines(file, text);
+    updateScrollMax(&scroll, text, glyphMap);
+    text->journal = journal;
+    text->undo = undo;
+
+    // Copied text goes to the system clipboard. It is only kept here if that fails.
+    char *clipboard = NULL;
+    size_t clipboard_length = 0;
     bool mouse_dragging = false;
     bool exit = false;
     bool shift_pressed = false;
+    bool first_frame = true;
+
+    // The window is only redrawn when something on it changed. In between the loop sleeps until the
+    // next event or the next cursor blink.
+    bool dirty = true;
+    bool focused = true;
+    bool cursor_drawn = true;
+    Uint32 blink_start = SDL_GetTicks();
+    startFrameStats(&stats);
 
     while (!exit)
     {
+        int timeout = -1;
+        if (focused)
+        {
+            timeout = BLINK_INTERVAL - (int)((SDL_GetTicks() - blink_start) % BLINK_INTERVAL);
+        }
+        int stats_timeout = statsTimeout(&stats);
+        if (stats_timeout >= 0 && (timeout < 0 || stats_timeout < timeout))
+        {
+            timeout = stats_timeout;
+        }
+
         SDL_Event event;
-        while (SDL_PollEvent(&event))
+        bool measuring = text->unmeasured > 0;
+        bool highlighting = highlighter != NULL && text->lexFrontier < text->lineCount;
+        int has_event = dirty || measuring || highlighting ? SDL_PollEvent(&event) : waitForEvent(&event, timeout);
+        while (has_event)
         {
+            if (event.type == SDL_KEYDOWN || event.type == SDL_TEXTINPUT ||
+                event.type == SDL_MOUSEBUTTONDOWN || event.type == SDL_MOUSEWHEEL)
+            {
+                // Input shows the cursor right away and restarts the blink.
+                blink_start = SDL_GetTicks();
+                stats.inputs++;
+            }
+
             switch (event.type)
             {
             case SDL_QUIT:
@@ -522,8 +1292,19 @@ int main(int argc, char const *argv[])
                 {
                     scroll.win_w = event.window.data1;
                     scroll.win_h = event.window.data2;
+                    updateWrapWidth(&scroll, text, lineCache, checkpoints, glyphMap);
                     updateScrollMax(&scroll, text, glyphMap);
                 }
+                else if (event.window.event == SDL_WINDOWEVENT_FOCUS_GAINED)
+                {
+                    focused = true;
+                    blink_start = SDL_GetTicks();
+                }
+                else if (event.window.event == SDL_WINDOWEVENT_FOCUS_LOST)
+                {
+                    focused = false;
+                }
+                dirty = true;
                 break;
 
             case SDL_MOUSEWHEEL:
@@ -543,40 +1324,45 @@ int main(int argc, char const *argv[])
                 {
                     scroll.x = MAX(0, scroll.x - 20);
                 }
+                dirty = true;
                 break;
 
             case SDL_MOUSEBUTTONDOWN:
                 if (event.button.button == SDL_BUTTON_LEFT)
                 {
                     int mouse_y = event.button.y;
-                    int clicked_line = scroll.y + mouse_y / glyphMap->glyphHeight;
+                    size_t clicked_line;
+                    size_t clicked_row;
 
-                    if (clicked_line >= 0 && clicked_line < (int)text->lineCount)
+                    if (lineOnScreenRow(text, &scroll, scroll.y + mouse_y / glyphMap->glyphHeight, &clicked_line,
+                                        &clicked_row))
                     {
                         cursor.line = clicked_line;
                         int mouse_x = event.button.x + scroll.x;
-                        cursor.index = findCursorPosition(text->lines[cursor.line], glyphMap, mouse_x);
-                        cursor.preferred_x = calculateCursorX(text->lines[cursor.line], glyphMap, cursor.index);
-
-                        // Start selection
-                        selection.start_line = cursor.line;
-                        selection.start_index = cursor.index;
-                        selection.end_line = cursor.line;
-                        selection.end_index = cursor.index;
+                        cursor.index = findRowPosition(text, cursor.line, clicked_row, glyphMap, checkpoints, mouse_x);
+                        cursor.preferred_x = calculateCursorX(text, cursor.line, glyphMap, checkpoints, cursor.index);
+
+                        // Typing after a click starts a new undo step
+                        undoBreak(text->undo);
+
+                        // Start selection, Ctrl+click adds a range to the ones already selected
+                        startSelection(&selection, cursorPosition(&cursor), (SDL_GetModState() & KMOD_CTRL) != 0);
                         mouse_dragging = true;
+                        dirty = true;
 
                         // Adjust scroll to keep cursor visible
                         int lines_visible = scroll.win_h / glyphMap->glyphHeight;
-                        if ((int)cursor.line < scroll.y)
+                        int cursor_row = cursorScreenRow(text, &cursor, glyphMap, checkpoints, &scroll);
+                        if (cursor_row < scroll.y)
                         {
-                            scroll.y = cursor.line;
+                            scroll.y = cursor_row;
                         }
-                        else if ((int)cursor.line >= scroll.y + lines_visible)
+                        else if (cursor_row >= scroll.y + lines_visible)
                         {
-                            scroll.y = cursor.line - lines_visible + 1;
+                            scroll.y = cursor_row - lines_visible + 1;
                         }
 
-                        int cursor_x = calculateCursorX(text->lines[cursor.line], glyphMap, cursor.index);
+                        int cursor_x = calculateCursorX(text, cursor.line, glyphMap, checkpoints, cursor.index);
                         if (cursor_x < scroll.x)
                         {
                             scroll.x = MAX(0, cursor_x - 20);
@@ -593,31 +1379,34 @@ int main(int argc, char const *argv[])
                 if (mouse_dragging)
                 {
                     int mouse_y = event.motion.y;
-                    int clicked_line = scroll.y + mouse_y / glyphMap->glyphHeight;
+                    size_t clicked_line;
+                    size_t clicked_row;
 
-                    if (clicked_line >= 0 && clicked_line < (int)text->lineCount)
+                    if (lineOnScreenRow(text, &scroll, scroll.y + mouse_y / glyphMap->glyphHeight, &clicked_line,
+                                        &clicked_row))
                     {
                         cursor.line = clicked_line;
                         int mouse_x = event.motion.x + scroll.x;
-                        cursor.index = findCursorPosition(text->lines[cursor.line], glyphMap, mouse_x);
-                        cursor.preferred_x = calculateCursorX(text->lines[cursor.line], glyphMap, cursor.index);
+                        cursor.index = findRowPosition(text, cursor.line, clicked_row, glyphMap, checkpoints, mouse_x);
+                        cursor.preferred_x = calculateCursorX(text, cursor.line, glyphMap, checkpoints, cursor.index);
 
                         // Update selection end
-                        selection.end_line = cursor.line;
-                        selection.end_index = cursor.index;
+                        extendSelection(&selection, cursorPosition(&cursor));
+                        dirty = true;
 
                         // Adjust scroll to keep cursor visible
                         int lines_visible = scroll.win_h / glyphMap->glyphHeight;
-                        if ((int)cursor.line < scroll.y)
+                        int cursor_row = cursorScreenRow(text, &cursor, glyphMap, checkpoints, &scroll);
+                        if (cursor_row < scroll.y)
                         {
-                            scroll.y = cursor.line;
+                            scroll.y = cursor_row;
                         }
-                        else if ((int)cursor.line >= scroll.y + lines_visible)
+                        else if (cursor_row >= scroll.y + lines_visible)
                         {
-                            scroll.y = cursor.line - lines_visible + 1;
+                            scroll.y = cursor_row - lines_visible + 1;
                         }
 
-                        int cursor_x = calculateCursorX(text->lines[cursor.line], glyphMap, cursor.index);
+                        int cursor_x = calculateCursorX(text, cursor.line, glyphMap, checkpoints, cursor.index);
                         if (cursor_x < scroll.x)
                         {
                             scroll.x = MAX(0, cursor_x - 20);
@@ -638,21 +1427,39 @@ int main(int argc, char const *argv[])
                 break;
 
             case SDL_TEXTINPUT:
-                if (!(SDL_GetModState() & KMOD_CTRL))
+                if (find.active && !(SDL_GetModState() & KMOD_CTRL))
                 {
-                    // Delete selected text if any
-                    if (selection.start_line != selection.end_line || selection.start_index != selection.end_index)
+                    if (find.replacing)
                     {
-                        // TODO: Implement deletion of selected text
-                        selection.start_line = selection.end_line = cursor.line;
-                        selection.start_index = selection.end_index = cursor.index;
+                        appendFindText(find.replacement, &find.replacement_length, event.text.text);
                     }
-
+                    else if (appendFindText(find.query, &find.length, event.text.text))
+                    {
+                        updateFind(&find, text, &cursor, &selection, glyphMap, checkpoints, search_event);
+                        keepCursorVisible(text, &cursor, glyphMap, checkpoints, &scroll);
+                    }
+                    updateFindTitle(window, &find);
+                    dirty = true;
+                }
+                else if (!(SDL_GetModState() & KMOD_CTRL))
+                {
+                    // Typing over a selection replaces it, undone as one edit
                     size_t textSize = strlen(event.text.text);
-                    insertOnLine(text, cursor.line, event.text.text, textSize);
+                    if (!selectionEmpty(&selection))
+                    {
+                        beginUndoGroup(text->undo);
+                        deleteSelectedText(text, &cursor, &selection);
+                        insertOnLine(text, cursor.line, cursor.index, event.text.text, textSize);
+                        endUndoGroup(text->undo);
+                    }
+                    else
+                    {
+                        insertOnLine(text, cursor.line, cursor.index, event.text.text, textSize);
+                    }
                     cursor.index += textSize;
-                    cursor.preferred_x = calculateCursorX(text->lines[cursor.line], glyphMap, cursor.index);
+                    cursor.preferred_x = calculateCursorX(text, cursor.line, glyphMap, checkpoints, cursor.index);
                     updateScrollMax(&scroll, text, glyphMap);
+                    dirty = true;
                 }
                 break;
 
@@ -667,13 +1474,14 @@ int main(int argc, char const *argv[])
                 case SDLK_EQUALS: // Ctrl + "+"
                     if ((SDL_GetModState() & KMOD_CTRL) && (SDL_GetModState() & KMOD_SHIFT))
                     {
-                        int newSize = glyphMap->glyphHeight + 2;
-                        if (newSize <= 40)
+                        int newSize = font_size + ZOOM_STEP;
+                        if (newSize <= MAX_FONT_SIZE)
                         {
-                            loadFont("DejaVuSansMono.ttf", newSize, &font);
-                            SDL_DestroyTexture(fontTexture);
-                            fontTexture = cacheTexture(renderer, font, glyphMap);
-                            glyphMap->glyphHeight = newSize;
+                            zoomFont(atlas, glyphMap, &font, newSize);
+                            font_size = newSize;
+                            resetLineWidths(text);
+                            clearCheckpoints(checkpoints);
+                            updateWrapWidth(&scroll, text, lineCache, checkpoints, glyphMap);
                             updateScrollMax(&scroll, text, glyphMap);
                         }
                     }
@@ -682,13 +1490,14 @@ int main(int argc, char const *argv[])
                 case SDLK_MINUS: // Ctrl + "-"
                     if (SDL_GetModState() & KMOD_CTRL)
                     {
-                        int newSize = glyphMap->glyphHeight - 2;
-                        if (newSize >= 8)
+                        int newSize = font_size - ZOOM_STEP;
+                        if (newSize >= MIN_FONT_SIZE)
                         {
-                            loadFont("DejaVuSansMono.ttf", newSize, &font);
-                            SDL_DestroyTexture(fontTexture);
-                            fontTexture = cacheTexture(renderer, font, glyphMap);
-                            glyphMap->glyphHeight = newSize;
+                            zoomFont(atlas, glyphMap, &font, newSize);
+                            font_size = newSize;
+                            resetLineWidths(text);
+                            clearCheckpoints(checkpoints);
+                            updateWrapWidth(&scroll, text, lineCache, checkpoints, glyphMap);
                             updateScrollMax(&scroll, text, glyphMap);
                         }
                     }
@@ -698,65 +1507,155 @@ int main(int argc, char const *argv[])
                     if (SDL_GetModState() & KMOD_CTRL)
                     {
                         selectAll(text, &selection);
-                        cursor.line = selection.end_line;
-                        cursor.index = selection.end_index;
-                        cursor.preferred_x = calculateCursorX(text->lines[cursor.line], glyphMap, cursor.index);
+                        cursor.line = selection.head.line;
+                        cursor.index = selection.head.index;
+                        cursor.preferred_x = calculateCursorX(text, cursor.line, glyphMap, checkpoints, cursor.index);
                     }
                     break;
 
                 case SDLK_c: // Ctrl+C
                     if (SDL_GetModState() & KMOD_CTRL)
                     {
-                        copySelectedText(text, &selection, clipboard, MAX_BUFFER_SIZE);
+                        free(clipboard);
+                        clipboard = copySelectedText(text, &selection, &clipboard_length);
+                        if (SDL_SetClipboardText(clipboard) == 0)
+                        {
+                            free(clipboard);
+                            clipboard = NULL;
+                        }
                     }
                     break;
 
                 case SDLK_v: // Ctrl+V
                     if (SDL_GetModState() & KMOD_CTRL)
                     {
-                        pasteText(text, &cursor, &selection, clipboard);
+                        char *pasted = SDL_HasClipboardText() ? SDL_GetClipboardText() : NULL;
+                        if (pasted != NULL && pasted[0] != '\0')
+                        {
+                            pasteText(text, &cursor, &selection, pasted, dropCarriageReturns(pasted, strlen(pasted)));
+                        }
+                        else if (clipboard != NULL)
+                        {
+                            pasteText(text, &cursor, &selection, clipboard, clipboard_length);
+                        }
+                        SDL_free(pasted);
                         updateScrollMax(&scroll, text, glyphMap);
                     }
                     break;
 
+                case SDLK_f: // Ctrl+F
+                    if (SDL_GetModState() & KMOD_CTRL)
+                    {
+                        find.active = true;
+                        find.origin = cursorPosition(&cursor);
+                        updateFindTitle(window, &find);
+                    }
+                    break;
+
+                case SDLK_TAB:
+                    if (find.active)
+                    {
+                        find.replacing = !find.replacing;
+                        updateFindTitle(window, &find);
+                    }
+                    break;
+
+                case SDLK_r: // Alt+R
+                    if (find.active && (SDL_GetModState() & KMOD_ALT))
+                    {
+                        find.regex = !find.regex;
+                        stopRegexSearch(&find);
+                        updateFindTitle(window, &find);
+                    }
+                    break;
+
+                case SDLK_F3:
+                    if (find.length > 0)
+                    {
+                        findNext(&find, text, cursorPosition(&cursor), &cursor, &selection, glyphMap, checkpoints);
+                    }
+                    break;
+
+                case SDLK_ESCAPE:
+                    if (find.active)
+                    {
+                        find.active = false;
+                        find.replacing = false;
+                        stopRegexSearch(&find);
+                        updateFindTitle(window, &find);
+                    }
+                    break;
+
                 case SDLK_s: // Ctrl+S
                     if ((SDL_GetModState() & KMOD_CTRL) && argc >= 2)
                     {
-                        saveFile(argv[1], text);
+                        save_requested = true;
                     }
                     break;
 
                 case SDLK_BACKSPACE:
-                    if (selection.start_line != selection.end_line || selection.start_index != selection.end_index)
+                    if (find.active)
+                    {
+                        if (find.replacing)
+                        {
+                            eraseFindChar(find.replacement, &find.replacement_length);
+                        }
+                        else if (eraseFindChar(find.query, &find.length))
+                        {
+                            updateFind(&find, text, &cursor, &selection, glyphMap, checkpoints, search_event);
+                        }
+                        updateFindTitle(window, &find);
+                    }
+                    else if (!selectionEmpty(&selection))
                     {
-                        // TODO: Implement deletion of selected text
-                        selection.start_line = selection.end_line = cursor.line;
-                        selection.start_index = selection.end_index = cursor.index;
+                        deleteSelectedText(text, &cursor, &selection);
+                        cursor.preferred_x = calculateCursorX(text, cursor.line, glyphMap, checkpoints, cursor.index);
                     }
                     else if (cursor.index > 0)
                     {
-                        cursor.index--;
-                        deleteFromLine(text, cursor.line);
-                        cursor.preferred_x = calculateCursorX(text->lines[cursor.line], glyphMap, cursor.index);
+                        // A character can be several bytes long
+                        size_t previous = prevCharIndex(text, cursor.line, cursor.index);
+                        while (cursor.index > previous)
+                        {
+                            deleteFromLine(text, cursor.line, cursor.index);
+                            cursor.index--;
+                        }
+                        cursor.preferred_x = calculateCursorX(text, cursor.line, glyphMap, checkpoints, cursor.index);
                     }
                     else if (cursor.line > 0)
                     {
                         cursor.index = deleteLine(text, cursor.line, cursor.index);
                         cursor.line--;
-                        cursor.preferred_x = calculateCursorX(text->lines[cursor.line], glyphMap, cursor.index);
+                        cursor.preferred_x = calculateCursorX(text, cursor.line, glyphMap, checkpoints, cursor.index);
                     }
                     updateScrollMax(&scroll, text, glyphMap);
                     break;
 
                 case SDLK_RETURN:
-                    if (selection.start_line != selection.end_line || selection.start_index != selection.end_index)
+                    if (find.active && (SDL_GetModState() & KMOD_CTRL))
+                    {
+                        // Regex matches are only found, there is no replacing them.
+                        if (!find.regex)
+                        {
+                            replaceMatches(&find, text, &cursor, &selection, glyphMap, checkpoints, &stats);
+                            updateScrollMax(&scroll, text, glyphMap);
+                        }
+                        break;
+                    }
+                    if (find.active)
+                    {
+                        findNext(&find, text, cursorPosition(&cursor), &cursor, &selection, glyphMap, checkpoints);
+                        break;
+                    }
+                    // A line break typed over a selection replaces it, undone as one edit
+                    beginUndoGroup(text->undo);
+                    if (!selectionEmpty(&selection))
                     {
-                        // TODO: Implement deletion of selected text
-                        selection.start_line = selection.end_line = cursor.line;
-                        selection.start_index = selection.end_index = cursor.index;
+                        deleteSelectedText(text, &cursor, &selection);
                     }
                     cursor.line++;
                     createNewLine(text, cursor.line, cursor.index);
+                    endUndoGroup(text->undo);
                     cursor.index = 0;
                     cursor.preferred_x = 0;
                     updateScrollMax(&scroll, text, glyphMap);
@@ -765,128 +1664,126 @@ int main(int argc, char const *argv[])
                      case SDLK_LEFT:
                             if (shift_pressed) {
                                 // Se Shift está pressionado, estende a seleção
-                                if (selection.start_line == selection.end_line && 
-                                    selection.start_index == selection.end_index) {
+                                if (!selectionExtending(&selection)) {
                                     // Se não há seleção, começa uma nova
-                                    selection.start_line = cursor.line;
-                                    selection.start_index = cursor.index;
+                                    startSelection(&selection, cursorPosition(&cursor), 1);
                                 }
                                 
                                 if (cursor.index > 0) {
-                                    cursorLeft(text->lines[cursor.line]);
-                                    cursor.index--;
+                                    cursor.index = prevCharIndex(text, cursor.line, cursor.index);
                                 } else if (cursor.line > 0) {
                                     cursor.line--;
-                                    cursor.index = moveCursorToEnd(text->lines[cursor.line]);
+                                    cursor.index = lineLength(text, cursor.line);
                                 }
                                 
                                 // Atualiza apenas o final da seleção
-                                selection.end_line = cursor.line;
-                                selection.end_index = cursor.index;
-                                cursor.preferred_x = calculateCursorX(text->lines[cursor.line], glyphMap, cursor.index);
+                                extendSelection(&selection, cursorPosition(&cursor));
+                                cursor.preferred_x = calculateCursorX(text, cursor.line, glyphMap, checkpoints, cursor.index);
                             } else {
                                 // Comportamento normal sem Shift
-                                if (selection.start_line != selection.end_line || selection.start_index != selection.end_index) {
-                                    cursor.line = selection.start_line;
-                                    cursor.index = selection.start_index;
+                                if (!selectionEmpty(&selection)) {
+                                    cursor.line = selectionStart(&selection).line;
+                                    cursor.index = selectionStart(&selection).index;
                                 } else if (cursor.index > 0) {
-                                    cursorLeft(text->lines[cursor.line]);
-                                    cursor.index--;
+                                    cursor.index = prevCharIndex(text, cursor.line, cursor.index);
                                 } else if (cursor.line > 0) {
                                     cursor.line--;
-                                    cursor.index = moveCursorToEnd(text->lines[cursor.line]);
+                                    cursor.index = lineLength(text, cursor.line);
                                 }
-                                selection.start_line = selection.end_line = cursor.line;
-                                selection.start_index = selection.end_index = cursor.index;
-                                cursor.preferred_x = calculateCursorX(text->lines[cursor.line], glyphMap, cursor.index);
+                                clearSelection(&selection);
+                                cursor.preferred_x = calculateCursorX(text, cursor.line, glyphMap, checkpoints, cursor.index);
                             }
                             break;
 
                         case SDLK_RIGHT:
                             if (shift_pressed) {
-                                if (selection.start_line == selection.end_line && 
-                                    selection.start_index == selection.end_index) {
-                                    selection.start_line = cursor.line;
-                                    selection.start_index = cursor.index;
+                                if (!selectionExtending(&selection)) {
+                                    startSelection(&selection, cursorPosition(&cursor), 1);
                                 }
                                 
-                                if (cursor.index < gapUsed(text->lines[cursor.line])) {
-                                    cursorRight(text->lines[cursor.line]);
-                                    cursor.index++;
+                                if (cursor.index < lineLength(text, cursor.line)) {
+                                    cursor.index = nextCharIndex(text, cursor.line, cursor.index);
                                 } else if (cursor.line < text->lineCount - 1) {
                                     cursor.line++;
                                     cursor.index = 0;
                                 }
                                 
-                                selection.end_line = cursor.line;
-                                selection.end_index = cursor.index;
-                                cursor.preferred_x = calculateCursorX(text->lines[cursor.line], glyphMap, cursor.index);
+                                extendSelection(&selection, cursorPosition(&cursor));
+                                cursor.preferred_x = calculateCursorX(text, cursor.line, glyphMap, checkpoints, cursor.index);
                             } else {
-                                if (selection.start_line != selection.end_line || selection.start_index != selection.end_index) {
-                                    cursor.line = selection.end_line;
-                                    cursor.index = selection.end_index;
-                                } else if (cursor.index < gapUsed(text->lines[cursor.line])) {
-                                    cursorRight(text->lines[cursor.line]);
-                                    cursor.index++;
+                                if (!selectionEmpty(&selection)) {
+                                    cursor.line = selectionEnd(&selection).line;
+                                    cursor.index = selectionEnd(&selection).index;
+                                } else if (cursor.index < lineLength(text, cursor.line)) {
+                                    cursor.index = nextCharIndex(text, cursor.line, cursor.index);
                                 } else if (cursor.line < text->lineCount - 1) {
                                     cursor.line++;
                                     cursor.index = 0;
                                 }
-                                selection.start_line = selection.end_line = cursor.line;
-                                selection.start_index = selection.end_index = cursor.index;
-                                cursor.preferred_x = calculateCursorX(text->lines[cursor.line], glyphMap, cursor.index);
+                                clearSelection(&selection);
+                                cursor.preferred_x = calculateCursorX(text, cursor.line, glyphMap, checkpoints, cursor.index);
                             }
                             break;
 
                         case SDLK_UP:
                             if (shift_pressed) {
-                                if (selection.start_line == selection.end_line && 
-                                    selection.start_index == selection.end_index) {
-                                    selection.start_line = cursor.line;
-                                    selection.start_index = cursor.index;
+                                if (!selectionExtending(&selection)) {
+                                    startSelection(&selection, cursorPosition(&cursor), 1);
                                 }
                                 
-                                if (cursor.line > 0) {
-                                    cursor.line--;
-                                    cursor.index = findCursorPosition(text->lines[cursor.line], glyphMap, cursor.preferred_x);
-                                }
+                                moveCursorRow(text, &cursor, -1, glyphMap, checkpoints);
                                 
-                                selection.end_line = cursor.line;
-                                selection.end_index = cursor.index;
+                                extendSelection(&selection, cursorPosition(&cursor));
                             } else {
-                                if (cursor.line > 0) {
-                                    cursor.line--;
-                                    cursor.index = findCursorPosition(text->lines[cursor.line], glyphMap, cursor.preferred_x);
-                                }
-                                selection.start_line = selection.end_line = cursor.line;
-                                selection.start_index = selection.end_index = cursor.index;
+                                moveCursorRow(text, &cursor, -1, glyphMap, checkpoints);
+                                clearSelection(&selection);
                             }
                             break;
 
                         case SDLK_DOWN:
                             if (shift_pressed) {
-                                if (selection.start_line == selection.end_line && 
-                                    selection.start_index == selection.end_index) {
-                                    selection.start_line = cursor.line;
-                                    selection.start_index = cursor.index;
+                                if (!selectionExtending(&selection)) {
+                                    startSelection(&selection, cursorPosition(&cursor), 1);
                                 }
                                 
-                                if (cursor.line < text->lineCount - 1) {
-                                    cursor.line++;
-                                    cursor.index = findCursorPosition(text->lines[cursor.line], glyphMap, cursor.preferred_x);
-                                }
+                                moveCursorRow(text, &cursor, 1, glyphMap, checkpoints);
                                 
-                                selection.end_line = cursor.line;
-                                selection.end_index = cursor.index;
+                                extendSelection(&selection, cursorPosition(&cursor));
                             } else {
-                                if (cursor.line < text->lineCount - 1) {
-                                    cursor.line++;
-                                    cursor.index = findCursorPosition(text->lines[cursor.line], glyphMap, cursor.preferred_x);
-                                }
-                                selection.start_line = selection.end_line = cursor.line;
-                                selection.start_index = selection.end_index = cursor.index;
+                                moveCursorRow(text, &cursor, 1, glyphMap, checkpoints);
+                                clearSelection(&selection);
                             }
                             break;
+                case SDLK_z: // Ctrl+Z, Ctrl+Shift+Z, Alt+Z
+                    if (SDL_GetModState() & KMOD_CTRL)
+                    {
+                        undoOrRedo(text, &cursor, &selection, glyphMap, checkpoints,
+                                   (SDL_GetModState() & KMOD_SHIFT) != 0);
+                        updateScrollMax(&scroll, text, glyphMap);
+                    }
+                    else if (SDL_GetModState() & KMOD_ALT)
+                    {
+                        // The line at the top of the window stays there.
+                        size_t top_row = 0;
+                        size_t top_line = scroll.wrap ? lineAtRow(text, scroll.y, &top_row) : (size_t)scroll.y;
+                        scroll.wrap = !scroll.wrap;
+                        scroll.x = 0;
+                        updateWrapWidth(&scroll, text, lineCache, checkpoints, glyphMap);
+                        scroll.y = (int)screenRowOfLine(text, &scroll, MIN(top_line, text->lineCount - 1));
+                        updateScrollMax(&scroll, text, glyphMap);
+                        updateScrollWidth(&scroll, text);
+                        cursor.preferred_x = calculateCursorX(text, cursor.line, glyphMap, checkpoints, cursor.index);
+                    }
+                    break;
+
+                case SDLK_y: // Ctrl+Y
+                    if (SDL_GetModState() & KMOD_CTRL)
+                    {
+                        undoOrRedo(text, &cursor, &selection, glyphMap, checkpoints, true);
+                        updateScrollMax(&scroll, text, glyphMap);
+                    }
+                    break;
+
                 case SDLK_PAGEUP:
                     scroll.y = MAX(0, scroll.y - (scroll.win_h / glyphMap->glyphHeight));
                     break;
@@ -896,27 +1793,8 @@ int main(int argc, char const *argv[])
                     break;
                 }
 
-                // Keep cursor visible vertically
-                int lines_visible = scroll.win_h / glyphMap->glyphHeight;
-                if ((int)cursor.line < scroll.y)
-                {
-                    scroll.y = (int)cursor.line;
-                }
-                else if ((int)cursor.line >= scroll.y + lines_visible)
-                {
-                    scroll.y = (int)cursor.line - lines_visible + 1;
-                }
-
-                // Keep cursor visible horizontally
-                int cursor_x = calculateCursorX(text->lines[cursor.line], glyphMap, cursor.index);
-                if (cursor_x < scroll.x)
-                {
-                    scroll.x = MAX(0, cursor_x - 20);
-                }
-                else if (cursor_x > scroll.x + scroll.win_w - 20)
-                {
-                    scroll.x = MIN(scroll.max_x, cursor_x - scroll.win_w + 20);
-                }
+                keepCursorVisible(text, &cursor, glyphMap, checkpoints, &scroll);
+                dirty = true;
                 break;
 
                     case SDL_KEYUP:
@@ -927,20 +1805,123 @@ int main(int argc, char const *argv[])
                             break;
                     }
                     break;
+
+            default:
+                if (event.type == save_event && event.user.data1 == save_job)
+                {
+                    completeSave(save_job, journal, save_mark, argv[1]);
+                    save_job = NULL;
+                }
+                else if (event.type == load_event)
+                {
+                    dirty = true;
+                }
+                else if (event.type == search_event && find.job != NULL && event.user.data1 == find.job)
+                {
+                    takeMatches(find.job, &find.found);
+                    updateFindTitle(window, &find);
+                    dirty = true;
+                }
+                break;
             }
+            has_event = SDL_PollEvent(&event);
         }
 
-        sdl_cc(SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0));
-        sdl_cc(SDL_RenderClear(renderer));
-        renderText(renderer, text, &cursor, &selection, fontTexture, cursorTexture, color, glyphMap, &scroll);
-        SDL_RenderPresent(renderer);
+        if (publishLines(file, text) > 0)
+        {
+            updateScrollMax(&scroll, text, glyphMap);
+            dirty = true;
+        }
+        if (save_requested && save_job == NULL && loadProgress(file) >= 1.0f)
+        {
+            save_requested = false;
+            save_mark = journalMark(journal);
+            save_job = startSave(argv[1], text, sync_policy, save_event);
+        }
+
+        // The regex search starts over once the text changed. Lines loaded since it started are
+        // searched after it is done.
+        if (find.active && find.regex && find.length > 0)
+        {
+            if ((find.job == NULL && !find.invalid) || text->version != find.searched_version)
+            {
+                restartRegexSearch(&find, text, 0, search_event);
+                updateFindTitle(window, &find);
+            }
+            else if (text->lineCount != find.searched_lines && find.job != NULL && searchFinished(find.job))
+            {
+                restartRegexSearch(&find, text, find.searched_lines, search_event);
+                updateFindTitle(window, &find);
+            }
+        }
+
+        bool cursor_visible = !focused || (SDL_GetTicks() - blink_start) / BLINK_INTERVAL % 2 == 0;
+        if (cursor_visible != cursor_drawn)
+        {
+            dirty = true;
+        }
+
+        if (dirty)
+        {
+            sdl_cc(SDL_SetRenderDrawColor(renderer, 0, 0, 0, 0));
+            sdl_cc(SDL_RenderClear(renderer));
+            renderText(renderer, batch, lineCache, checkpoints, highlighter, text, &cursor, cursor_visible, &selection, &find, color, glyphMap, &scroll);
+            renderLoadProgress(renderer, file, &scroll);
+            SDL_RenderPresent(renderer);
+            dirty = false;
+            cursor_drawn = cursor_visible;
+            stats.frames++;
+        }
+        if (measuring && measureLines(text, glyphMap, checkpoints, &scroll))
+        {
+            dirty = true;
+        }
+        if (highlighting)
+        {
+            size_t first_row;
+            size_t first_line = firstVisibleLine(text, &scroll, &first_row);
+            size_t last_line = first_line + scroll.win_h / glyphMap->glyphHeight + 1;
+            if (highlightLines(highlighter, text, HIGHLIGHT_BATCH, first_line, last_line))
+            {
+                dirty = true;
+            }
+        }
+        reportFrameStats(&stats, lineCache);
+
+        if (first_frame && stats.enabled)
+        {
+            printf("First frame after %.2f ms\n",
+                   (double)(SDL_GetPerformanceCounter() - start_time) * 1000.0 / (double)SDL_GetPerformanceFrequency());
+        }
+        first_frame = false;
     }
 
+    // A save asked for before quitting is still made, after the file finished loading.
+    if (save_requested)
+    {
+        finishLoading(file, text);
+        completeSave(save_job, journal, save_mark, argv[1]);
+        save_mark = journalMark(journal);
+        save_job = startSave(argv[1], text, sync_policy, save_event);
+    }
+    completeSave(save_job, journal, save_mark, argv[1]);
+    closeJournal(journal);
+    freeSelection(&selection);
+    freeMatchList(&find.matches);
+    cancelSearch(find.job);
+    freeSnapshot(find.snapshot);
+    freeMatchList(&find.found);
     freeText(text);
+    freeUndoLog(undo);
+    free(clipboard);
+    closeFile(file);
     freeGlyphMap(glyphMap);
-    SDL_DestroyTexture(cursorTexture);
-    SDL_DestroyTexture(fontTexture);
-    TTF_CloseFont(font);
+    freeBatch(batch);
+    freeLineCache(lineCache);
+    freeCheckpointCache(checkpoints);
+    freeHighlighter(highlighter);
+    closeGlyphFont(font);
+    closeAtlasCache(atlas);
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
     TTF_Quit();
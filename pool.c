@@ -0,0 +1,98 @@
+#include "pool.h"
+#include <stdlib.h>
+
+// Takes the next job of the current batch and runs it with the lock released. Expects the lock held.
+static int runNextJob(WorkerPool* pool)
+{
+    if (pool->nextJob >= pool->jobCount) {
+        return 0;
+    }
+    int job = pool->nextJob++;
+    SDL_UnlockMutex(pool->lock);
+    pool->task(pool->jobs + job * pool->jobSize);
+    SDL_LockMutex(pool->lock);
+    if (++pool->finished == pool->jobCount) {
+        SDL_CondSignal(pool->done);
+    }
+    return 1;
+}
+
+static int poolWorker(void* data)
+{
+    WorkerPool* pool = (WorkerPool*)data;
+    SDL_LockMutex(pool->lock);
+    while (!pool->quit) {
+        if (!runNextJob(pool)) {
+            SDL_CondWait(pool->wake, pool->lock);
+        }
+    }
+    SDL_UnlockMutex(pool->lock);
+    return 0;
+}
+
+WorkerPool* createPool(int threadCount)
+{
+    WorkerPool* pool = (WorkerPool*)calloc(1, sizeof(WorkerPool));
+    pool->lock = SDL_CreateMutex();
+    pool->wake = SDL_CreateCond();
+    pool->done = SDL_CreateCond();
+    pool->threads = (SDL_Thread**)calloc(threadCount > 0 ? threadCount : 1, sizeof(SDL_Thread*));
+    for (int i = 0; i < threadCount; i++) {
+        pool->threads[pool->threadCount] = SDL_CreateThread(poolWorker, "worker", pool);
+        if (pool->threads[pool->threadCount] != NULL) {
+            pool->threadCount++;
+        }
+    }
+    return pool;
+}
+
+void freePool(WorkerPool* pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+    SDL_LockMutex(pool->lock);
+    pool->quit = 1;
+    SDL_CondBroadcast(pool->wake);
+    SDL_UnlockMutex(pool->lock);
+    for (int i = 0; i < pool->threadCount; i++) {
+        SDL_WaitThread(pool->threads[i], NULL);
+    }
+    SDL_DestroyCond(pool->done);
+    SDL_DestroyCond(pool->wake);
+    SDL_DestroyMutex(pool->lock);
+    free(pool->threads);
+    free(pool);
+}
+
+// Number of threads that work on a batch, including the caller.
+int poolWorkers(WorkerPool* pool)
+{
+    return pool == NULL ? 1 : pool->threadCount + 1;
+}
+
+// Runs task on each of the jobCount jobs of jobSize bytes in jobs and waits for all of them.
+void runPool(WorkerPool* pool, PoolTask task, void* jobs, size_t jobSize, int jobCount)
+{
+    if (pool == NULL || pool->threadCount == 0 || jobCount == 1) {
+        for (int i = 0; i < jobCount; i++) {
+            task((char*)jobs + i * jobSize);
+        }
+        return;
+    }
+    SDL_LockMutex(pool->lock);
+    pool->task = task;
+    pool->jobs = (char*)jobs;
+    pool->jobSize = jobSize;
+    pool->jobCount = jobCount;
+    pool->nextJob = 0;
+    pool->finished = 0;
+    SDL_CondBroadcast(pool->wake);
+    while (runNextJob(pool)) {
+    }
+    while (pool->finished < pool->jobCount) {
+        SDL_CondWait(pool->done, pool->lock);
+    }
+    pool->jobCount = 0;
+    SDL_UnlockMutex(pool->lock);
+}
@@ -0,0 +1,31 @@
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <SDL.h>
+
+// Fixed set of worker threads that run a batch of jobs in parallel. The calling thread works on the
+// batch too and runPool returns once every job is done.
+
+typedef void (*PoolTask)(void* job);
+
+typedef struct {
+    SDL_Thread** threads;
+    int threadCount;
+    SDL_mutex* lock;
+    SDL_cond* wake;
+    SDL_cond* done;
+    PoolTask task;
+    char* jobs;
+    size_t jobSize;
+    int jobCount;
+    int nextJob;
+    int finished;
+    int quit;
+} WorkerPool;
+
+WorkerPool* createPool(int threadCount);
+void freePool(WorkerPool* pool);
+int poolWorkers(WorkerPool* pool);
+void runPool(WorkerPool* pool, PoolTask task, void* jobs, size_t jobSize, int jobCount);
+
+#endif
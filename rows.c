@@ -0,0 +1,107 @@
+#include "rows.h"
+
+#define MIN_ROW_LINES 64
+
+static size_t lowBit(size_t i)
+{
+    return i & (~i + 1);
+}
+
+static void reserveRows(RowTree* tree, size_t count)
+{
+    if (count + 1 <= tree->capacity) {
+        return;
+    }
+    while (count + 1 > tree->capacity) {
+        tree->capacity = tree->capacity == 0 ? MIN_ROW_LINES : tree->capacity * 2;
+    }
+    tree->sums = (size_t*)realloc(tree->sums, sizeof(size_t) * tree->capacity);
+}
+
+RowTree* createRowTree(void)
+{
+    RowTree* tree = (RowTree*)calloc(1, sizeof(RowTree));
+    reserveRows(tree, 0);
+    return tree;
+}
+
+void freeRowTree(RowTree* tree)
+{
+    if (tree == NULL) {
+        return;
+    }
+    free(tree->sums);
+    free(tree);
+}
+
+// Builds the nodes of the tree that cover lines from from on, in O(n - from), from count row
+// counts each stride bytes after the one before. The nodes before from are kept, the ones of them
+// that the rebuilt nodes cover are the nodes rowsBefore(from) adds up.
+void buildRowTreeFrom(RowTree* tree, const int* rows, size_t count, size_t stride, size_t from)
+{
+    reserveRows(tree, count);
+    tree->count = count;
+    const char* next = (const char*)rows + stride * from;
+    for (size_t i = from + 1; i <= count; i++, next += stride) {
+        tree->sums[i] = (size_t)*(const int*)next;
+    }
+    for (size_t i = from; i > 0; i -= lowBit(i)) {
+        size_t parent = i + lowBit(i);
+        if (parent <= count) {
+            tree->sums[parent] += tree->sums[i];
+        }
+    }
+    for (size_t i = from + 1; i <= count; i++) {
+        size_t parent = i + lowBit(i);
+        if (parent <= count) {
+            tree->sums[parent] += tree->sums[i];
+        }
+    }
+}
+
+// Adds a line at the end. Its node covers the lines before it that the nodes below it cover.
+void appendRows(RowTree* tree, size_t rows)
+{
+    reserveRows(tree, tree->count + 1);
+    size_t i = ++tree->count;
+    size_t sum = rows;
+    for (size_t child = i - 1; child > i - lowBit(i); child -= lowBit(child)) {
+        sum += tree->sums[child];
+    }
+    tree->sums[i] = sum;
+}
+
+void addRows(RowTree* tree, size_t line, long delta)
+{
+    for (size_t i = line + 1; i <= tree->count; i += lowBit(i)) {
+        tree->sums[i] += (size_t)delta;
+    }
+}
+
+// Rows taken by the lines before line, the first row of line.
+size_t rowsBefore(const RowTree* tree, size_t line)
+{
+    size_t sum = 0;
+    for (size_t i = line; i > 0; i -= lowBit(i)) {
+        sum += tree->sums[i];
+    }
+    return sum;
+}
+
+// Line that row is part of and which of its rows it is. Returns count if row is past the last line.
+size_t findRow(const RowTree* tree, size_t row, size_t* rowInLine)
+{
+    size_t line = 0;
+    size_t step = 1;
+    while (step * 2 <= tree->count) {
+        step *= 2;
+    }
+    for (; step > 0; step /= 2) {
+        if (line + step <= tree->count && tree->sums[line + step] <= row) {
+            line += step;
+            row -= tree->sums[line];
+        }
+    }
+    *rowInLine = row;
+    return line;
+}
@@ -0,0 +1,25 @@
+#ifndef ROWS_H_
+#define ROWS_H_
+
+#include <stdlib.h>
+
+// How many screen rows each line takes when lines are wrapped, as a Fenwick tree so the first row
+// of a line and the line at a row are found in O(log n). Lines appended at the end are added in
+// O(log n) too, anything that shifts lines builds the tree again from the first line it moved.
+
+typedef struct {
+    // sums[i] is the number of rows of lines i - lowbit(i) .. i - 1.
+    size_t* sums;
+    size_t count;
+    size_t capacity;
+} RowTree;
+
+RowTree* createRowTree(void);
+void freeRowTree(RowTree* tree);
+void buildRowTreeFrom(RowTree* tree, const int* rows, size_t count, size_t stride, size_t from);
+void appendRows(RowTree* tree, size_t rows);
+void addRows(RowTree* tree, size_t line, long delta);
+size_t rowsBefore(const RowTree* tree, size_t line);
+size_t findRow(const RowTree* tree, size_t row, size_t* rowInLine);
+
+#endif
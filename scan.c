@@ -0,0 +1,337 @@
+#include "scan.h"
+#include <stddef.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86
+#include <immintrin.h>
+#endif
+
+static void pushNewLine(NewLineIndex* index, size_t offset)
+{
+    if (index->count == index->capacity) {
+        index->capacity = index->capacity ? index->capacity * 2 : 1024;
+        index->offsets = (size_t*)realloc(index->offsets, sizeof(size_t) * index->capacity);
+    }
+    index->offsets[index->count++] = offset;
+}
+
+static const char* findNewLineScalar(const char* start, const char* end)
+{
+    return (const char*)memchr(start, '\n', end - start);
+}
+
+static size_t countNewLinesScalar(const char* start, const char* end)
+{
+    size_t count = 0;
+    for (const char* p = start; p < end; p++) {
+        count += *p == '\n';
+    }
+    return count;
+}
+
+// Printable ASCII is 0x20 to 0x7E. Anything else is a control character, DEL or part of a multi
+// byte sequence.
+static int isSpecialByte(char c)
+{
+    return (unsigned char)c < 0x20 || (unsigned char)c >= 0x7F;
+}
+
+static const char* findSpecialByteScalar(const char* start, const char* end)
+{
+    for (const char* p = start; p < end; p++) {
+        if (isSpecialByte(*p)) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static void collectNewLinesScalar(const char* data, size_t from, size_t to, NewLineIndex* index)
+{
+    const char* end = data + to;
+    for (const char* p = data + from; (p = findNewLineScalar(p, end)) != NULL; p++) {
+        pushNewLine(index, p - data);
+    }
+}
+
+// needle is at least 2 bytes long in the literal finders, shorter ones go through memchr.
+static const char* findLiteralScalar(const char* start, const char* end, const char* needle, size_t length)
+{
+    const char* last = end - length;
+    for (const char* p = start; p <= last; p++) {
+        p = (const char*)memchr(p, needle[0], last - p + 1);
+        if (p == NULL) {
+            return NULL;
+        }
+        if (p[length - 1] == needle[length - 1] && memcmp(p + 1, needle + 1, length - 2) == 0) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+#ifdef SCAN_X86
+
+__attribute__((target("sse2")))
+static const char* findNewLineSSE2(const char* start, const char* end)
+{
+    const __m128i newLine = _mm_set1_epi8('\n');
+    const char* p = start;
+    for (; end - p >= 16; p += 16) {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), newLine));
+        if (mask != 0) {
+            return p + __builtin_ctz((unsigned int)mask);
+        }
+    }
+    return findNewLineScalar(p, end);
+}
+
+__attribute__((target("sse2")))
+static size_t countNewLinesSSE2(const char* start, const char* end)
+{
+    const __m128i newLine = _mm_set1_epi8('\n');
+    const char* p = start;
+    size_t count = 0;
+    for (; end - p >= 16; p += 16) {
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), newLine));
+        count += __builtin_popcount((unsigned int)mask);
+    }
+    return count + countNewLinesScalar(p, end);
+}
+
+__attribute__((target("sse2")))
+static void collectNewLinesSSE2(const char* data, size_t from, size_t to, NewLineIndex* index)
+{
+    const __m128i newLine = _mm_set1_epi8('\n');
+    const char* p = data + from;
+    const char* end = data + to;
+    for (; end - p >= 16; p += 16) {
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)p), newLine));
+        while (mask != 0) {
+            pushNewLine(index, (p - data) + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    collectNewLinesScalar(data, p - data, to, index);
+}
+
+// Signed compares: bytes from 0x80 up are negative, so one less-than catches them together with the
+// control characters.
+__attribute__((target("sse2")))
+static const char* findSpecialByteSSE2(const char* start, const char* end)
+{
+    const __m128i space = _mm_set1_epi8(0x20);
+    const __m128i del = _mm_set1_epi8(0x7F);
+    const char* p = start;
+    for (; end - p >= 16; p += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i*)p);
+        int mask = _mm_movemask_epi8(_mm_or_si128(_mm_cmplt_epi8(bytes, space), _mm_cmpeq_epi8(bytes, del)));
+        if (mask != 0) {
+            return p + __builtin_ctz((unsigned int)mask);
+        }
+    }
+    return findSpecialByteScalar(p, end);
+}
+
+// Compares a block against the first byte of the needle and the block length - 1 bytes on against
+// the last byte. Only where both match is the rest of the needle compared.
+__attribute__((target("sse2")))
+static const char* findLiteralSSE2(const char* start, const char* end, const char* needle, size_t length)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[length - 1]);
+    const char* p = start;
+    for (; end - p >= (ptrdiff_t)(length - 1 + 16); p += 16) {
+        __m128i firstBytes = _mm_loadu_si128((const __m128i*)p);
+        __m128i lastBytes = _mm_loadu_si128((const __m128i*)(p + length - 1));
+        unsigned int mask = (unsigned int)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(firstBytes, first), _mm_cmpeq_epi8(lastBytes, last)));
+        while (mask != 0) {
+            const char* candidate = p + __builtin_ctz(mask);
+            if (memcmp(candidate + 1, needle + 1, length - 2) == 0) {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return findLiteralScalar(p, end, needle, length);
+}
+
+__attribute__((target("avx2")))
+static const char* findNewLineAVX2(const char* start, const char* end)
+{
+    const __m256i newLine = _mm256_set1_epi8('\n');
+    const char* p = start;
+    for (; end - p >= 32; p += 32) {
+        int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), newLine));
+        if (mask != 0) {
+            return p + __builtin_ctz((unsigned int)mask);
+        }
+    }
+    return findNewLineScalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static size_t countNewLinesAVX2(const char* start, const char* end)
+{
+    const __m256i newLine = _mm256_set1_epi8('\n');
+    const char* p = start;
+    size_t count = 0;
+    for (; end - p >= 32; p += 32) {
+        int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), newLine));
+        count += __builtin_popcount((unsigned int)mask);
+    }
+    return count + countNewLinesScalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static void collectNewLinesAVX2(const char* data, size_t from, size_t to, NewLineIndex* index)
+{
+    const __m256i newLine = _mm256_set1_epi8('\n');
+    const char* p = data + from;
+    const char* end = data + to;
+    for (; end - p >= 32; p += 32) {
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)p), newLine));
+        while (mask != 0) {
+            pushNewLine(index, (p - data) + __builtin_ctz(mask));
+            mask &= mask - 1;
+        }
+    }
+    collectNewLinesScalar(data, p - data, to, index);
+}
+
+__attribute__((target("avx2")))
+static const char* findSpecialByteAVX2(const char* start, const char* end)
+{
+    const __m256i space = _mm256_set1_epi8(0x20);
+    const __m256i del = _mm256_set1_epi8(0x7F);
+    const char* p = start;
+    for (; end - p >= 32; p += 32) {
+        __m256i bytes = _mm256_loadu_si256((const __m256i*)p);
+        int mask = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpgt_epi8(space, bytes), _mm256_cmpeq_epi8(bytes, del)));
+        if (mask != 0) {
+            return p + __builtin_ctz((unsigned int)mask);
+        }
+    }
+    return findSpecialByteScalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static const char* findLiteralAVX2(const char* start, const char* end, const char* needle, size_t length)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[length - 1]);
+    const char* p = start;
+    for (; end - p >= (ptrdiff_t)(length - 1 + 32); p += 32) {
+        __m256i firstBytes = _mm256_loadu_si256((const __m256i*)p);
+        __m256i lastBytes = _mm256_loadu_si256((const __m256i*)(p + length - 1));
+        unsigned int mask = (unsigned int)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(firstBytes, first), _mm256_cmpeq_epi8(lastBytes, last)));
+        while (mask != 0) {
+            const char* candidate = p + __builtin_ctz(mask);
+            if (memcmp(candidate + 1, needle + 1, length - 2) == 0) {
+                return candidate;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return findLiteralScalar(p, end, needle, length);
+}
+
+#endif
+
+// Start out with the plain versions so the scanner works even if initScanner was never called.
+static const char* (*findImpl)(const char*, const char*) = findNewLineScalar;
+static size_t (*countImpl)(const char*, const char*) = countNewLinesScalar;
+static void (*collectImpl)(const char*, size_t, size_t, NewLineIndex*) = collectNewLinesScalar;
+static const char* (*specialImpl)(const char*, const char*) = findSpecialByteScalar;
+static const char* (*literalImpl)(const char*, const char*, const char*, size_t) = findLiteralScalar;
+
+// Picks the widest instruction set the CPU supports. Call once at startup before any threads run.
+void initScanner(void)
+{
+    if (!useScanLevel(SCAN_AVX2)) {
+        useScanLevel(SCAN_SSE2);
+    }
+}
+
+// Switches every scan to the versions for level, as long as the CPU supports it. Returns 0 and
+// leaves the scanner as it was otherwise. Like initScanner, only while no other thread scans.
+int useScanLevel(ScanLevel level)
+{
+    if (level == SCAN_PLAIN) {
+        findImpl = findNewLineScalar;
+        countImpl = countNewLinesScalar;
+        collectImpl = collectNewLinesScalar;
+        specialImpl = findSpecialByteScalar;
+        literalImpl = findLiteralScalar;
+        return 1;
+    }
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (level == SCAN_AVX2 && __builtin_cpu_supports("avx2")) {
+        findImpl = findNewLineAVX2;
+        countImpl = countNewLinesAVX2;
+        collectImpl = collectNewLinesAVX2;
+        specialImpl = findSpecialByteAVX2;
+        literalImpl = findLiteralAVX2;
+        return 1;
+    }
+    if (level == SCAN_SSE2 && __builtin_cpu_supports("sse2")) {
+        findImpl = findNewLineSSE2;
+        countImpl = countNewLinesSSE2;
+        collectImpl = collectNewLinesSSE2;
+        specialImpl = findSpecialByteSSE2;
+        literalImpl = findLiteralSSE2;
+        return 1;
+    }
+#endif
+    return 0;
+}
+
+// Returns the first newline in [start, end) or NULL.
+const char* findNewLine(const char* start, const char* end)
+{
+    return findImpl(start, end);
+}
+
+size_t countNewLines(const char* start, const char* end)
+{
+    return countImpl(start, end);
+}
+
+// Appends the offset (relative to data) of every newline in data[from, to) to index.
+void collectNewLines(const char* data, size_t from, size_t to, NewLineIndex* index)
+{
+    collectImpl(data, from, to, index);
+}
+
+// Returns the first byte in [start, end) that is not printable ASCII or NULL.
+const char* findSpecialByte(const char* start, const char* end)
+{
+    return specialImpl(start, end);
+}
+
+// Returns the first occurrence of needle in [start, end) or NULL. An empty needle is found at start.
+const char* findLiteral(const char* start, const char* end, const char* needle, size_t length)
+{
+    if (length == 0) {
+        return start;
+    }
+    if ((size_t)(end - start) < length) {
+        return NULL;
+    }
+    if (length == 1) {
+        return (const char*)memchr(start, needle[0], end - start);
+    }
+    return literalImpl(start, end, needle, length);
+}
+
+void freeNewLineIndex(NewLineIndex* index)
+{
+    free(index->offsets);
+    index->offsets = NULL;
+    index->count = 0;
+    index->capacity = 0;
+}
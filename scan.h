@@ -0,0 +1,30 @@
+#ifndef SCAN_H_
+#define SCAN_H_
+
+#include <stdlib.h>
+
+// Newline scanning with SSE2 or AVX2, picked at runtime, and a plain fallback elsewhere. The same
+// goes for finding the end of a run of printable ASCII and for finding a literal string.
+
+typedef struct {
+    size_t* offsets;
+    size_t count;
+    size_t capacity;
+} NewLineIndex;
+
+typedef enum {
+    SCAN_PLAIN,
+    SCAN_SSE2,
+    SCAN_AVX2
+} ScanLevel;
+
+void initScanner(void);
+int useScanLevel(ScanLevel level);
+const char* findNewLine(const char* start, const char* end);
+size_t countNewLines(const char* start, const char* end);
+void collectNewLines(const char* data, size_t from, size_t to, NewLineIndex* index);
+const char* findSpecialByte(const char* start, const char* end);
+const char* findLiteral(const char* start, const char* end, const char* needle, size_t length);
+void freeNewLineIndex(NewLineIndex* index);
+
+#endif
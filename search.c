@@ -0,0 +1,175 @@
+#include "search.h"
+#include "scan.h"
+#include <string.h>
+
+#define MIN_MATCHES 64
+// Needles longer than this can not be checked around the gap without copying, they are compared
+// byte by byte there instead.
+#define GAP_WINDOW 256
+
+// Byte at index of a line, on either side of the gap.
+static char lineByte(const LineSpan* line, size_t index)
+{
+    return index < line->beforeLength ? line->before[index] : line->after[index - line->beforeLength];
+}
+
+static int matchesAt(const LineSpan* line, size_t index, const char* needle, size_t length)
+{
+    for (size_t i = 0; i < length; i++) {
+        if (lineByte(line, index + i) != needle[i]) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// First match that starts in [from, to) and has part of it on both sides of the gap.
+static int findAcrossGap(const LineSpan* line, size_t from, size_t to, const char* needle, size_t length,
+                         size_t* index)
+{
+    if (length > GAP_WINDOW) {
+        // A match has to end by the end of the line.
+        size_t last = line->beforeLength + line->afterLength - length + 1;
+        to = to < last ? to : last;
+        for (size_t i = from; i < to; i++) {
+            if (matchesAt(line, i, needle, length)) {
+                *index = i;
+                return 1;
+            }
+        }
+        return 0;
+    }
+    char window[2 * GAP_WINDOW];
+    size_t before = line->beforeLength - from;
+    size_t after = line->afterLength < length - 1 ? line->afterLength : length - 1;
+    memcpy(window, line->before + from, before);
+    memcpy(window + before, line->after, after);
+    const char* found = findLiteral(window, window + before + after, needle, length);
+    if (found == NULL || (size_t)(found - window) >= to - from) {
+        return 0;
+    }
+    *index = from + (found - window);
+    return 1;
+}
+
+// First match in a line that starts at or after from.
+int findInLine(Text* text, size_t line, size_t from, const char* needle, size_t length, size_t* index)
+{
+    LineSpan span = getLineSpan(text, line);
+    size_t total = span.beforeLength + span.afterLength;
+    if (length == 0 || from + length > total) {
+        return 0;
+    }
+
+    // Matches that end before the gap.
+    if (from < span.beforeLength) {
+        const char* found = findLiteral(span.before + from, span.before + span.beforeLength, needle, length);
+        if (found != NULL) {
+            *index = found - span.before;
+            return 1;
+        }
+    }
+    // Matches that start before the gap and end after it.
+    if (span.beforeLength > 0 && span.afterLength > 0) {
+        size_t start = span.beforeLength >= length - 1 ? span.beforeLength - (length - 1) : 0;
+        start = start > from ? start : from;
+        if (start < span.beforeLength && findAcrossGap(&span, start, span.beforeLength, needle, length, index)) {
+            return 1;
+        }
+    }
+    // Matches after the gap.
+    size_t after = from > span.beforeLength ? from - span.beforeLength : 0;
+    const char* found = findLiteral(span.after + after, span.after + span.afterLength, needle, length);
+    if (found != NULL) {
+        *index = span.beforeLength + (found - span.after);
+        return 1;
+    }
+    return 0;
+}
+
+// First match at or after from, going on from the top of the text after the last line. The line
+// from is on is searched again from its start last, so a match before from is found too.
+int findNextMatch(Text* text, TextPosition from, const char* needle, size_t length, Match* match)
+{
+    if (text->lineCount == 0 || length == 0) {
+        return 0;
+    }
+    for (size_t i = 0; i <= text->lineCount; i++) {
+        size_t line = (from.line + i) % text->lineCount;
+        size_t start = i == 0 ? from.index : 0;
+        size_t index;
+        if (findInLine(text, line, start, needle, length, &index)) {
+            match->start = (TextPosition){.line = line, .index = index};
+            match->end = (TextPosition){.line = line, .index = index + length};
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void addMatch(MatchList* list, Match match)
+{
+    if (list->count == list->capacity) {
+        list->capacity = list->capacity == 0 ? MIN_MATCHES : list->capacity * 2;
+        list->matches = (Match*)realloc(list->matches, sizeof(Match) * list->capacity);
+    }
+    list->matches[list->count++] = match;
+}
+
+// Every match on the lines in [first, last), for the lines on screen.
+void collectMatches(Text* text, size_t first, size_t last, const char* needle, size_t length, MatchList* list)
+{
+    list->count = 0;
+    if (length == 0) {
+        return;
+    }
+    last = last < text->lineCount ? last : text->lineCount;
+    for (size_t line = first; line < last; line++) {
+        size_t index = 0;
+        while (findInLine(text, line, index, needle, length, &index)) {
+            Match match = {.start = {.line = line, .index = index}, .end = {.line = line, .index = index + length}};
+            addMatch(list, match);
+            index += length;
+        }
+    }
+}
+
+// Index of the first match in a sorted list that is on line or after it.
+size_t firstMatchFrom(const MatchList* list, size_t line)
+{
+    size_t low = 0;
+    size_t high = list->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (list->matches[middle].start.line < line) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// First match in a sorted list that starts at or after from, going on from the first one after the
+// last. Returns 0 if the list is empty.
+int nextMatchInList(const MatchList* list, TextPosition from, Match* match)
+{
+    if (list->count == 0) {
+        return 0;
+    }
+    size_t i = firstMatchFrom(list, from.line);
+    while (i < list->count && comparePositions(list->matches[i].start, from) < 0) {
+        i++;
+    }
+    *match = list->matches[i < list->count ? i : 0];
+    return 1;
+}
+
+void freeMatchList(MatchList* list)
+{
+    free(list->matches);
+    list->matches = NULL;
+    list->count = 0;
+    list->capacity = 0;
+}
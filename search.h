@@ -0,0 +1,30 @@
+#ifndef SEARCH_H_
+#define SEARCH_H_
+
+#include "line.h"
+#include "selection.h"
+
+// Finding a literal string in the text. Lines are searched one at a time as the runs before and
+// after their gap, with the few bytes around the gap checked on their own, so nothing is copied. A
+// match never goes over a line break.
+
+typedef struct {
+    TextPosition start;
+    TextPosition end;
+} Match;
+
+typedef struct {
+    Match* matches;
+    size_t count;
+    size_t capacity;
+} MatchList;
+
+int findInLine(Text* text, size_t line, size_t from, const char* needle, size_t length, size_t* index);
+int findNextMatch(Text* text, TextPosition from, const char* needle, size_t length, Match* match);
+void addMatch(MatchList* list, Match match);
+void collectMatches(Text* text, size_t first, size_t last, const char* needle, size_t length, MatchList* list);
+size_t firstMatchFrom(const MatchList* list, size_t line);
+int nextMatchInList(const MatchList* list, TextPosition from, Match* match);
+void freeMatchList(MatchList* list);
+
+#endif
@@ -0,0 +1,159 @@
+#include "selection.h"
+#include <string.h>
+
+#define MIN_RANGES 8
+
+int comparePositions(TextPosition a, TextPosition b)
+{
+    if (a.line != b.line) {
+        return a.line < b.line ? -1 : 1;
+    }
+    if (a.index != b.index) {
+        return a.index < b.index ? -1 : 1;
+    }
+    return 0;
+}
+
+// Index of the first range that ends at or after pos.
+static size_t rangeAfter(const Selection* selection, TextPosition pos)
+{
+    size_t low = 0;
+    size_t high = selection->count;
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if (comparePositions(selection->ranges[middle].end, pos) < 0) {
+            low = middle + 1;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static void removeRange(Selection* selection, size_t index)
+{
+    memmove(selection->ranges + index, selection->ranges + index + 1,
+            sizeof(SelectionRange) * (selection->count - index - 1));
+    selection->count--;
+}
+
+// Adds start..end, merged with every range it overlaps or touches. Returns where it ended up.
+static size_t insertRange(Selection* selection, TextPosition start, TextPosition end)
+{
+    size_t first = rangeAfter(selection, start);
+    size_t last = first;
+    while (last < selection->count && comparePositions(selection->ranges[last].start, end) <= 0) {
+        if (comparePositions(selection->ranges[last].end, end) > 0) {
+            end = selection->ranges[last].end;
+        }
+        last++;
+    }
+    if (first < last && comparePositions(selection->ranges[first].start, start) < 0) {
+        start = selection->ranges[first].start;
+    }
+
+    if (first == last) {
+        if (selection->count == selection->capacity) {
+            selection->capacity = selection->capacity == 0 ? MIN_RANGES : selection->capacity * 2;
+            selection->ranges =
+                (SelectionRange*)realloc(selection->ranges, sizeof(SelectionRange) * selection->capacity);
+        }
+        memmove(selection->ranges + first + 1, selection->ranges + first,
+                sizeof(SelectionRange) * (selection->count - first));
+        selection->count++;
+    }
+    else if (last - first > 1) {
+        memmove(selection->ranges + first + 1, selection->ranges + last,
+                sizeof(SelectionRange) * (selection->count - last));
+        selection->count -= last - first - 1;
+    }
+    selection->ranges[first] = (SelectionRange){.start = start, .end = end};
+    return first;
+}
+
+void freeSelection(Selection* selection)
+{
+    free(selection->ranges);
+    selection->ranges = NULL;
+    selection->count = 0;
+    selection->capacity = 0;
+    selection->anchored = 0;
+}
+
+void clearSelection(Selection* selection)
+{
+    selection->count = 0;
+    selection->anchored = 0;
+    selection->active = 0;
+}
+
+int selectionEmpty(const Selection* selection)
+{
+    return selection->count == 0;
+}
+
+// Whether a range is being made and has something in it.
+int selectionExtending(const Selection* selection)
+{
+    return selection->anchored && selection->active < selection->count;
+}
+
+// Starts a new range at at. Unless keepRanges is set the ranges selected so far are dropped.
+void startSelection(Selection* selection, TextPosition at, int keepRanges)
+{
+    if (!keepRanges) {
+        selection->count = 0;
+    }
+    selection->anchored = 1;
+    selection->anchor = at;
+    selection->head = at;
+    selection->active = selection->count;
+}
+
+// Moves the loose end of the range being made to head.
+void extendSelection(Selection* selection, TextPosition head)
+{
+    if (!selection->anchored) {
+        startSelection(selection, head, 0);
+        return;
+    }
+    if (selection->active < selection->count) {
+        removeRange(selection, selection->active);
+    }
+    selection->head = head;
+    int order = comparePositions(selection->anchor, head);
+    if (order == 0) {
+        selection->active = selection->count;
+    }
+    else if (order < 0) {
+        selection->active = insertRange(selection, selection->anchor, head);
+    }
+    else {
+        selection->active = insertRange(selection, head, selection->anchor);
+    }
+}
+
+void selectRange(Selection* selection, TextPosition start, TextPosition end)
+{
+    startSelection(selection, start, 0);
+    extendSelection(selection, end);
+}
+
+// Start of the first range. Only valid if the selection is not empty.
+TextPosition selectionStart(const Selection* selection)
+{
+    return selection->ranges[0].start;
+}
+
+// End of the last range. Only valid if the selection is not empty.
+TextPosition selectionEnd(const Selection* selection)
+{
+    return selection->ranges[selection->count - 1].end;
+}
+
+// Index of the first range that reaches line, count if there is none.
+size_t firstRangeFrom(const Selection* selection, size_t line)
+{
+    return rangeAfter(selection, (TextPosition){.line = line, .index = 0});
+}
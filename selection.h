@@ -0,0 +1,44 @@
+#ifndef SELECTION_H_
+#define SELECTION_H_
+
+#include <stdlib.h>
+
+// Selected text as sorted ranges that neither overlap nor touch, each with its start before its end.
+// Drawing and copying look ranges up by line, so they only cost as much as the part that is used.
+
+typedef struct {
+    size_t line;
+    size_t index;
+} TextPosition;
+
+typedef struct {
+    TextPosition start;
+    TextPosition end;
+} SelectionRange;
+
+typedef struct {
+    SelectionRange* ranges;
+    size_t count;
+    size_t capacity;
+    // The range being made, from the anchor to where it was last extended. It is stored with the
+    // others once it is not empty, active is its index then and count otherwise. Ranges it runs
+    // into are merged into it.
+    int anchored;
+    TextPosition anchor;
+    TextPosition head;
+    size_t active;
+} Selection;
+
+int comparePositions(TextPosition a, TextPosition b);
+void freeSelection(Selection* selection);
+void clearSelection(Selection* selection);
+int selectionEmpty(const Selection* selection);
+int selectionExtending(const Selection* selection);
+void startSelection(Selection* selection, TextPosition at, int keepRanges);
+void extendSelection(Selection* selection, TextPosition head);
+void selectRange(Selection* selection, TextPosition start, TextPosition end);
+TextPosition selectionStart(const Selection* selection);
+TextPosition selectionEnd(const Selection* selection);
+size_t firstRangeFrom(const Selection* selection, size_t line);
+
+#endif
@@ -0,0 +1,385 @@
+#include "undo.h"
+#include "varint.h"
+#include <string.h>
+
+#define MIN_UNDO_LOG (64 * 1024)
+// Typing and backspacing grow one record up to this many bytes.
+#define UNDO_COALESCE_BYTES 4096
+// Set on the op byte of a record that is undone together with the one before it.
+#define UNDO_LINKED 0x40
+#define MAX_UNDO_HEADER (1 + 3 * MAX_VARINT)
+
+struct UndoLog {
+    unsigned char* bytes;
+    size_t length;
+    size_t capacity;
+    size_t done;
+    size_t budget;
+    // The last record while typing may still grow it. It goes into the log before anything else.
+    int pendingOp;
+    size_t pendingLine;
+    size_t pendingPos;
+    char* pendingText;
+    size_t pendingLength;
+    size_t pendingCapacity;
+    // Records after the first one of a group are linked to the one before. groupStart is where the
+    // first one is while the group is open. A group that alone outgrows the budget is dropped, and
+    // its edits can not be undone.
+    int groupDepth;
+    int groupStarted;
+    size_t groupStart;
+    int groupDropped;
+};
+
+typedef struct {
+    int op;
+    int linked;
+    size_t line;
+    size_t linePos;
+    const char* data;
+    size_t length;
+    size_t start;
+    size_t end;
+} UndoRecord;
+
+UndoLog* createUndoLog(size_t budget)
+{
+    UndoLog* log = (UndoLog*)calloc(1, sizeof(UndoLog));
+    log->budget = budget;
+    return log;
+}
+
+void freeUndoLog(UndoLog* log)
+{
+    if (log == NULL) {
+        return;
+    }
+    free(log->bytes);
+    free(log->pendingText);
+    free(log);
+}
+
+static void readRecord(const UndoLog* log, size_t start, UndoRecord* record)
+{
+    const unsigned char* first = log->bytes + start;
+    const unsigned char* end = log->bytes + log->length;
+    const unsigned char* p = first;
+    record->op = *p & ~UNDO_LINKED;
+    record->linked = (*p & UNDO_LINKED) != 0;
+    p++;
+    p += getVarint(p, end, &record->line);
+    p += getVarint(p, end, &record->linePos);
+    p += getVarint(p, end, &record->length);
+    record->data = (const char*)p;
+    size_t body = (size_t)(p - first) + record->length;
+    unsigned char size[MAX_VARINT];
+    record->start = start;
+    record->end = start + body + putVarint(size, body);
+}
+
+// The size behind a record is its varint with the bytes in reverse, so its last byte is read first.
+static void readRecordBefore(const UndoLog* log, size_t end, UndoRecord* record)
+{
+    size_t body = 0;
+    int shift = 0;
+    unsigned char byte;
+    do {
+        byte = log->bytes[--end];
+        body |= (size_t)(byte & 0x7f) << shift;
+        shift += 7;
+    } while (byte & 0x80);
+    readRecord(log, end - body, record);
+}
+
+// Drops the oldest groups until incoming more bytes fit. It drops down to three quarters of the
+// budget, so the log is not moved on every edit once it is full. A record larger than the budget is
+// still kept, on its own. The open group is never cut into. If it does not fit in the budget by
+// itself it is dropped as a whole, and 0 is returned to not add the incoming record to it.
+static int trimLog(UndoLog* log, size_t incoming)
+{
+    if (log->length + incoming <= log->budget) {
+        return 1;
+    }
+    int grouped = log->groupDepth > 0 && log->groupStarted;
+    size_t limit = grouped ? log->groupStart : log->length;
+    size_t target = log->budget / 4 * 3;
+    size_t cut = 0;
+    UndoRecord record;
+    while (cut < limit && log->length - cut + incoming > target) {
+        readRecord(log, cut, &record);
+        cut = record.end;
+        while (cut < limit) {
+            readRecord(log, cut, &record);
+            if (!record.linked) {
+                break;
+            }
+            cut = record.end;
+        }
+    }
+    if (grouped && log->length - cut + incoming > log->budget) {
+        log->length = 0;
+        log->done = 0;
+        log->groupDropped = 1;
+        return 0;
+    }
+    memmove(log->bytes, log->bytes + cut, log->length - cut);
+    log->length -= cut;
+    log->done = log->done > cut ? log->done - cut : 0;
+    log->groupStart = log->groupStart > cut ? log->groupStart - cut : 0;
+    return 1;
+}
+
+// Appends a record with room for length bytes of text. Returns where the text goes, or NULL if the
+// record was dropped with its group.
+static char* appendRecord(UndoLog* log, int op, size_t line, size_t linePos, size_t length)
+{
+    unsigned char header[MAX_UNDO_HEADER];
+    size_t headerLength = 0;
+    header[headerLength++] = (unsigned char)op;
+    headerLength += putVarint(header + headerLength, line);
+    headerLength += putVarint(header + headerLength, linePos);
+    headerLength += putVarint(header + headerLength, length);
+    size_t body = headerLength + length;
+    unsigned char size[MAX_VARINT];
+    size_t sizeLength = putVarint(size, body);
+
+    if (!trimLog(log, body + sizeLength)) {
+        return NULL;
+    }
+    if (log->length + body + sizeLength > log->capacity) {
+        size_t capacity = log->capacity == 0 ? MIN_UNDO_LOG : log->capacity * 2;
+        while (capacity < log->length + body + sizeLength) {
+            capacity *= 2;
+        }
+        log->bytes = (unsigned char*)realloc(log->bytes, capacity);
+        log->capacity = capacity;
+    }
+    unsigned char* record = log->bytes + log->length;
+    memcpy(record, header, headerLength);
+    for (size_t i = 0; i < sizeLength; i++) {
+        record[body + i] = size[sizeLength - 1 - i];
+    }
+    log->length += body + sizeLength;
+    log->done = log->length;
+    return (char*)record + headerLength;
+}
+
+static void flushPending(UndoLog* log)
+{
+    if (log->pendingOp == 0) {
+        return;
+    }
+    char* text = appendRecord(log, log->pendingOp, log->pendingLine, log->pendingPos, log->pendingLength);
+    if (text != NULL) {
+        memcpy(text, log->pendingText, log->pendingLength);
+    }
+    log->pendingOp = 0;
+    log->pendingLength = 0;
+}
+
+static void reservePending(UndoLog* log, size_t length)
+{
+    if (length > log->pendingCapacity) {
+        log->pendingCapacity = length < 64 ? 64 : length * 2;
+        log->pendingText = (char*)realloc(log->pendingText, log->pendingCapacity);
+    }
+}
+
+// Typing goes on at the end of the pending insert, a backspace right in front of a pending delete.
+static int mergePending(UndoLog* log, UndoOp op, size_t line, size_t linePos, const char* data, size_t length)
+{
+    if (log->pendingOp != (int)op || log->pendingLine != line ||
+        log->pendingLength + length > UNDO_COALESCE_BYTES || memchr(data, '\n', length) != NULL) {
+        return 0;
+    }
+    if (op == UNDO_INSERT && linePos == log->pendingPos + log->pendingLength) {
+        reservePending(log, log->pendingLength + length);
+        memcpy(log->pendingText + log->pendingLength, data, length);
+    }
+    else if (op == UNDO_DELETE && linePos + length == log->pendingPos) {
+        reservePending(log, log->pendingLength + length);
+        memmove(log->pendingText + length, log->pendingText, log->pendingLength);
+        memcpy(log->pendingText, data, length);
+        log->pendingPos = linePos;
+    }
+    else {
+        return 0;
+    }
+    log->pendingLength += length;
+    return 1;
+}
+
+static int nextLinked(UndoLog* log)
+{
+    if (log->groupDepth == 0) {
+        return 0;
+    }
+    if (log->groupStarted) {
+        return UNDO_LINKED;
+    }
+    log->groupStarted = 1;
+    log->groupStart = log->length;
+    return 0;
+}
+
+// Records an edit that is about to be made. A new edit cuts off everything that was undone.
+void undoRecord(UndoLog* log, UndoOp op, size_t line, size_t linePos, const char* data, size_t length)
+{
+    log->length = log->done;
+    if (log->groupDropped) {
+        return;
+    }
+    if (length > 0 && mergePending(log, op, line, linePos, data, length)) {
+        return;
+    }
+    flushPending(log);
+    int linked = nextLinked(log);
+    if ((op == UNDO_INSERT || op == UNDO_DELETE) && !linked && log->groupDepth == 0 && length > 0 &&
+        length <= UNDO_COALESCE_BYTES && memchr(data, '\n', length) == NULL) {
+        reservePending(log, length);
+        memcpy(log->pendingText, data, length);
+        log->pendingOp = op;
+        log->pendingLine = line;
+        log->pendingPos = linePos;
+        log->pendingLength = length;
+        return;
+    }
+    char* text = appendRecord(log, op | linked, line, linePos, length);
+    if (text != NULL && length > 0) {
+        memcpy(text, data, length);
+    }
+}
+
+// Records an edit whose text the caller copies into the returned space right away, so large
+// deletes are copied once. Returns NULL if the edit is not recorded, its group was dropped.
+char* undoReserve(UndoLog* log, UndoOp op, size_t line, size_t linePos, size_t length)
+{
+    log->length = log->done;
+    if (log->groupDropped) {
+        return NULL;
+    }
+    flushPending(log);
+    return appendRecord(log, op | nextLinked(log), line, linePos, length);
+}
+
+// Typing after this starts a new record, e.g. once the cursor was moved.
+void undoBreak(UndoLog* log)
+{
+    if (log == NULL) {
+        return;
+    }
+    flushPending(log);
+}
+
+void beginUndoGroup(UndoLog* log)
+{
+    if (log == NULL) {
+        return;
+    }
+    flushPending(log);
+    if (log->groupDepth++ == 0) {
+        log->groupStarted = 0;
+    }
+}
+
+void endUndoGroup(UndoLog* log)
+{
+    if (log == NULL) {
+        return;
+    }
+    if (--log->groupDepth == 0) {
+        log->groupDropped = 0;
+    }
+}
+
+// Undoes or redoes one record through the same edits the editor makes, so they are journaled like
+// any other. Returns where the cursor goes.
+static TextPosition applyRecord(Text* text, const UndoRecord* record, int undo)
+{
+    size_t line = record->line;
+    size_t linePos = record->linePos;
+    switch (record->op) {
+    case UNDO_INSERT:
+    case UNDO_DELETE:
+        if ((record->op == UNDO_INSERT) == undo) {
+            deleteText(text, line, linePos, record->length);
+        }
+        else {
+            insertTextOnLine(text, &line, &linePos, record->data, record->length);
+        }
+        break;
+    case UNDO_SPLIT:
+        if (undo) {
+            deleteLine(text, line + 1, 0);
+        }
+        else {
+            createNewLine(text, line + 1, linePos);
+            line++;
+            linePos = 0;
+        }
+        break;
+    case UNDO_JOIN:
+        // The bytes the join dropped from the start of the lower line come back with it.
+        if (undo) {
+            createNewLine(text, line + 1, linePos);
+            if (record->length > 0) {
+                insertOnLine(text, (int)line + 1, 0, record->data, record->length);
+            }
+            line++;
+            linePos = 0;
+        }
+        else {
+            deleteLine(text, line + 1, record->length);
+        }
+        break;
+    case UNDO_REPLACE:
+        applyReplacement(text, record->data, record->length, undo);
+        linePos = 0;
+        break;
+    }
+    return (TextPosition){.line = line, .index = linePos};
+}
+
+// Undoes the last edit, with every record of its group. Returns 0 if there is nothing to undo.
+int undoEdit(Text* text, TextPosition* cursor)
+{
+    UndoLog* log = text->undo;
+    if (log == NULL) {
+        return 0;
+    }
+    flushPending(log);
+    if (log->done == 0) {
+        return 0;
+    }
+    // Nothing the undo does is recorded.
+    text->undo = NULL;
+    UndoRecord record;
+    do {
+        readRecordBefore(log, log->done, &record);
+        *cursor = applyRecord(text, &record, 1);
+        log->done = record.start;
+    } while (record.linked && log->done > 0);
+    text->undo = log;
+    return 1;
+}
+
+// Does the last undone edit again. Returns 0 if there is nothing to redo.
+int redoEdit(Text* text, TextPosition* cursor)
+{
+    UndoLog* log = text->undo;
+    if (log == NULL || log->done == log->length) {
+        return 0;
+    }
+    text->undo = NULL;
+    UndoRecord record;
+    readRecord(log, log->done, &record);
+    do {
+        *cursor = applyRecord(text, &record, 0);
+        log->done = record.end;
+        if (log->done < log->length) {
+            readRecord(log, log->done, &record);
+        }
+    } while (log->done < log->length && record.linked);
+    text->undo = log;
+    return 1;
+}
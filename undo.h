@@ -0,0 +1,33 @@
+#ifndef UNDO_H_
+#define UNDO_H_
+
+#include "line.h"
+#include "selection.h"
+
+// Undo history as one append-only byte log. A record is its op, line and position as varints and
+// the text it inserted or removed inline, followed by its size stored back to front so the log can
+// be walked from either end. Records before the done mark are applied, the ones after it were
+// undone and are redone from there until the next edit cuts them off. Consecutive typing or
+// backspacing on a line grows one record. Records in a group carry a flag that ties them to the
+// one before, so a paste or a replace is undone at once. Once the log is over its budget the oldest
+// groups are dropped.
+
+typedef enum {
+    UNDO_INSERT = 1,
+    UNDO_DELETE,
+    UNDO_SPLIT,
+    UNDO_JOIN,
+    UNDO_REPLACE
+} UndoOp;
+
+UndoLog* createUndoLog(size_t budget);
+void freeUndoLog(UndoLog* log);
+void undoRecord(UndoLog* log, UndoOp op, size_t line, size_t linePos, const char* data, size_t length);
+char* undoReserve(UndoLog* log, UndoOp op, size_t line, size_t linePos, size_t length);
+void undoBreak(UndoLog* log);
+void beginUndoGroup(UndoLog* log);
+void endUndoGroup(UndoLog* log);
+int undoEdit(Text* text, TextPosition* cursor);
+int redoEdit(Text* text, TextPosition* cursor);
+
+#endif
@@ -0,0 +1,59 @@
+#include "utf8.h"
+
+int isContinuationByte(char c)
+{
+    return ((unsigned char)c & 0xC0) == 0x80;
+}
+
+// Decodes the code point at string and stores how many bytes it took in length. Malformed or cut
+// off sequences decode as one replacement character per byte so every byte is drawn as something.
+uint32_t decodeUtf8(const char* string, const char* end, size_t* length)
+{
+    const unsigned char* s = (const unsigned char*)string;
+    unsigned char lead = s[0];
+    if (lead < 0x80) {
+        *length = 1;
+        return lead;
+    }
+
+    size_t count;
+    uint32_t codepoint;
+    uint32_t minimum;
+    if ((lead & 0xE0) == 0xC0) {
+        count = 2;
+        codepoint = lead & 0x1F;
+        minimum = 0x80;
+    }
+    else if ((lead & 0xF0) == 0xE0) {
+        count = 3;
+        codepoint = lead & 0x0F;
+        minimum = 0x800;
+    }
+    else if ((lead & 0xF8) == 0xF0) {
+        count = 4;
+        codepoint = lead & 0x07;
+        minimum = 0x10000;
+    }
+    else {
+        *length = 1;
+        return REPLACEMENT_CHAR;
+    }
+
+    if ((size_t)(end - string) < count) {
+        *length = 1;
+        return REPLACEMENT_CHAR;
+    }
+    for (size_t i = 1; i < count; i++) {
+        if (!isContinuationByte(string[i])) {
+            *length = 1;
+            return REPLACEMENT_CHAR;
+        }
+        codepoint = (codepoint << 6) | (s[i] & 0x3F);
+    }
+    if (codepoint < minimum || codepoint > 0x10FFFF || (codepoint >= 0xD800 && codepoint <= 0xDFFF)) {
+        *length = 1;
+        return REPLACEMENT_CHAR;
+    }
+    *length = count;
+    return codepoint;
+}
@@ -0,0 +1,15 @@
+#ifndef UTF8_H_
+#define UTF8_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+// Text is stored as UTF-8 bytes, positions in a line are byte offsets that always sit on a code
+// point boundary.
+
+#define REPLACEMENT_CHAR 0xFFFD
+
+uint32_t decodeUtf8(const char* string, const char* end, size_t* length);
+int isContinuationByte(char c);
+
+#endif
@@ -0,0 +1,28 @@
+#include "varint.h"
+
+// Returns the bytes written, at most MAX_VARINT.
+size_t putVarint(unsigned char* out, size_t value)
+{
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    out[length++] = (unsigned char)value;
+    return length;
+}
+
+// Returns the bytes read, 0 if the varint runs past end.
+size_t getVarint(const unsigned char* in, const unsigned char* end, size_t* value)
+{
+    size_t result = 0;
+    int shift = 0;
+    for (const unsigned char* p = in; p < end && shift < 64; p++, shift += 7) {
+        result |= (size_t)(*p & 0x7f) << shift;
+        if ((*p & 0x80) == 0) {
+            *value = result;
+            return p - in + 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,14 @@
+#ifndef VARINT_H_
+#define VARINT_H_
+
+#include <stdlib.h>
+
+// Unsigned LEB128: seven bits per byte, low bits first, the top bit set on every byte but the last.
+// The journal and the undo log store positions and lengths this way.
+
+#define MAX_VARINT 10
+
+size_t putVarint(unsigned char* out, size_t value);
+size_t getVarint(const unsigned char* in, const unsigned char* end, size_t* value);
+
+#endif
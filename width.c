@@ -0,0 +1,189 @@
+#include "width.h"
+#include <string.h>
+
+#define MIN_SLOTS 64
+#define EMPTY_WIDTH -1
+
+static size_t hashWidth(int width)
+{
+    return (size_t)((unsigned int)width * 2654435761u);
+}
+
+// Slot holding width, or the empty slot where it would go.
+static size_t findSlot(WidthIndex* index, int width)
+{
+    size_t mask = index->slotCount - 1;
+    size_t i = hashWidth(width) & mask;
+    while (index->slots[i].width != EMPTY_WIDTH && index->slots[i].width != width) {
+        i = (i + 1) & mask;
+    }
+    return i;
+}
+
+static void resetSlots(WidthIndex* index, size_t slotCount)
+{
+    index->slotCount = slotCount;
+    index->slots = (WidthCount*)malloc(sizeof(WidthCount) * slotCount);
+    for (size_t i = 0; i < slotCount; i++) {
+        index->slots[i] = (WidthCount){.width = EMPTY_WIDTH};
+    }
+    index->used = 0;
+}
+
+static void siftUp(WidthIndex* index, size_t i)
+{
+    int width = index->heap[i];
+    while (i > 0 && index->heap[(i - 1) / 2] < width) {
+        index->heap[i] = index->heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    index->heap[i] = width;
+}
+
+static void siftDown(WidthIndex* index, size_t i)
+{
+    int width = index->heap[i];
+    while (2 * i + 1 < index->heapLength) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < index->heapLength && index->heap[child + 1] > index->heap[child]) {
+            child++;
+        }
+        if (index->heap[child] <= width) {
+            break;
+        }
+        index->heap[i] = index->heap[child];
+        i = child;
+    }
+    index->heap[i] = width;
+}
+
+static void pushHeap(WidthIndex* index, int width)
+{
+    if (index->heapLength == index->heapCapacity) {
+        index->heapCapacity = index->heapCapacity == 0 ? MIN_SLOTS : index->heapCapacity * 2;
+        index->heap = (int*)realloc(index->heap, sizeof(int) * index->heapCapacity);
+    }
+    index->heap[index->heapLength++] = width;
+    siftUp(index, index->heapLength - 1);
+}
+
+// Builds the table and the heap again from the widths that are still counted. Drops every width
+// that was waiting to come off the heap.
+static void rebuild(WidthIndex* index, size_t slotCount)
+{
+    WidthCount* old = index->slots;
+    size_t oldCount = index->slotCount;
+    resetSlots(index, slotCount);
+    index->heapLength = 0;
+    for (size_t i = 0; i < oldCount; i++) {
+        if (old[i].width != EMPTY_WIDTH && old[i].count > 0) {
+            WidthCount* slot = &index->slots[findSlot(index, old[i].width)];
+            *slot = (WidthCount){.width = old[i].width, .inHeap = 1, .count = old[i].count};
+            index->used++;
+            index->heap[index->heapLength++] = old[i].width;
+        }
+    }
+    for (size_t i = index->heapLength / 2; i-- > 0;) {
+        siftDown(index, i);
+    }
+    free(old);
+}
+
+// Linear probing without tombstones: slots after the removed one are shifted back if their probe
+// sequence passes through the hole.
+static void removeSlot(WidthIndex* index, size_t hole)
+{
+    size_t mask = index->slotCount - 1;
+    index->slots[hole].width = EMPTY_WIDTH;
+    index->used--;
+    size_t i = hole;
+    while (1) {
+        i = (i + 1) & mask;
+        if (index->slots[i].width == EMPTY_WIDTH) {
+            return;
+        }
+        size_t home = hashWidth(index->slots[i].width) & mask;
+        int between = hole <= i ? (home > hole && home <= i) : (home > hole || home <= i);
+        if (!between) {
+            index->slots[hole] = index->slots[i];
+            index->slots[i].width = EMPTY_WIDTH;
+            hole = i;
+        }
+    }
+}
+
+WidthIndex* createWidthIndex(void)
+{
+    WidthIndex* index = (WidthIndex*)calloc(1, sizeof(WidthIndex));
+    resetSlots(index, MIN_SLOTS);
+    return index;
+}
+
+void freeWidthIndex(WidthIndex* index)
+{
+    if (index == NULL) {
+        return;
+    }
+    free(index->slots);
+    free(index->heap);
+    free(index);
+}
+
+void clearWidths(WidthIndex* index)
+{
+    free(index->slots);
+    resetSlots(index, MIN_SLOTS);
+    index->live = 0;
+    index->heapLength = 0;
+}
+
+void addWidth(WidthIndex* index, int width)
+{
+    if ((index->used + 1) * 2 > index->slotCount) {
+        rebuild(index, index->slotCount * 2);
+    }
+    WidthCount* slot = &index->slots[findSlot(index, width)];
+    if (slot->width == EMPTY_WIDTH) {
+        *slot = (WidthCount){.width = width};
+        index->used++;
+    }
+    if (slot->count++ == 0) {
+        index->live++;
+        if (!slot->inHeap) {
+            slot->inHeap = 1;
+            pushHeap(index, width);
+        }
+    }
+}
+
+void removeWidth(WidthIndex* index, int width)
+{
+    WidthCount* slot = &index->slots[findSlot(index, width)];
+    if (slot->width == EMPTY_WIDTH || slot->count == 0) {
+        return;
+    }
+    if (--slot->count == 0) {
+        index->live--;
+        // Widths that are no longer counted pile up below the top when a line keeps changing width.
+        if (index->heapLength > 2 * index->live + MIN_SLOTS) {
+            rebuild(index, index->slotCount);
+        }
+    }
+}
+
+// Widest width counted, 0 if there is none.
+int widestWidth(WidthIndex* index)
+{
+    while (index->heapLength > 0) {
+        size_t top = findSlot(index, index->heap[0]);
+        if (index->slots[top].count > 0) {
+            return index->heap[0];
+        }
+        removeSlot(index, top);
+        index->heap[0] = index->heap[--index->heapLength];
+        if (index->heapLength > 0) {
+            siftDown(index, 0);
+        }
+    }
+    return 0;
+}
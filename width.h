@@ -0,0 +1,33 @@
+#ifndef WIDTH_H_
+#define WIDTH_H_
+
+#include <stdlib.h>
+
+// Multiset of line widths. Each distinct width has a count in a hash table and sits in a max heap,
+// so the widest line is known without looking at the lines and a line changing width costs
+// O(log n). Widths whose count dropped to zero are only taken off the heap once they reach the top.
+
+typedef struct {
+    int width;
+    int inHeap;
+    size_t count;
+} WidthCount;
+
+typedef struct {
+    WidthCount* slots;
+    size_t slotCount;
+    size_t used;
+    size_t live;
+    int* heap;
+    size_t heapLength;
+    size_t heapCapacity;
+} WidthIndex;
+
+WidthIndex* createWidthIndex(void);
+void freeWidthIndex(WidthIndex* index);
+void clearWidths(WidthIndex* index);
+void addWidth(WidthIndex* index, int width);
+void removeWidth(WidthIndex* index, int width);
+int widestWidth(WidthIndex* index);
+
+#endif
@@ -0,0 +1,105 @@
+#include "wrap.h"
+#include "utf8.h"
+
+#define MIN_ROW_STARTS 16
+
+typedef struct {
+    int x;
+    size_t start;
+    // Offset just past the last space in the row, 0 if there is none yet.
+    size_t lastBreak;
+} RowState;
+
+// Goes through the characters of string, which starts at offset, until one does not fit on the row.
+// Returns the offset the next row starts at or 0 if the whole string fits.
+static size_t wrapSpan(RowState* row, Glyph_Map* glyphMap, const char* string, size_t length, size_t offset,
+                       int width)
+{
+    const char* end = string + length;
+    size_t used;
+    for (const char* c = string; c < end; c += used) {
+        Uint32 codepoint = decodeUtf8(c, end, &used);
+        size_t at = offset + (c - string);
+        if (codepoint == ' ' || codepoint == '\t') {
+            row->x = codepoint == '\t' ? tabStop(glyphMap, row->x) : row->x + glyphWidth(glyphMap, codepoint);
+            row->lastBreak = at + used;
+            continue;
+        }
+        int advance = codepoint < 32 ? 0 : glyphWidth(glyphMap, codepoint);
+        if (row->x + advance > width && at > row->start) {
+            return row->lastBreak != 0 ? row->lastBreak : at;
+        }
+        row->x += advance;
+    }
+    return 0;
+}
+
+// Offset the row starting at start ends at, the length of the line for its last row.
+size_t wrapRowEnd(Glyph_Map* glyphMap, const LineSpan* line, size_t start, int width)
+{
+    RowState row = {.x = 0, .start = start, .lastBreak = 0};
+    if (start < line->beforeLength) {
+        size_t end = wrapSpan(&row, glyphMap, line->before + start, line->beforeLength - start, start, width);
+        if (end != 0) {
+            return end;
+        }
+        start = line->beforeLength;
+    }
+    size_t after = start - line->beforeLength;
+    size_t end = wrapSpan(&row, glyphMap, line->after + after, line->afterLength - after, start, width);
+    return end != 0 ? end : line->beforeLength + line->afterLength;
+}
+
+// Stores where each row of the line starts, the first at 0.
+void wrapLine(RowStarts* rows, Glyph_Map* glyphMap, const LineSpan* line, int width)
+{
+    size_t length = line->beforeLength + line->afterLength;
+    size_t start = 0;
+    rows->count = 0;
+    do {
+        if (rows->count == rows->capacity) {
+            rows->capacity = rows->capacity == 0 ? MIN_ROW_STARTS : rows->capacity * 2;
+            rows->starts = (size_t*)realloc(rows->starts, sizeof(size_t) * rows->capacity);
+        }
+        rows->starts[rows->count++] = start;
+        start = wrapRowEnd(glyphMap, line, start, width);
+    } while (start < length);
+}
+
+int countWrappedRows(Glyph_Map* glyphMap, const LineSpan* line, int width)
+{
+    size_t length = line->beforeLength + line->afterLength;
+    size_t start = 0;
+    int rows = 0;
+    do {
+        rows++;
+        start = wrapRowEnd(glyphMap, line, start, width);
+    } while (start < length);
+    return rows;
+}
+
+// Row the character at index is on. An index where a row starts is on that row, not at the end of
+// the one before.
+size_t rowOfIndex(const RowStarts* rows, size_t index)
+{
+    size_t low = 0;
+    size_t high = rows->count;
+    while (high - low > 1) {
+        size_t middle = low + (high - low) / 2;
+        if (rows->starts[middle] <= index) {
+            low = middle;
+        }
+        else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+void freeRowStarts(RowStarts* rows)
+{
+    free(rows->starts);
+    rows->starts = NULL;
+    rows->count = 0;
+    rows->capacity = 0;
+}
@@ -0,0 +1,23 @@
+#ifndef WRAP_H_
+#define WRAP_H_
+
+#include "glyph.h"
+#include "line.h"
+
+// Soft wrapping: a row ends after the last space that fits, or before the first character that does
+// not fit if the row has no space. Spaces hang past the end of a row instead of starting the next
+// one. Tabs stop relative to the start of their row.
+
+typedef struct {
+    size_t* starts;
+    size_t count;
+    size_t capacity;
+} RowStarts;
+
+size_t wrapRowEnd(Glyph_Map* glyphMap, const LineSpan* line, size_t start, int width);
+void wrapLine(RowStarts* rows, Glyph_Map* glyphMap, const LineSpan* line, int width);
+int countWrappedRows(Glyph_Map* glyphMap, const LineSpan* line, int width);
+size_t rowOfIndex(const RowStarts* rows, size_t index);
+void freeRowStarts(RowStarts* rows);
+
+#endif